@@ -0,0 +1,11 @@
+// Builds the sketch for the host. setup() and loop() come straight from
+// test_bench.ino; the manager sources are compiled alongside unmodified.
+#include <new>
+#include "../test_bench/test_bench.ino"
+
+// Soft reset of the sketch: everything in RAM starts over from its constructor, while
+// RTC_NOINIT_ATTR storage keeps what was written before
+void resetSketch() {
+  vehicleSystem.~VehicleSystem();
+  new (&vehicleSystem) VehicleSystem();
+}
@@ -0,0 +1,398 @@
+// Fleet simulator: runs many independent copies of the firmware, each with its
+// own board, car and VehicleSystem, and gives every copy a pseudo-terminal
+// that a control server opens like a real vehicle's serial port. All boards
+// share one virtual clock that advances in fixed epochs paced to wall-clock
+// time; each epoch the boards are stepped on a pool of --threads workers.
+//
+//   fleet_runner --vehicles 200 --link /tmp/fleet
+//   fleet_runner --vehicles 50 --speed 0 --duration 60000 --script scripts/bci_session.txt
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <termios.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../test_bench/include/vehicle_system.h"
+#include "simulation.h"
+#include "work_stealing_pool.h"
+#include "world.h"
+
+// Virtual time a fleet without --duration is allowed to run for
+static const unsigned long UNBOUNDED_DURATION_MS = 30UL * 24 * 3600 * 1000;
+
+// Bytes taken from one pseudo-terminal per epoch; the UART FIFO drops the rest anyway
+static const size_t INPUT_CHUNK = 256;
+
+// Default floor: a room with scattered posts, as in the parameter sweep
+static const char* DEFAULT_WORLD =
+  "arena 400 300\n"
+  "post 130 90 12\n"
+  "post 160 210 15\n"
+  "box 230 120 40 40\n"
+  "post 310 60 10\n"
+  "post 330 220 12\n"
+  "start 40 60 20\n";
+
+static std::atomic<bool> interrupted(false);
+
+static void onSignal(int signal) {
+  (void)signal;
+  interrupted = true;
+}
+
+class SystemFirmware : public SimFirmware {
+  private:
+    VehicleSystem& system;
+
+  public:
+    explicit SystemFirmware(VehicleSystem& vehicleSystem) : system(vehicleSystem) {}
+    void setup() override { system.setup(); }
+    void loop() override { system.loop(); }
+};
+
+class FleetHost;
+
+// One simulated vehicle and its pseudo-terminal
+struct FleetVehicle {
+  int index;
+  int masterFd;
+  int slaveFd;             // Held open so the port keeps its settings between clients
+  std::string port;
+  std::string linkPath;
+  std::string inbox;       // Input read by the coordinator, typed at the next epoch
+
+  // The vehicle's whole state lives with its board, so any worker can step it
+  std::unique_ptr<VehicleSystem> system;
+  std::unique_ptr<SystemFirmware> firmware;
+  std::unique_ptr<Simulation> simulation;
+  std::unique_ptr<FleetHost> host;
+  bool running;
+
+  // Filled in by whichever worker steps the vehicle
+  unsigned long bytesIn;
+  unsigned long bytesOut;
+  unsigned long bytesDropped;
+
+  FleetVehicle() : index(0), masterFd(-1), slaveFd(-1), running(false), bytesIn(0), bytesOut(0),
+                   bytesDropped(0) {}
+};
+
+// Host side of one vehicle: types what arrived on the pseudo-terminal during
+// the last epoch and copies output back to it
+class FleetHost : public SimOperator, public SimSerialListener {
+  private:
+    FleetVehicle& vehicle;
+
+  public:
+    explicit FleetHost(FleetVehicle& fleetVehicle) : vehicle(fleetVehicle) {}
+
+    void onStep(uint64_t nowMicros, const SimCar& car, SimBoard& board) override {
+      if (!vehicle.inbox.empty()) {
+        board.feedSerial(vehicle.inbox.c_str());
+        vehicle.bytesIn += vehicle.inbox.size();
+        vehicle.inbox.clear();
+      }
+    }
+
+    void onSerialOutput(uint64_t nowMicros, const char* data, size_t size) override {
+      while (size > 0) {
+        ssize_t written = write(vehicle.masterFd, data, size);
+        if (written > 0) {
+          vehicle.bytesOut += written;
+          data += written;
+          size -= written;
+        } else if (written < 0 && errno == EINTR) {
+          continue;
+        } else {
+          vehicle.bytesDropped += size;  // Nobody is reading the port and its buffer is full
+          return;
+        }
+      }
+    }
+};
+
+static bool openPort(FleetVehicle* vehicle, std::string* error) {
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  char name[64];
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0 || ptsname_r(master, name, sizeof(name)) != 0) {
+    *error = std::string("cannot create a pseudo-terminal: ") + strerror(errno);
+    if (master >= 0) {
+      close(master);
+    }
+    return false;
+  }
+
+  int slave = open(name, O_RDWR | O_NOCTTY);
+  termios settings;
+  if (slave < 0 || tcgetattr(slave, &settings) != 0) {
+    *error = std::string("cannot open ") + name + ": " + strerror(errno);
+    close(master);
+    return false;
+  }
+  // Raw 8-bit line like the USB serial port: no echo, no line editing
+  cfmakeraw(&settings);
+  cfsetspeed(&settings, B115200);
+  tcsetattr(slave, TCSANOW, &settings);
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+  vehicle->masterFd = master;
+  vehicle->slaveFd = slave;
+  vehicle->port = name;
+  return true;
+}
+
+static void closePort(FleetVehicle* vehicle) {
+  if (!vehicle->linkPath.empty()) {
+    unlink(vehicle->linkPath.c_str());
+  }
+  close(vehicle->slaveFd);
+  close(vehicle->masterFd);
+}
+
+// Take whatever the clients have written since the last epoch
+static void readPorts(std::vector<FleetVehicle>& vehicles, std::vector<pollfd>& fds) {
+  if (poll(fds.data(), fds.size(), 0) <= 0) {
+    return;
+  }
+  char buffer[INPUT_CHUNK];
+  for (size_t i = 0; i < fds.size(); i++) {
+    if ((fds[i].revents & POLLIN) == 0) {
+      continue;
+    }
+    ssize_t count = read(fds[i].fd, buffer, sizeof(buffer));
+    for (ssize_t c = 0; c < count; c++) {
+      if (buffer[c] != '\0') {
+        vehicles[i].inbox += buffer[c];
+      }
+    }
+  }
+}
+
+// Pseudo-terminals take two descriptors each; raise the soft limit as far as allowed
+static void raiseDescriptorLimit() {
+  rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+static void printUsage(const char* program) {
+  printf("Usage: %s [options]\n", program);
+  printf("  --vehicles N     Simulated vehicles, each with its own pseudo-terminal (default 4)\n");
+  printf("  --threads N      Worker threads stepping the vehicles (default: all cores)\n");
+  printf("  --epoch MS       Step of the shared virtual clock; input is typed at epoch boundaries (default 10)\n");
+  printf("  --speed X        Virtual time per wall-clock time, 0 for as fast as possible (default 1)\n");
+  printf("  --duration MS    Virtual time to run for (default: until interrupted)\n");
+  printf("  --world FILE     Floor every vehicle drives on (default: built-in room with posts)\n");
+  printf("  --script FILE    Type '<ms> <command>' lines into every vehicle\n");
+  printf("  --link DIR       Create DIR/vehicle-N symlinks to the ports\n");
+  printf("  --seed N         Sensor noise seed; vehicle N uses seed + N\n");
+  printf("  --no-alloc       Exit 1 if any firmware allocates from the heap inside loop()\n");
+  printf("  --quiet          Print only the fleet totals at the end\n");
+}
+
+int main(int argc, char** argv) {
+  int vehicleCount = 4;
+  unsigned int threads = 0;
+  unsigned long epochMillis = 10;
+  double speed = 1.0;
+  unsigned long durationMillis = 0;
+  unsigned int seed = 1;
+  bool failOnAlloc = false;
+  bool quiet = false;
+  std::string worldPath, scriptPath, linkDir;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(arg, "--vehicles") == 0 && hasValue) {
+      vehicleCount = atoi(argv[++i]);
+    } else if (strcmp(arg, "--threads") == 0 && hasValue) {
+      threads = static_cast<unsigned int>(atoi(argv[++i]));
+    } else if (strcmp(arg, "--epoch") == 0 && hasValue) {
+      epochMillis = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(arg, "--speed") == 0 && hasValue) {
+      speed = atof(argv[++i]);
+    } else if (strcmp(arg, "--duration") == 0 && hasValue) {
+      durationMillis = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(arg, "--world") == 0 && hasValue) {
+      worldPath = argv[++i];
+    } else if (strcmp(arg, "--script") == 0 && hasValue) {
+      scriptPath = argv[++i];
+    } else if (strcmp(arg, "--link") == 0 && hasValue) {
+      linkDir = argv[++i];
+    } else if (strcmp(arg, "--seed") == 0 && hasValue) {
+      seed = static_cast<unsigned int>(strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(arg, "--no-alloc") == 0) {
+      failOnAlloc = true;
+    } else if (strcmp(arg, "--quiet") == 0) {
+      quiet = true;
+    } else {
+      printUsage(argv[0]);
+      return strcmp(arg, "--help") == 0 ? 0 : 2;
+    }
+  }
+  if (vehicleCount < 1 || epochMillis < 1 || speed < 0) {
+    fprintf(stderr, "Need at least one vehicle, an epoch of at least 1 ms and a speed of 0 or more\n");
+    return 2;
+  }
+
+  World world;
+  std::string error;
+  if (worldPath.empty() ? !world.parse(DEFAULT_WORLD, &error) : !world.loadFile(worldPath, &error)) {
+    fprintf(stderr, "World: %s\n", error.c_str());
+    return 2;
+  }
+  std::vector<ScriptCommand> script;
+  if (!scriptPath.empty() && !loadScriptFile(scriptPath, &script, &error)) {
+    fprintf(stderr, "Script: %s\n", error.c_str());
+    return 2;
+  }
+
+  raiseDescriptorLimit();
+  std::vector<FleetVehicle> vehicles(vehicleCount);
+  std::vector<pollfd> fds(vehicleCount);
+  for (int i = 0; i < vehicleCount; i++) {
+    vehicles[i].index = i;
+    if (!openPort(&vehicles[i], &error)) {
+      fprintf(stderr, "Vehicle %d: %s\n", i, error.c_str());
+      for (int j = 0; j < i; j++) {
+        closePort(&vehicles[j]);
+      }
+      return 1;
+    }
+    if (!linkDir.empty()) {
+      vehicles[i].linkPath = linkDir + "/vehicle-" + std::to_string(i);
+      unlink(vehicles[i].linkPath.c_str());
+      if (symlink(vehicles[i].port.c_str(), vehicles[i].linkPath.c_str()) != 0) {
+        fprintf(stderr, "Cannot link %s: %s\n", vehicles[i].linkPath.c_str(), strerror(errno));
+        vehicles[i].linkPath.clear();
+      }
+    }
+    fds[i].fd = vehicles[i].masterFd;
+    fds[i].events = POLLIN;
+    printf("vehicle %d: %s%s%s\n", i, vehicles[i].port.c_str(),
+           vehicles[i].linkPath.empty() ? "" : " -> ", vehicles[i].linkPath.c_str());
+  }
+  WorkStealingPool pool(threads);
+  printf("Fleet of %d on %u worker threads, %lu ms epochs, %s\n", vehicleCount, pool.getThreadCount(), epochMillis,
+         speed > 0 ? "paced to wall-clock time" : "unpaced");
+  fflush(stdout);
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  SimulationOptions options;
+  options.durationMillis = durationMillis > 0 ? durationMillis : UNBOUNDED_DURATION_MS;
+
+  const uint64_t epochMicros = static_cast<uint64_t>(epochMillis) * 1000;
+  std::vector<size_t> active;
+  for (size_t i = 0; i < vehicles.size(); i++) {
+    FleetVehicle& vehicle = vehicles[i];
+    SimulationOptions vehicleOptions = options;
+    vehicleOptions.seed = seed + vehicle.index;
+    vehicle.system.reset(new VehicleSystem());
+    vehicle.firmware.reset(new SystemFirmware(*vehicle.system));
+    vehicle.simulation.reset(new Simulation(world, CarModel(), vehicleOptions));
+    vehicle.host.reset(new FleetHost(vehicle));
+    vehicle.simulation->setOutputTap(vehicle.host.get());
+    active.push_back(i);
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  pool.run(active.size(), [&](size_t task) {
+    FleetVehicle& vehicle = vehicles[active[task]];
+    vehicle.simulation->begin(*vehicle.firmware, script, vehicle.host.get());
+  });
+
+  // Coordinator: step every running vehicle to the end of the epoch, hold until
+  // wall-clock time catches up, then hand over the input that arrived meanwhile
+  uint64_t epochEnd = epochMicros;
+  unsigned long epochs = 0;
+  unsigned long lateEpochs = 0;
+  double worstLagMillis = 0;
+  std::function<void(size_t)> step = [&](size_t task) {
+    FleetVehicle& vehicle = vehicles[active[task]];
+    vehicle.running = vehicle.simulation->runUntil(epochEnd);
+  };
+  while (!active.empty() && !interrupted) {
+    pool.run(active.size(), step);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < active.size(); i++) {
+      if (vehicles[active[i]].running) {
+        active[kept++] = active[i];
+      }
+    }
+    active.resize(kept);
+    if (active.empty() || interrupted) {
+      break;
+    }
+
+    if (speed > 0) {
+      std::chrono::steady_clock::time_point due =
+        start + std::chrono::microseconds(static_cast<int64_t>(epochEnd / speed));
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (now > due + std::chrono::microseconds(epochMicros)) {
+        lateEpochs++;
+        double lag = std::chrono::duration<double, std::milli>(now - due).count();
+        if (lag > worstLagMillis) {
+          worstLagMillis = lag;
+        }
+      } else {
+        std::this_thread::sleep_until(due);
+      }
+    }
+    readPorts(vehicles, fds);
+    epochEnd += epochMicros;
+    epochs++;
+  }
+  double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  unsigned long bytesIn = 0, bytesOut = 0, bytesDropped = 0, collisions = 0, allocations = 0;
+  if (!quiet) {
+    printf("\nvehicle  port          iterations  collisions  distance cm  bytes in  bytes out  dropped\n");
+  }
+  for (size_t i = 0; i < vehicles.size(); i++) {
+    FleetVehicle& vehicle = vehicles[i];
+    vehicle.simulation->end();
+    const Simulation& simulation = *vehicle.simulation;
+    if (!quiet) {
+      printf("%7d  %-12s  %10lu  %10lu  %11.0f  %8lu  %9lu  %7lu\n", vehicle.index, vehicle.port.c_str(),
+             simulation.getLoopIterations(), simulation.getCar().getCollisions(),
+             simulation.getCar().getDistanceTravelled(), vehicle.bytesIn, vehicle.bytesOut, vehicle.bytesDropped);
+    }
+    bytesIn += vehicle.bytesIn;
+    bytesOut += vehicle.bytesOut;
+    bytesDropped += vehicle.bytesDropped;
+    collisions += simulation.getCar().getCollisions();
+    allocations += simulation.getLoopAllocations();
+    closePort(&vehicles[i]);
+  }
+
+  double virtualSeconds = epochEnd / 1e6;
+  printf("\nFleet: %zu vehicles, %.1f s virtual in %.1f s wall (%.1fx real time)\n", vehicles.size(),
+         virtualSeconds, wallSeconds, wallSeconds > 0 ? virtualSeconds / wallSeconds : 0.0);
+  if (speed > 0) {
+    printf("Schedule: %lu of %lu epochs late, worst lag %.1f ms\n", lateEpochs, epochs, worstLagMillis);
+  }
+  printf("Serial: %lu bytes in, %lu bytes out, %lu dropped while nobody read the port\n",
+         bytesIn, bytesOut, bytesDropped);
+  printf("Collisions: %lu\n", collisions);
+  printf("Heap: %lu allocations in loop() across the fleet\n", allocations);
+  return failOnAlloc && allocations > 0 ? 1 : 0;
+}
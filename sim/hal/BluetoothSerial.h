@@ -0,0 +1,18 @@
+#ifndef BLUETOOTH_SERIAL_H
+#define BLUETOOTH_SERIAL_H
+
+#include <Arduino.h>
+
+// The simulator has no radio; this stub keeps bt_manager.cpp compiling and
+// behaves like a Bluetooth link that never receives any data.
+class BluetoothSerial : public Print {
+  public:
+    bool begin(const String& name) { (void)name; return true; }
+    bool deleteAllBondedDevices() { return true; }
+    int available() { return 0; }
+    int read() { return -1; }
+    size_t write(uint8_t c) override { (void)c; return 1; }
+    using Print::write;
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef ESP_H
+#define ESP_H
+
+#include <cstdint>
+
+// Heap figures come from the allocations the firmware made on the bound
+// SimBoard, measured against the DRAM heap of a freshly booted ESP32.
+class EspClass {
+  public:
+    uint32_t getHeapSize();
+    uint32_t getFreeHeap();
+    uint32_t getMinFreeHeap();
+    uint32_t getMaxAllocHeap();
+};
+
+extern EspClass ESP;
+
+#endif
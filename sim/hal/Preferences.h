@@ -0,0 +1,23 @@
+#ifndef PREFERENCES_H
+#define PREFERENCES_H
+
+#include <cstddef>
+
+// NVS namespace as the ESP32 Arduino core opens it. Entries live on the bound
+// SimBoard, which keeps them across reset() as flash would.
+class Preferences {
+  private:
+    const char* name;
+    bool readOnly;
+
+  public:
+    Preferences() : name(nullptr), readOnly(true) {}
+
+    bool begin(const char* nameSpace, bool readOnlyMode = false, const char* partitionLabel = nullptr);
+    void end();
+    size_t putBytes(const char* key, const void* value, size_t len);
+    size_t getBytesLength(const char* key);
+    size_t getBytes(const char* key, void* buf, size_t maxLen);
+};
+
+#endif
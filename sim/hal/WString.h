@@ -0,0 +1,102 @@
+#ifndef WSTRING_H
+#define WSTRING_H
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// Host stand-in for the Arduino String class. Only the subset of the API
+// used by the firmware is provided; storage is a std::string, so every
+// temporary allocates exactly like the heap-backed original does.
+class String {
+  private:
+    std::string buffer;
+
+  public:
+    String() {}
+    String(const char* str) : buffer(str ? str : "") {}
+    String(const std::string& str) : buffer(str) {}
+    explicit String(char c) : buffer(1, c) {}
+    explicit String(int value) : buffer(std::to_string(value)) {}
+    explicit String(unsigned int value) : buffer(std::to_string(value)) {}
+    explicit String(long value) : buffer(std::to_string(value)) {}
+    explicit String(unsigned long value) : buffer(std::to_string(value)) {}
+    explicit String(float value, unsigned int decimals = 2) { setFloat(value, decimals); }
+    explicit String(double value, unsigned int decimals = 2) { setFloat(value, decimals); }
+
+    unsigned int length() const { return buffer.length(); }
+    const char* c_str() const { return buffer.c_str(); }
+    bool reserve(unsigned int size) { buffer.reserve(size); return true; }
+
+    char charAt(unsigned int index) const { return index < buffer.length() ? buffer[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+
+    int indexOf(char c, unsigned int from = 0) const {
+      std::string::size_type pos = buffer.find(c, from);
+      return pos == std::string::npos ? -1 : static_cast<int>(pos);
+    }
+
+    int indexOf(const String& str, unsigned int from = 0) const {
+      std::string::size_type pos = buffer.find(str.buffer, from);
+      return pos == std::string::npos ? -1 : static_cast<int>(pos);
+    }
+
+    String substring(unsigned int from) const {
+      return from >= buffer.length() ? String() : String(buffer.substr(from));
+    }
+
+    String substring(unsigned int from, unsigned int to) const {
+      if (from > to) {
+        unsigned int tmp = from;
+        from = to;
+        to = tmp;
+      }
+      if (from >= buffer.length()) {
+        return String();
+      }
+      return String(buffer.substr(from, to - from));
+    }
+
+    long toInt() const { return strtol(buffer.c_str(), nullptr, 10); }
+    float toFloat() const { return strtof(buffer.c_str(), nullptr); }
+
+    void trim() {
+      std::string::size_type start = 0;
+      while (start < buffer.length() && isspace(static_cast<unsigned char>(buffer[start]))) start++;
+      std::string::size_type end = buffer.length();
+      while (end > start && isspace(static_cast<unsigned char>(buffer[end - 1]))) end--;
+      buffer = buffer.substr(start, end - start);
+    }
+
+    void toLowerCase() {
+      for (std::string::size_type i = 0; i < buffer.length(); i++) {
+        buffer[i] = static_cast<char>(tolower(static_cast<unsigned char>(buffer[i])));
+      }
+    }
+
+    bool equals(const String& other) const { return buffer == other.buffer; }
+    bool equals(const char* other) const { return buffer == (other ? other : ""); }
+    bool operator==(const String& other) const { return equals(other); }
+    bool operator==(const char* other) const { return equals(other); }
+    bool operator!=(const String& other) const { return !equals(other); }
+    bool operator!=(const char* other) const { return !equals(other); }
+
+    String& operator+=(const String& other) { buffer += other.buffer; return *this; }
+    String& operator+=(const char* other) { if (other) buffer += other; return *this; }
+    String& operator+=(char c) { buffer += c; return *this; }
+
+    friend String operator+(const String& lhs, const String& rhs) { return String(lhs.buffer + rhs.buffer); }
+    friend String operator+(const String& lhs, const char* rhs) { return String(lhs.buffer + (rhs ? rhs : "")); }
+    friend String operator+(const char* lhs, const String& rhs) { return String((lhs ? lhs : "") + rhs.buffer); }
+    friend String operator+(const String& lhs, char rhs) { return String(lhs.buffer + rhs); }
+
+  private:
+    void setFloat(double value, unsigned int decimals) {
+      char tmp[48];
+      snprintf(tmp, sizeof(tmp), "%.*f", static_cast<int>(decimals), value);
+      buffer = tmp;
+    }
+};
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef ESP_ATTR_H
+#define ESP_ATTR_H
+
+// RTC memory survives a soft reset on the ESP32. On the host, RTC_NOINIT_ATTR
+// variables are collected in one thread-local section that works as a scratch
+// copy: the contents belong to the SimBoard, which loads them when bound to a
+// thread and saves them when unbound, so a board can move between threads.
+#define RTC_NOINIT_ATTR __attribute__((section("sim_rtc_noinit"))) thread_local
+#define IRAM_ATTR
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+// Reset causes as reported by ESP-IDF
+typedef enum {
+  ESP_RST_UNKNOWN,
+  ESP_RST_POWERON,
+  ESP_RST_EXT,
+  ESP_RST_SW,
+  ESP_RST_PANIC,
+  ESP_RST_INT_WDT,
+  ESP_RST_TASK_WDT,
+  ESP_RST_WDT,
+  ESP_RST_DEEPSLEEP,
+  ESP_RST_BROWNOUT,
+  ESP_RST_SDIO
+} esp_reset_reason_t;
+
+// Why the board bound to the calling thread last started: power-on, or whatever SimBoard::reset() was given
+esp_reset_reason_t esp_reset_reason();
+
+#endif
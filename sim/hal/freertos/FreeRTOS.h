@@ -0,0 +1,20 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <cstdint>
+
+// The simulator runs each firmware instance on a plain host thread; there
+// are no FreeRTOS tasks to inspect.
+typedef void* TaskHandle_t;
+typedef unsigned int UBaseType_t;
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+
+// One tick per millisecond, as configured for the Arduino core
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef FREERTOS_TASK_H
+#define FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+inline TaskHandle_t xTaskGetHandle(const char* name) { (void)name; return nullptr; }
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { (void)task; return 0; }
+
+// Direct-to-task notifications. The only task is the loop, which maps to the
+// board bound to the thread; a blocked wait keeps the host side of the
+// simulation running so input can arrive and wake it.
+TaskHandle_t xTaskGetCurrentTaskHandle();
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+#endif
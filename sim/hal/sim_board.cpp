@@ -0,0 +1,652 @@
+#include "sim_board.h"
+#include <Arduino.h>
+#include <Preferences.h>
+#include <algorithm>
+#include <link.h>
+
+// HC-SR04 fires its 40 kHz burst after the trigger falls and only then
+// raises the echo line; roughly 8 cycles plus internal processing.
+static const unsigned long ECHO_START_LATENCY_US = 460;
+
+// UART0 at 115200 baud, 10 bits per byte. The Arduino core installs the UART
+// driver without a transmit ring, so a write blocks until its bytes fit in
+// the 128-byte hardware FIFO.
+static const uint64_t SERIAL_BYTE_US = 87;
+static const uint64_t SERIAL_TX_FIFO = 128;
+
+// The receive event fires once the line has been idle for the RX timeout,
+// two byte times by default
+static const uint64_t SERIAL_RX_TIMEOUT_US = 2 * SERIAL_BYTE_US;
+
+// Granularity at which time spent in the firmware lets the host side run
+static const uint64_t IDLE_STEP_US = 1000;
+
+static thread_local SimBoard* boundBoard = nullptr;
+static thread_local bool firmwareRunning = false;
+
+HardwareSerial Serial;
+
+// RTC_NOINIT_ATTR variables, gathered by the linker; weak so binaries without firmware link too
+extern "C" char __start_sim_rtc_noinit[] __attribute__((weak));
+extern "C" char __stop_sim_rtc_noinit[] __attribute__((weak));
+
+// The section's address is that of its thread-local template. The calling thread's copy sits at
+// the same offset in its block of the executable's TLS segment.
+static int findRtcMemory(dl_phdr_info* info, size_t size, void* found) {
+  (void)size;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr)& segment = info->dlpi_phdr[i];
+    char* image = reinterpret_cast<char*>(info->dlpi_addr + segment.p_vaddr);
+    if (segment.p_type == PT_TLS && info->dlpi_tls_data != nullptr && __start_sim_rtc_noinit >= image &&
+        __start_sim_rtc_noinit < image + segment.p_memsz) {
+      *static_cast<char**>(found) = static_cast<char*>(info->dlpi_tls_data) + (__start_sim_rtc_noinit - image);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// The calling thread's copy of the RTC section, looked up once per thread; size 0 if the
+// firmware has none
+static char* threadRtcMemory(size_t* size) {
+  static thread_local bool found = false;
+  static thread_local char* memory = nullptr;
+  if (!found) {
+    if (__stop_sim_rtc_noinit - __start_sim_rtc_noinit > 0) {
+      dl_iterate_phdr(findRtcMemory, &memory);
+    }
+    found = true;
+  }
+  *size = memory != nullptr ? static_cast<size_t>(__stop_sim_rtc_noinit - __start_sim_rtc_noinit) : 0;
+  return memory;
+}
+
+SimBoard::SimBoard() {
+  nowMicros = 0;
+  plant = nullptr;
+  memset(pinLevels, 0, sizeof(pinLevels));
+  memset(pwmDuty, 0, sizeof(pwmDuty));
+  enPin = dataPin = clockPin = latchPin = pwmLeftPin = pwmRightPin = -1;
+  shiftRegister = 0;
+  latchedDirection = 0;
+  trigPin = echoPin = -1;
+  pingPending = false;
+  rxHead = rxTail = 0;
+  serialListener = nullptr;
+  txIdleAt = 0;
+  receivePending = false;
+  receiveEventAt = 0;
+  notifyCount = 0;
+  idleListener = nullptr;
+  yieldAt = UINT64_MAX;
+  resetReason = ESP_RST_POWERON;
+  hangAt = 0;
+  hangFor = 0;
+  memset(&stats, 0, sizeof(stats));
+  memset(&heap, 0, sizeof(heap));
+  trace = nullptr;
+  rtcMemory.assign(__stop_sim_rtc_noinit - __start_sim_rtc_noinit, 0);
+}
+
+SimBoard* SimBoard::current() {
+  return boundBoard;
+}
+
+// Swap the thread's RTC section from the bound board's image to the next board's
+static void switchBoard(SimBoard* from, SimBoard* to) {
+  if (from != to) {
+    if (from != nullptr) {
+      from->saveRtcMemory();
+    }
+    if (to != nullptr) {
+      to->loadRtcMemory();
+    }
+  }
+  boundBoard = to;
+}
+
+SimBoard::Scope::Scope(SimBoard* board) {
+  previous = boundBoard;
+  switchBoard(previous, board);
+}
+
+SimBoard::Scope::~Scope() {
+  switchBoard(boundBoard, previous);
+}
+
+SimBoard::FirmwareScope::FirmwareScope() {
+  previous = firmwareRunning;
+  firmwareRunning = true;
+}
+
+SimBoard::FirmwareScope::~FirmwareScope() {
+  firmwareRunning = previous;
+}
+
+SimBoard::HostScope::HostScope() {
+  previous = firmwareRunning;
+  firmwareRunning = false;
+}
+
+SimBoard::HostScope::~HostScope() {
+  firmwareRunning = previous;
+}
+
+bool SimBoard::inFirmware() {
+  return firmwareRunning;
+}
+
+void SimBoard::attachPlant(SimPlant* physicalPlant) {
+  plant = physicalPlant;
+  if (plant != nullptr) {
+    plant->advanceTo(nowMicros);
+  }
+}
+
+void SimBoard::setMotorPins(int en, int data, int clock, int latch, int pwmLeft, int pwmRight) {
+  enPin = en;
+  dataPin = data;
+  clockPin = clock;
+  latchPin = latch;
+  pwmLeftPin = pwmLeft;
+  pwmRightPin = pwmRight;
+}
+
+void SimBoard::setUltrasonicPins(int trig, int echo) {
+  trigPin = trig;
+  echoPin = echo;
+}
+
+uint64_t SimBoard::now() const {
+  return nowMicros;
+}
+
+void SimBoard::advance(uint64_t micros) {
+  nowMicros += micros;
+  if (plant != nullptr) {
+    HostScope host;
+    plant->advanceTo(nowMicros);
+  }
+}
+
+void SimBoard::step(uint64_t maxMicros) {
+  uint64_t stepMicros = std::min(IDLE_STEP_US, maxMicros);
+  if (receivePending && receiveEventAt > nowMicros) {
+    stepMicros = std::min(stepMicros, receiveEventAt - nowMicros);
+  }
+  advance(stepMicros);
+  if (idleListener != nullptr) {
+    HostScope host;
+    idleListener->onIdleStep(nowMicros);
+  }
+  serviceSerialEvents();
+}
+
+void SimBoard::spend(uint64_t micros) {
+  if (hangFor > 0 && nowMicros >= hangAt) {
+    if (trace != nullptr) {
+      trace->instant(nowMicros, "injected hang");
+    }
+    micros += hangFor;
+    hangFor = 0;
+  }
+  uint64_t deadline = nowMicros + micros;
+  while (nowMicros < deadline) {
+    step(deadline - nowMicros);
+  }
+}
+
+void SimBoard::setYieldAt(uint64_t atMicros) {
+  yieldAt = atMicros;
+}
+
+void SimBoard::setHang(uint64_t atMicros, uint64_t forMicros) {
+  hangAt = atMicros;
+  hangFor = forMicros;
+}
+
+void SimBoard::blockFor(uint64_t micros) {
+  stats.delayMicros += micros;
+  if (trace != nullptr) {
+    trace->begin(nowMicros, "delay", false);
+  }
+  spend(micros);
+  if (trace != nullptr) {
+    trace->end(nowMicros, "delay");
+  }
+}
+
+void SimBoard::reset(esp_reset_reason_t reason) {
+  resetReason = reason;
+  memset(pinLevels, 0, sizeof(pinLevels));
+  memset(pwmDuty, 0, sizeof(pwmDuty));
+  shiftRegister = 0;
+  latchedDirection = 0;
+  pingPending = false;
+  rxHead = rxTail = 0;
+  receiveCallback = nullptr;
+  receivePending = false;
+  notifyCount = 0;
+  notifyMotors();
+}
+
+esp_reset_reason_t SimBoard::getResetReason() const {
+  return resetReason;
+}
+
+void SimBoard::saveRtcMemory() {
+  size_t size;
+  char* memory = threadRtcMemory(&size);
+  if (size > 0) {
+    memcpy(rtcMemory.data(), memory, size);
+  }
+}
+
+void SimBoard::loadRtcMemory() {
+  size_t size;
+  char* memory = threadRtcMemory(&size);
+  if (size > 0) {
+    memcpy(memory, rtcMemory.data(), size);
+  }
+}
+
+const std::vector<uint8_t>* SimBoard::readFlash(const std::string& key) const {
+  auto entry = flash.find(key);
+  return entry == flash.end() ? nullptr : &entry->second;
+}
+
+void SimBoard::writeFlash(const std::string& key, const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  flash[key].assign(bytes, bytes + size);
+}
+
+void SimBoard::notifyMotors() {
+  if (plant == nullptr) {
+    return;
+  }
+  // The shift register's output enable is active low
+  bool enabled = enPin >= 0 && pinLevels[enPin] == LOW;
+  int left = pwmLeftPin >= 0 ? pwmDuty[pwmLeftPin] : 0;
+  int right = pwmRightPin >= 0 ? pwmDuty[pwmRightPin] : 0;
+  HostScope host;
+  plant->setMotorOutputs(nowMicros, latchedDirection, enabled, left, right);
+}
+
+void SimBoard::writePin(uint8_t pin, uint8_t value) {
+  if (pin >= PIN_COUNT) {
+    return;
+  }
+  uint8_t previous = pinLevels[pin];
+  pinLevels[pin] = value ? HIGH : LOW;
+
+  if (pin == trigPin && previous == HIGH && value == LOW) {
+    // Falling edge of the trigger pulse starts a measurement
+    pingPending = true;
+    stats.pings++;
+  } else if (pin == latchPin && previous == LOW && value == HIGH) {
+    // Rising edge of the storage clock copies the shift register to the outputs
+    latchedDirection = shiftRegister;
+    stats.motorWrites++;
+    notifyMotors();
+  } else if (pin == enPin && previous != pinLevels[pin]) {
+    notifyMotors();
+  }
+}
+
+int SimBoard::readPin(uint8_t pin) const {
+  return pin < PIN_COUNT ? pinLevels[pin] : LOW;
+}
+
+void SimBoard::writePwm(uint8_t pin, int value) {
+  if (pin >= PIN_COUNT) {
+    return;
+  }
+  pwmDuty[pin] = value < 0 ? 0 : (value > 255 ? 255 : value);
+  if (pin == pwmLeftPin || pin == pwmRightPin) {
+    notifyMotors();
+  }
+}
+
+void SimBoard::shiftOutByte(uint8_t bitOrder, uint8_t value) {
+  if (bitOrder == MSBFIRST) {
+    shiftRegister = value;
+  } else {
+    uint8_t reversed = 0;
+    for (int i = 0; i < 8; i++) {
+      if (value & (1 << i)) {
+        reversed |= static_cast<uint8_t>(0x80 >> i);
+      }
+    }
+    shiftRegister = reversed;
+  }
+}
+
+unsigned long SimBoard::measurePulse(uint8_t pin, uint8_t state, unsigned long timeout) {
+  uint64_t start = nowMicros;
+  unsigned long result = 0;
+  if (trace != nullptr) {
+    trace->begin(nowMicros, "pulseIn", false);
+  }
+
+  if (pin == echoPin && state == HIGH && pingPending && plant != nullptr) {
+    pingPending = false;
+    unsigned long echo;
+    {
+      HostScope host;
+      echo = plant->echoMicros(nowMicros);
+    }
+    if (echo > 0 && ECHO_START_LATENCY_US + echo <= timeout) {
+      spend(ECHO_START_LATENCY_US + echo);
+      result = echo;
+    } else {
+      spend(timeout);
+    }
+  } else {
+    // Nothing ever drives the line: pulseIn() waits out the full timeout
+    pingPending = false;
+    spend(timeout);
+  }
+
+  stats.pulseInMicros += nowMicros - start;
+  if (trace != nullptr) {
+    trace->end(nowMicros, "pulseIn");
+  }
+  return result;
+}
+
+void SimBoard::feedSerial(const char* data) {
+  if (*data != '\0' && receiveCallback) {
+    receivePending = true;
+    receiveEventAt = nowMicros + SERIAL_RX_TIMEOUT_US;
+  }
+  for (; *data != '\0'; data++) {
+    size_t next = (rxHead + 1) % SERIAL_RX_SIZE;
+    if (next == rxTail) {
+      break;  // Receive FIFO full, like the UART driver the rest is dropped
+    }
+    rxBuffer[rxHead] = *data;
+    rxHead = next;
+  }
+}
+
+void SimBoard::setSerialListener(SimSerialListener* listener) {
+  serialListener = listener;
+}
+
+void SimBoard::setIdleListener(SimIdleListener* listener) {
+  idleListener = listener;
+}
+
+void SimBoard::setReceiveCallback(std::function<void()> callback) {
+  receiveCallback = callback;
+}
+
+void SimBoard::serviceSerialEvents() {
+  if (receivePending && nowMicros >= receiveEventAt) {
+    receivePending = false;
+    if (trace != nullptr) {
+      trace->instant(nowMicros, "uart receive event");
+    }
+    FirmwareScope inFirmware;
+    receiveCallback();
+  }
+}
+
+void SimBoard::notifyTask() {
+  notifyCount++;
+}
+
+unsigned long SimBoard::takeNotify(uint64_t timeoutMicros, bool clearCount) {
+  uint64_t start = nowMicros;
+  uint64_t deadline = std::min(nowMicros + timeoutMicros, yieldAt);
+  if (trace != nullptr) {
+    trace->begin(nowMicros, "idle wait", false);
+  }
+
+  serviceSerialEvents();
+  while (notifyCount == 0 && nowMicros < deadline) {
+    step(deadline - nowMicros);
+  }
+  stats.idleMicros += nowMicros - start;
+  if (trace != nullptr) {
+    trace->end(nowMicros, "idle wait");
+  }
+
+  unsigned long count = notifyCount;
+  if (count > 0) {
+    stats.wakes++;
+    notifyCount = clearCount ? 0 : count - 1;
+  }
+  return count;
+}
+
+int SimBoard::serialAvailable() const {
+  return static_cast<int>((rxHead + SERIAL_RX_SIZE - rxTail) % SERIAL_RX_SIZE);
+}
+
+int SimBoard::serialRead() {
+  if (rxHead == rxTail) {
+    return -1;
+  }
+  unsigned char c = static_cast<unsigned char>(rxBuffer[rxTail]);
+  rxTail = (rxTail + 1) % SERIAL_RX_SIZE;
+  return c;
+}
+
+int SimBoard::serialPeek() const {
+  return rxHead == rxTail ? -1 : static_cast<unsigned char>(rxBuffer[rxTail]);
+}
+
+void SimBoard::serialWrite(const uint8_t* data, size_t size) {
+  if (serialListener != nullptr) {
+    HostScope host;
+    serialListener->onSerialOutput(nowMicros, reinterpret_cast<const char*>(data), size);
+  }
+
+  // Queue the bytes behind whatever is still being shifted out, then wait
+  // until no more than a FIFO's worth remains
+  txIdleAt = (txIdleAt > nowMicros ? txIdleAt : nowMicros) + size * SERIAL_BYTE_US;
+  uint64_t backlog = txIdleAt - nowMicros;
+  if (backlog > SERIAL_TX_FIFO * SERIAL_BYTE_US) {
+    uint64_t wait = backlog - SERIAL_TX_FIFO * SERIAL_BYTE_US;
+    stats.serialMicros += wait;
+    if (trace != nullptr) {
+      trace->begin(nowMicros, "uart tx wait", false);
+    }
+    spend(wait);
+    if (trace != nullptr) {
+      trace->end(nowMicros, "uart tx wait");
+    }
+  }
+}
+
+void SimBoard::setTrace(SimTrace* recorder) {
+  trace = recorder;
+}
+
+const SimBoardStats& SimBoard::getStats() const {
+  return stats;
+}
+
+void SimBoard::chargeAllocation(size_t size) {
+  heap.allocations++;
+  heap.liveBytes += size;
+  if (heap.liveBytes > heap.peakBytes) {
+    heap.peakBytes = heap.liveBytes;
+  }
+}
+
+void SimBoard::chargeFree(size_t size) {
+  heap.liveBytes = size > heap.liveBytes ? 0 : heap.liveBytes - size;
+}
+
+const SimHeapStats& SimBoard::getHeapStats() const {
+  return heap;
+}
+
+// Arduino core entry points
+
+unsigned long millis() {
+  return static_cast<unsigned long>(SimBoard::current()->now() / 1000);
+}
+
+unsigned long micros() {
+  return static_cast<unsigned long>(SimBoard::current()->now());
+}
+
+void delay(unsigned long ms) {
+  SimBoard::current()->blockFor(static_cast<uint64_t>(ms) * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  SimBoard::current()->blockFor(us);
+}
+
+esp_reset_reason_t esp_reset_reason() {
+  return SimBoard::current()->getResetReason();
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  SimBoard::current()->writePin(pin, value);
+}
+
+int digitalRead(uint8_t pin) {
+  return SimBoard::current()->readPin(pin);
+}
+
+void analogWrite(uint8_t pin, int value) {
+  SimBoard::current()->writePwm(pin, value);
+}
+
+void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t value) {
+  (void)dataPin;
+  (void)clockPin;
+  SimBoard::current()->shiftOutByte(bitOrder, value);
+}
+
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout) {
+  return SimBoard::current()->measurePulse(pin, state, timeout);
+}
+
+long map(long x, long inMin, long inMax, long outMin, long outMax) {
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  return SimBoard::current();
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait) {
+  return SimBoard::current()->takeNotify(static_cast<uint64_t>(ticksToWait) * portTICK_PERIOD_MS * 1000,
+                                         clearCountOnExit == pdTRUE);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  static_cast<SimBoard*>(task)->notifyTask();
+  return pdTRUE;
+}
+
+void enableLoopWDT() {}
+void disableLoopWDT() {}
+void feedLoopWDT() {}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    n += write(*buffer++);
+  }
+  return n;
+}
+
+size_t Print::printf(const char* format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (len < 0) {
+    return 0;
+  }
+  if (static_cast<size_t>(len) >= sizeof(buffer)) {
+    len = sizeof(buffer) - 1;
+  }
+  return write(reinterpret_cast<const uint8_t*>(buffer), static_cast<size_t>(len));
+}
+
+int HardwareSerial::available() {
+  return SimBoard::current()->serialAvailable();
+}
+
+int HardwareSerial::read() {
+  return SimBoard::current()->serialRead();
+}
+
+int HardwareSerial::peek() {
+  return SimBoard::current()->serialPeek();
+}
+
+void HardwareSerial::onReceive(std::function<void()> function, bool onlyOnTimeout) {
+  (void)onlyOnTimeout;
+  SimBoard::current()->setReceiveCallback(function);
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  SimBoard::current()->serialWrite(&c, 1);
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  SimBoard::current()->serialWrite(buffer, size);
+  return size;
+}
+
+// Preferences: the board's flash map stands in for NVS. Its bookkeeping is the flash driver's,
+// not the firmware's, so it is not charged to the firmware heap.
+
+bool Preferences::begin(const char* nameSpace, bool readOnlyMode, const char* partitionLabel) {
+  (void)partitionLabel;
+  name = nameSpace;
+  readOnly = readOnlyMode;
+  return true;
+}
+
+void Preferences::end() {
+  name = nullptr;
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t len) {
+  if (name == nullptr || readOnly) {
+    return 0;
+  }
+  SimBoard::HostScope host;
+  SimBoard::current()->writeFlash(std::string(name) + "/" + key, value, len);
+  return len;
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+  if (name == nullptr) {
+    return 0;
+  }
+  SimBoard::HostScope host;
+  const std::vector<uint8_t>* entry = SimBoard::current()->readFlash(std::string(name) + "/" + key);
+  return entry == nullptr ? 0 : entry->size();
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen) {
+  if (name == nullptr) {
+    return 0;
+  }
+  SimBoard::HostScope host;
+  const std::vector<uint8_t>* entry = SimBoard::current()->readFlash(std::string(name) + "/" + key);
+  if (entry == nullptr || entry->size() > maxLen) {
+    return 0;
+  }
+  memcpy(buf, entry->data(), entry->size());
+  return entry->size();
+}
+
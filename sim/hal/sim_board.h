@@ -0,0 +1,238 @@
+#ifndef SIM_BOARD_H
+#define SIM_BOARD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "esp_system.h"
+#include "sim_trace.h"
+
+// Physical side of the simulation: whatever is wired to the board's pins.
+class SimPlant {
+  public:
+    virtual ~SimPlant() {}
+
+    // Bring the physical model forward to the given virtual time
+    virtual void advanceTo(uint64_t nowMicros) = 0;
+
+    // Motor driver outputs changed (latched direction byte and PWM per side)
+    virtual void setMotorOutputs(uint64_t nowMicros, uint8_t direction, bool enabled,
+                                 int pwmLeft, int pwmRight) = 0;
+
+    // Round-trip echo time for a ping fired now, or 0 if nothing answers
+    virtual unsigned long echoMicros(uint64_t nowMicros) = 0;
+};
+
+// Receives the bytes the firmware writes to its serial port as they are written
+class SimSerialListener {
+  public:
+    virtual ~SimSerialListener() {}
+    virtual void onSerialOutput(uint64_t nowMicros, const char* data, size_t size) = 0;
+};
+
+// Host side that keeps running while the firmware is busy or blocked
+class SimIdleListener {
+  public:
+    virtual ~SimIdleListener() {}
+    // Called after each step of virtual time the firmware spends, working or waiting
+    virtual void onIdleStep(uint64_t nowMicros) = 0;
+};
+
+// Counters the board keeps about what the firmware did with its hardware
+struct SimBoardStats {
+  uint64_t pulseInMicros;   // Virtual time spent blocked in pulseIn()
+  uint64_t delayMicros;     // Virtual time spent blocked in delay()/delayMicroseconds()
+  unsigned long pings;      // Ultrasonic trigger pulses fired
+  unsigned long motorWrites; // Direction bytes latched into the shift register
+  uint64_t serialMicros;    // Virtual time spent blocked waiting for the UART transmit FIFO
+  uint64_t idleMicros;      // Virtual time the loop task spent blocked on a task notification
+  unsigned long wakes;      // Waits cut short by a notification
+};
+
+// Heap use by the firmware running on one board
+struct SimHeapStats {
+  size_t liveBytes;           // Bytes currently allocated
+  size_t peakBytes;           // Most bytes ever allocated at once
+  unsigned long allocations;  // Allocations made since power-on
+};
+
+// A virtual ESP32: clock, GPIO, the motor shift register and the USB serial
+// port. The Arduino HAL shim forwards every call to the board bound to the
+// calling thread, so several boards can run side by side on different threads.
+class SimBoard {
+  private:
+    static const int PIN_COUNT = 64;
+    static const size_t SERIAL_RX_SIZE = 1024;
+
+    uint64_t nowMicros;
+    SimPlant* plant;
+
+    uint8_t pinLevels[PIN_COUNT];
+    int pwmDuty[PIN_COUNT];
+
+    // Motor driver wiring (74HC595 shift register plus two PWM channels)
+    int enPin, dataPin, clockPin, latchPin, pwmLeftPin, pwmRightPin;
+    uint8_t shiftRegister;
+    uint8_t latchedDirection;
+
+    // Ultrasonic wiring and trigger state
+    int trigPin, echoPin;
+    bool pingPending;
+
+    // Serial receive ring and transmit capture
+    char rxBuffer[SERIAL_RX_SIZE];
+    size_t rxHead, rxTail;
+    SimSerialListener* serialListener;
+
+    // Time the UART finishes shifting out everything written so far
+    uint64_t txIdleAt;
+
+    // UART receive event and the loop task's notification count
+    std::function<void()> receiveCallback;
+    bool receivePending;
+    uint64_t receiveEventAt;
+    unsigned long notifyCount;
+    SimIdleListener* idleListener;
+
+    // Waits for a notification end here at the latest, so a stepped board hands back on time
+    uint64_t yieldAt;
+
+    // Cause of the last start, reported to the firmware by esp_reset_reason()
+    esp_reset_reason_t resetReason;
+
+    // RTC memory, zero at power-on like the real board's is cleared; reset() leaves it alone.
+    // The firmware's RTC_NOINIT_ATTR variables are a per-thread working copy, swapped in and
+    // out of this image whenever a Scope binds the board to a thread.
+    std::vector<uint8_t> rtcMemory;
+
+    // NVS entries by "<namespace>/<key>"; flash, so reset() leaves them alone
+    std::map<std::string, std::vector<uint8_t>> flash;
+
+    // Injected hang: the first stretch of time spent after hangAt takes hangFor longer
+    uint64_t hangAt;
+    uint64_t hangFor;
+
+    SimBoardStats stats;
+    SimHeapStats heap;
+    SimTrace* trace;
+
+    void notifyMotors();
+
+    // Advance by at most maxMicros, stopping at the next UART receive event, then let the host
+    // and the receive callback run
+    void step(uint64_t maxMicros);
+
+  public:
+    SimBoard();
+
+    // Board bound to the calling thread (nullptr if none)
+    static SimBoard* current();
+
+    // Binds a board to the calling thread for the lifetime of the scope
+    class Scope {
+      private:
+        SimBoard* previous;
+      public:
+        explicit Scope(SimBoard* board);
+        ~Scope();
+    };
+
+    // Marks a call into firmware code: heap use inside it is charged to the bound board
+    class FirmwareScope {
+      private:
+        bool previous;
+      public:
+        FirmwareScope();
+        ~FirmwareScope();
+    };
+
+    // Marks host code called back from inside the firmware (plant, serial listener)
+    class HostScope {
+      private:
+        bool previous;
+      public:
+        HostScope();
+        ~HostScope();
+    };
+
+    // True while firmware code is running on the calling thread
+    static bool inFirmware();
+
+    // Soft reset: outputs, pins, the UART receive path and pending notifications go back to
+    // their power-on state while the clock, the wiring and RTC memory carry on. Run the
+    // firmware's setup() again afterwards.
+    void reset(esp_reset_reason_t reason);
+    esp_reset_reason_t getResetReason() const;
+
+    // Copy RTC memory between this board's image and the calling thread's working copy; Scope
+    // does this when it binds or unbinds the board
+    void saveRtcMemory();
+    void loadRtcMemory();
+
+    // NVS as the Preferences shim sees it: the entry stored under a key (nullptr if none)
+    const std::vector<uint8_t>* readFlash(const std::string& key) const;
+    void writeFlash(const std::string& key, const void* data, size_t size);
+
+    // Wiring
+    void attachPlant(SimPlant* physicalPlant);
+    void setMotorPins(int en, int data, int clock, int latch, int pwmLeft, int pwmRight);
+    void setUltrasonicPins(int trig, int echo);
+
+    // Virtual clock
+    uint64_t now() const;
+    void advance(uint64_t micros);
+    void blockFor(uint64_t micros);
+
+    // Let micros pass in the loop task, busy or blocked. The host keeps typing and the UART
+    // receive callback keeps running in between, as the UART event task preempts the loop.
+    void spend(uint64_t micros);
+
+    // End any wait for a notification still running at atMicros there, as if it had timed out
+    // (UINT64_MAX: never). Lets a caller stepping the board get it back between loop iterations.
+    void setYieldAt(uint64_t atMicros);
+
+    // Make the first spend() from atMicros on take forMicros longer, like a loop stuck in a driver
+    void setHang(uint64_t atMicros, uint64_t forMicros);
+
+    // GPIO as seen by the firmware
+    void writePin(uint8_t pin, uint8_t value);
+    int readPin(uint8_t pin) const;
+    void writePwm(uint8_t pin, int value);
+    void shiftOutByte(uint8_t bitOrder, uint8_t value);
+    unsigned long measurePulse(uint8_t pin, uint8_t state, unsigned long timeout);
+
+    // Serial port, host side
+    void feedSerial(const char* data);
+    void setSerialListener(SimSerialListener* listener);
+    void setIdleListener(SimIdleListener* listener);
+
+    // Run the firmware's receive callback if its UART event is due
+    void serviceSerialEvents();
+
+    // Serial port, firmware side
+    int serialAvailable() const;
+    int serialRead();
+    int serialPeek() const;
+    void serialWrite(const uint8_t* data, size_t size);
+    void setReceiveCallback(std::function<void()> callback);
+
+    // Task notifications for the loop task: give one, or wait up to timeoutMicros for one
+    void notifyTask();
+    unsigned long takeNotify(uint64_t timeoutMicros, bool clearCount);
+
+    const SimBoardStats& getStats() const;
+
+    // Timeline recorder for the firmware's trace hooks and the HAL's blocking waits (nullptr: off)
+    void setTrace(SimTrace* recorder);
+    SimTrace* getTrace() const { return trace; }
+
+    // Heap accounting, fed by the operator new/delete overrides in sim_heap.cpp
+    void chargeAllocation(size_t size);
+    void chargeFree(size_t size);
+    const SimHeapStats& getHeapStats() const;
+};
+
+#endif
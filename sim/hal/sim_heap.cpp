@@ -0,0 +1,104 @@
+#include <cstdlib>
+#include <new>
+#include "sim_board.h"
+#include "Esp.h"
+
+// Replaces the global allocator so every firmware allocation is charged to
+// the board it runs on. Each block carries its size in a small header.
+
+static const size_t HEADER_SIZE = 16;  // Keeps the payload aligned for any type
+
+// DRAM heap of an ESP32 running the Arduino core, before the sketch allocates
+static const uint32_t SIM_HEAP_SIZE = 327680;
+
+EspClass ESP;
+
+static void* trackedAlloc(size_t size) {
+  char* block = static_cast<char*>(malloc(size + HEADER_SIZE));
+  if (block == nullptr) {
+    return nullptr;
+  }
+  *reinterpret_cast<size_t*>(block) = size;
+
+  SimBoard* board = SimBoard::current();
+  if (board != nullptr && SimBoard::inFirmware()) {
+    board->chargeAllocation(size);
+  }
+  return block + HEADER_SIZE;
+}
+
+static void trackedFree(void* ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  char* block = static_cast<char*>(ptr) - HEADER_SIZE;
+
+  SimBoard* board = SimBoard::current();
+  if (board != nullptr && SimBoard::inFirmware()) {
+    board->chargeFree(*reinterpret_cast<size_t*>(block));
+  }
+  free(block);
+}
+
+void* operator new(size_t size) {
+  void* ptr = trackedAlloc(size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return trackedAlloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return trackedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  trackedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  trackedFree(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  trackedFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  trackedFree(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  trackedFree(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  trackedFree(ptr);
+}
+
+uint32_t EspClass::getHeapSize() {
+  return SIM_HEAP_SIZE;
+}
+
+uint32_t EspClass::getFreeHeap() {
+  SimBoard* board = SimBoard::current();
+  return board ? SIM_HEAP_SIZE - static_cast<uint32_t>(board->getHeapStats().liveBytes) : SIM_HEAP_SIZE;
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+  SimBoard* board = SimBoard::current();
+  return board ? SIM_HEAP_SIZE - static_cast<uint32_t>(board->getHeapStats().peakBytes) : SIM_HEAP_SIZE;
+}
+
+uint32_t EspClass::getMaxAllocHeap() {
+  // Fragmentation is not modelled; the whole free heap is one block
+  return getFreeHeap();
+}
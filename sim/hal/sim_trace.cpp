@@ -0,0 +1,150 @@
+#include "sim_trace.h"
+#include <cstdio>
+#include "sim_board.h"
+#include "../../test_bench/include/trace.h"
+
+SimTrace::SimTrace(size_t maxEvents) {
+  capacity = maxEvents;
+  dropped = 0;
+  openSpans = 0;
+  skippedSpans = 0;
+  events.reserve(capacity);
+}
+
+bool SimTrace::hasRoom(size_t count) const {
+  // Room is always kept for the ends of the spans still open
+  return events.size() + openSpans + count <= capacity;
+}
+
+void SimTrace::begin(uint64_t nowMicros, const char* name, bool elidable, uint8_t track) {
+  // Nothing nested inside a dropped span is kept either, so the ends still pair up
+  if (skippedSpans > 0 || !hasRoom(2)) {
+    skippedSpans++;
+    if (!elidable) {
+      dropped++;  // Elidable spans mostly vanish anyway, so they are not counted
+    }
+    return;
+  }
+  events.push_back({nowMicros, name, 0, 'B', track, elidable});
+  openSpans++;
+}
+
+void SimTrace::end(uint64_t nowMicros, const char* name, uint8_t track) {
+  if (skippedSpans > 0) {
+    skippedSpans--;
+    return;
+  }
+  if (openSpans == 0) {
+    return;  // Tracing started inside the span
+  }
+  openSpans--;
+
+  const SimTraceEvent* last = events.empty() ? nullptr : &events.back();
+  if (last != nullptr && last->phase == 'B' && last->elidable && last->atMicros == nowMicros &&
+      last->track == track) {
+    events.pop_back();
+    return;
+  }
+  events.push_back({nowMicros, name, 0, 'E', track, false});
+}
+
+void SimTrace::instant(uint64_t nowMicros, const char* name, uint8_t track) {
+  if (!hasRoom(1)) {
+    dropped++;
+    return;
+  }
+  events.push_back({nowMicros, name, 0, 'i', track, false});
+}
+
+void SimTrace::counter(uint64_t nowMicros, const char* name, long value) {
+  if (!hasRoom(1)) {
+    dropped++;
+    return;
+  }
+  events.push_back({nowMicros, name, value, 'C', TRACK_FIRMWARE, false});
+}
+
+static void writeJsonString(FILE* file, const char* text) {
+  fputc('"', file);
+  for (const char* c = text; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fputc('\\', file);
+    }
+    if (static_cast<unsigned char>(*c) >= 0x20) {
+      fputc(*c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+bool SimTrace::writeJson(const std::string& path, const char* processName) const {
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    return false;
+  }
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(file, "{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"process_name\",\"args\":{\"name\":", TRACK_FIRMWARE);
+  writeJsonString(file, processName);
+  fprintf(file, "}},\n");
+  fprintf(file, "{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"loop task\"}},\n",
+          TRACK_FIRMWARE);
+  fprintf(file, "{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"host\"}}",
+          TRACK_HOST);
+
+  for (const SimTraceEvent& event : events) {
+    fprintf(file, ",\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"name\":", event.phase, event.track,
+            static_cast<unsigned long long>(event.atMicros));
+    writeJsonString(file, event.name);
+    if (event.phase == 'i') {
+      fprintf(file, ",\"s\":\"t\"");
+    } else if (event.phase == 'C') {
+      fprintf(file, ",\"args\":{\"value\":%ld}", event.value);
+    }
+    fputc('}', file);
+  }
+  fprintf(file, "\n]}\n");
+  return fclose(file) == 0;
+}
+
+// Firmware hooks from trace.h: record against the board bound to the calling thread
+
+static SimTrace* activeTrace(SimBoard** board) {
+  *board = SimBoard::current();
+  return *board != nullptr ? (*board)->getTrace() : nullptr;
+}
+
+void traceBegin(const char* name) {
+  SimBoard* board;
+  if (SimTrace* trace = activeTrace(&board)) {
+    trace->begin(board->now(), name, false);
+  }
+}
+
+void traceStageBegin(const char* name) {
+  SimBoard* board;
+  if (SimTrace* trace = activeTrace(&board)) {
+    trace->begin(board->now(), name, true);
+  }
+}
+
+void traceEnd(const char* name) {
+  SimBoard* board;
+  if (SimTrace* trace = activeTrace(&board)) {
+    trace->end(board->now(), name);
+  }
+}
+
+void traceInstant(const char* name) {
+  SimBoard* board;
+  if (SimTrace* trace = activeTrace(&board)) {
+    trace->instant(board->now(), name);
+  }
+}
+
+void traceCounter(const char* name, long value) {
+  SimBoard* board;
+  if (SimTrace* trace = activeTrace(&board)) {
+    trace->counter(board->now(), name, value);
+  }
+}
@@ -0,0 +1,56 @@
+#ifndef SIM_TRACE_H
+#define SIM_TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Which row of the timeline an event belongs on
+enum SimTraceTrack {
+  TRACK_FIRMWARE = 1,  // The loop task, including the HAL calls it blocks in
+  TRACK_HOST = 2       // Input the simulated host types
+};
+
+// One Chrome Trace Event: 'B'/'E' span edges, 'i' instants, 'C' counters
+struct SimTraceEvent {
+  uint64_t atMicros;
+  const char* name;
+  long value;
+  char phase;
+  uint8_t track;
+  bool elidable;  // 'B' only: drop the span if it closes empty at the same virtual time
+};
+
+// In-memory timeline of one board, preallocated so recording never touches
+// the heap inside loop(). Loop stages are opened as elidable: if one closes
+// at the same virtual time with nothing inside, it is dropped, which keeps the
+// thousands of iterations that take no simulated time out of the trace.
+// Firmware calls and HAL waits are always kept. Once the buffer is full
+// further events are counted and dropped.
+class SimTrace {
+  private:
+    std::vector<SimTraceEvent> events;
+    size_t capacity;
+    unsigned long dropped;
+    size_t openSpans;
+    size_t skippedSpans;  // Begins dropped for lack of room whose ends are still to come
+
+    bool hasRoom(size_t count) const;
+
+  public:
+    explicit SimTrace(size_t maxEvents);
+
+    void begin(uint64_t nowMicros, const char* name, bool elidable = true, uint8_t track = TRACK_FIRMWARE);
+    void end(uint64_t nowMicros, const char* name, uint8_t track = TRACK_FIRMWARE);
+    void instant(uint64_t nowMicros, const char* name, uint8_t track = TRACK_FIRMWARE);
+    void counter(uint64_t nowMicros, const char* name, long value);
+
+    size_t size() const { return events.size(); }
+    unsigned long getDropped() const { return dropped; }
+
+    // Write Chrome Trace Event JSON (loads in Perfetto and chrome://tracing); false on I/O error
+    bool writeJson(const std::string& path, const char* processName) const;
+};
+
+#endif
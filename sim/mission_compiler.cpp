@@ -0,0 +1,299 @@
+#include "mission_compiler.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include "../test_bench/include/config.h"
+#include "../test_bench/include/mission_bytecode.h"
+
+// Hex bytes per '$' line; with the prefix this stays inside MAX_COMMAND_LENGTH
+static const size_t UPLOAD_CHUNK_BYTES = 30;
+
+namespace {
+
+// An open repeat or if, waiting for its "end"
+struct Block {
+  enum Kind { REPEAT_COUNTED, REPEAT_FOREVER, IF } kind;
+  size_t top;          // Loop start
+  int counter;         // REPEAT_COUNTED
+  size_t patchAt;      // IF: operand to point at the else branch or the end
+  bool hasElse;
+  int line;
+};
+
+class Compiler {
+  private:
+    std::vector<uint8_t>* out;
+    std::vector<Block> blocks;
+    int countedDepth;
+    int line;
+    std::string* error;
+
+    bool fail(const std::string& message) {
+      *error = "line " + std::to_string(line) + ": " + message;
+      return false;
+    }
+
+    void emit8(uint8_t value) { out->push_back(value); }
+    void emit16(uint16_t value) {
+      out->push_back(value & 0xFF);
+      out->push_back(value >> 8);
+    }
+    void patch16(size_t at, uint16_t value) {
+      (*out)[at] = value & 0xFF;
+      (*out)[at + 1] = value >> 8;
+    }
+
+    // Parse an integer word in [minValue, maxValue]
+    bool parseNumber(const std::string& word, long minValue, long maxValue, const char* what, long* value) {
+      char* end;
+      *value = strtol(word.c_str(), &end, 10);
+      if (*end != '\0' || *value < minValue || *value > maxValue) {
+        return fail(std::string(what) + " must be " + std::to_string(minValue) + "-" + std::to_string(maxValue));
+      }
+      return true;
+    }
+
+    // Read the next word as an integer in [minValue, maxValue]
+    bool number(std::istringstream& fields, long minValue, long maxValue, const char* what, long* value) {
+      std::string word;
+      if (!(fields >> word)) {
+        return fail(std::string("missing ") + what);
+      }
+      return parseNumber(word, minValue, maxValue, what, value);
+    }
+
+    // "distance < N" or "distance > N": emit a range reading and a jump taken when the
+    // condition is false; returns the offset of its target operand
+    bool condition(std::istringstream& fields, size_t* patchAt) {
+      std::string subject, comparison;
+      long cm;
+      if (!(fields >> subject >> comparison) || subject != "distance" || (comparison != "<" && comparison != ">")) {
+        return fail("expected 'distance < cm' or 'distance > cm'");
+      }
+      if (!number(fields, 1, MISSION_NO_ECHO_CM, "distance", &cm)) {
+        return false;
+      }
+      emit8(MOP_RANGE);
+      // distance > N is the same as not distance < N + 1
+      emit8(comparison == "<" ? MOP_JUMP_GE : MOP_JUMP_LT);
+      emit16(comparison == "<" ? cm : cm + 1);
+      *patchAt = out->size();
+      emit16(0);
+      return true;
+    }
+
+    bool statement(const std::string& keyword, std::istringstream& fields) {
+      long value;
+      if (keyword == "forward" || keyword == "backward" || keyword == "left" || keyword == "right") {
+        long speed = 0;
+        std::string word;
+        if ((fields >> word) && !parseNumber(word, MIN_SPEED, MAX_SPEED, "speed", &speed)) {
+          return false;
+        }
+        emit8(MOP_MOVE);
+        emit8(keyword == "forward" ? MDIR_FORWARD : keyword == "backward" ? MDIR_BACKWARD
+              : keyword == "left" ? MDIR_SPIN_LEFT : MDIR_SPIN_RIGHT);
+        emit8(speed);
+      } else if (keyword == "stop") {
+        emit8(MOP_MOVE);
+        emit8(MDIR_STOP);
+        emit8(0);
+      } else if (keyword == "turn") {
+        if (!number(fields, -32768, 32767, "degrees", &value)) {
+          return false;
+        }
+        emit8(MOP_TURN);
+        emit16(static_cast<uint16_t>(value));
+      } else if (keyword == "wait") {
+        std::string word;
+        if (!(fields >> word)) {
+          return fail("missing wait time (ms) or 'until'");
+        }
+        if (word == "until") {
+          size_t top = out->size();
+          size_t patchAt;
+          if (!condition(fields, &patchAt)) {
+            return false;
+          }
+          // Keep reading until the condition holds
+          patch16(patchAt, top);
+        } else {
+          if (!parseNumber(word, 0, 65535, "wait time (ms)", &value)) {
+            return false;
+          }
+          emit8(MOP_WAIT);
+          emit16(value);
+        }
+      } else if (keyword == "repeat") {
+        Block block = {Block::REPEAT_FOREVER, 0, -1, 0, false, line};
+        std::string word;
+        if (fields >> word) {
+          if (!parseNumber(word, 1, 65535, "repeat count", &value)) {
+            return false;
+          }
+          if (countedDepth == MISSION_COUNTERS) {
+            return fail("counted repeats nest at most " + std::to_string(MISSION_COUNTERS) + " deep");
+          }
+          block.kind = Block::REPEAT_COUNTED;
+          block.counter = countedDepth++;
+          emit8(MOP_SET_COUNTER);
+          emit8(block.counter);
+          emit16(value);
+        }
+        block.top = out->size();
+        blocks.push_back(block);
+      } else if (keyword == "if") {
+        Block block = {Block::IF, 0, -1, 0, false, line};
+        if (!condition(fields, &block.patchAt)) {
+          return false;
+        }
+        blocks.push_back(block);
+      } else if (keyword == "else") {
+        if (blocks.empty() || blocks.back().kind != Block::IF || blocks.back().hasElse) {
+          return fail("'else' without an open 'if'");
+        }
+        Block& block = blocks.back();
+        emit8(MOP_JUMP);
+        size_t skipElse = out->size();
+        emit16(0);
+        patch16(block.patchAt, out->size());
+        block.patchAt = skipElse;
+        block.hasElse = true;
+      } else if (keyword == "end") {
+        if (blocks.empty()) {
+          return fail("'end' without an open 'repeat' or 'if'");
+        }
+        Block block = blocks.back();
+        blocks.pop_back();
+        if (block.kind == Block::REPEAT_COUNTED) {
+          emit8(MOP_LOOP);
+          emit8(block.counter);
+          emit16(block.top);
+          countedDepth--;
+        } else if (block.kind == Block::REPEAT_FOREVER) {
+          emit8(MOP_JUMP);
+          emit16(block.top);
+        } else {
+          patch16(block.patchAt, out->size());
+        }
+      } else {
+        return fail("unknown statement '" + keyword + "'");
+      }
+
+      std::string extra;
+      if (fields >> extra) {
+        return fail("unexpected '" + extra + "'");
+      }
+      return true;
+    }
+
+  public:
+    Compiler(std::vector<uint8_t>* program, std::string* errorText)
+      : out(program), countedDepth(0), line(0), error(errorText) {}
+
+    bool compile(const std::string& source) {
+      out->clear();
+      std::istringstream lines(source);
+      std::string text;
+
+      while (std::getline(lines, text)) {
+        line++;
+        std::string::size_type hash = text.find('#');
+        if (hash != std::string::npos) {
+          text = text.substr(0, hash);
+        }
+        std::istringstream fields(text);
+        std::string keyword;
+        if (!(fields >> keyword)) {
+          continue;
+        }
+        if (!statement(keyword, fields)) {
+          return false;
+        }
+      }
+
+      if (!blocks.empty()) {
+        line = blocks.back().line;
+        return fail("block is never closed with 'end'");
+      }
+      emit8(MOP_END);
+      if (out->size() > MISSION_MAX_BYTES) {
+        *error = "program is " + std::to_string(out->size()) + " bytes, the device holds " +
+                 std::to_string(MISSION_MAX_BYTES);
+        return false;
+      }
+      return true;
+    }
+};
+
+}  // namespace
+
+bool compileMission(const std::string& source, std::vector<uint8_t>* program, std::string* error) {
+  Compiler compiler(program, error);
+  return compiler.compile(source);
+}
+
+bool compileMissionFile(const std::string& path, std::vector<uint8_t>* program, std::string* error) {
+  std::ifstream in(path.c_str());
+  if (!in) {
+    if (error) *error = "cannot open " + path;
+    return false;
+  }
+  std::stringstream text;
+  text << in.rdbuf();
+  return compileMission(text.str(), program, error);
+}
+
+std::string disassembleMission(const std::vector<uint8_t>& program) {
+  static const char* DIRECTIONS[MDIR_COUNT] = {"stop", "forward", "backward", "spin-left", "spin-right"};
+  std::string listing;
+  char text[80];
+
+  for (size_t at = 0; at < program.size(); ) {
+    uint8_t op = program[at];
+    uint8_t size = missionInstructionSize(op);
+    if (size == 0 || at + size > program.size()) {
+      snprintf(text, sizeof(text), "%04zu  ?? %02x\n", at, op);
+      listing += text;
+      break;
+    }
+    const uint8_t* operand = &program[at + 1];
+    uint16_t a = size >= 3 ? operand[0] | (operand[1] << 8) : 0;
+    uint16_t b = size >= 5 ? operand[2] | (operand[3] << 8) : 0;
+    uint16_t counterValue = size >= 4 ? operand[1] | (operand[2] << 8) : 0;
+
+    switch (op) {
+      case MOP_END:         snprintf(text, sizeof(text), "%04zu  END\n", at); break;
+      case MOP_MOVE:        snprintf(text, sizeof(text), "%04zu  MOVE %s %u\n", at,
+                                     operand[0] < MDIR_COUNT ? DIRECTIONS[operand[0]] : "?", operand[1]); break;
+      case MOP_TURN:        snprintf(text, sizeof(text), "%04zu  TURN %d\n", at, static_cast<int16_t>(a)); break;
+      case MOP_WAIT:        snprintf(text, sizeof(text), "%04zu  WAIT %u ms\n", at, a); break;
+      case MOP_RANGE:       snprintf(text, sizeof(text), "%04zu  RANGE\n", at); break;
+      case MOP_JUMP_LT:     snprintf(text, sizeof(text), "%04zu  JUMP_LT %u cm -> %04u\n", at, a, b); break;
+      case MOP_JUMP_GE:     snprintf(text, sizeof(text), "%04zu  JUMP_GE %u cm -> %04u\n", at, a, b); break;
+      case MOP_JUMP:        snprintf(text, sizeof(text), "%04zu  JUMP -> %04u\n", at, a); break;
+      case MOP_SET_COUNTER: snprintf(text, sizeof(text), "%04zu  SET c%u = %u\n", at, operand[0], counterValue); break;
+      default:              snprintf(text, sizeof(text), "%04zu  LOOP c%u -> %04u\n", at, operand[0], counterValue); break;
+    }
+    listing += text;
+    at += size;
+  }
+  return listing;
+}
+
+std::vector<std::string> missionUploadLines(const std::vector<uint8_t>& program) {
+  std::vector<std::string> lines;
+  lines.push_back("mission " + std::to_string(program.size()) + " " +
+                  std::to_string(missionChecksum(program.data(), program.size())));
+
+  char hex[3];
+  for (size_t at = 0; at < program.size(); at += UPLOAD_CHUNK_BYTES) {
+    std::string chunk = "$";
+    for (size_t i = at; i < program.size() && i < at + UPLOAD_CHUNK_BYTES; i++) {
+      snprintf(hex, sizeof(hex), "%02x", program[i]);
+      chunk += hex;
+    }
+    lines.push_back(chunk);
+  }
+  return lines;
+}
@@ -0,0 +1,27 @@
+#ifndef MISSION_COMPILER_H
+#define MISSION_COMPILER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Compiles the mission script language into the firmware's mission bytecode
+// (test_bench/include/mission_bytecode.h). One statement per line, '#' starts
+// a comment, blocks close with "end":
+//
+//   forward [speed] | backward [speed] | left | right | stop
+//   turn <degrees>                      positive turns clockwise
+//   wait <ms>
+//   wait until distance < <cm>          also "> <cm>"
+//   if distance < <cm> ... [else ...] end
+//   repeat [count] ... end              no count repeats forever
+bool compileMission(const std::string& source, std::vector<uint8_t>* program, std::string* error);
+bool compileMissionFile(const std::string& path, std::vector<uint8_t>* program, std::string* error);
+
+// One line per instruction: byte offset, mnemonic and operands
+std::string disassembleMission(const std::vector<uint8_t>& program);
+
+// Serial lines that upload the program: "mission <bytes> <checksum>" then '$' hex chunks
+std::vector<std::string> missionUploadLines(const std::vector<uint8_t>& program);
+
+#endif
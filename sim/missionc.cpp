@@ -0,0 +1,45 @@
+// Mission compiler: turns a mission script into the serial lines that upload
+// it to the car. Send the lines in order, then "run".
+//
+//   missionc patrol.mission > patrol.txt
+//   missionc --list patrol.mission
+
+#include <cstdio>
+#include <cstring>
+#include "mission_compiler.h"
+
+int main(int argc, char** argv) {
+  bool listing = false;
+  const char* path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--list") == 0) {
+      listing = true;
+    } else if (path == nullptr && argv[i][0] != '-') {
+      path = argv[i];
+    } else {
+      path = nullptr;
+      break;
+    }
+  }
+  if (path == nullptr) {
+    fprintf(stderr, "usage: %s [--list] SCRIPT\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<uint8_t> program;
+  std::string error;
+  if (!compileMissionFile(path, &program, &error)) {
+    fprintf(stderr, "%s: %s\n", path, error.c_str());
+    return 1;
+  }
+
+  if (listing) {
+    printf("%s", disassembleMission(program).c_str());
+    printf("%zu bytes\n", program.size());
+    return 0;
+  }
+  for (const std::string& line : missionUploadLines(program)) {
+    printf("%s\n", line.c_str());
+  }
+  return 0;
+}
@@ -0,0 +1,121 @@
+// Stress test and throughput benchmark for the firmware's SpscRing. A producer
+// thread pushes a numbered sequence while the consumer checks that every item
+// arrives once, in order and untorn, for single and batch transfers at a few
+// capacities. Build with `make tsan` to run the same check under ThreadSanitizer.
+//
+//   ring_bench                     # 10M items per case
+//   ring_bench --items 200000
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "../test_bench/include/spsc_ring.h"
+
+// Payload wide enough that a torn copy would show up in the check word
+struct RingItem {
+  uint32_t sequence;
+  uint32_t check;
+  uint64_t pad;
+};
+
+static uint32_t checkWord(uint32_t sequence) {
+  return sequence * 2654435761u ^ 0x5A5A5A5Au;
+}
+
+struct BenchResult {
+  unsigned long errors;
+  double seconds;
+  unsigned long producerFull;
+  unsigned long consumerEmpty;
+};
+
+// Move items through the ring, batch items at a time (1 uses push/pop)
+template <size_t Capacity>
+static BenchResult transfer(unsigned long items, size_t batch) {
+  static SpscRing<RingItem, Capacity> ring;
+  BenchResult result = {0, 0.0, 0, 0};
+
+  auto start = std::chrono::steady_clock::now();
+  std::thread producer([&]() {
+    RingItem buffer[64];
+    uint32_t next = 0;
+    while (next < items) {
+      size_t count = batch;
+      if (count > items - next) {
+        count = items - next;
+      }
+      for (size_t i = 0; i < count; i++) {
+        buffer[i].sequence = next + i;
+        buffer[i].check = checkWord(next + i);
+        buffer[i].pad = next + i;
+      }
+      size_t sent = batch == 1 ? (ring.push(buffer[0]) ? 1 : 0) : ring.pushBatch(buffer, count);
+      if (sent == 0) {
+        result.producerFull++;
+        std::this_thread::yield();
+      }
+      next += sent;
+    }
+  });
+
+  RingItem buffer[64];
+  uint32_t expected = 0;
+  while (expected < items) {
+    size_t count = batch == 1 ? (ring.pop(buffer[0]) ? 1 : 0) : ring.popBatch(buffer, batch);
+    if (count == 0) {
+      result.consumerEmpty++;
+      std::this_thread::yield();
+      continue;
+    }
+    for (size_t i = 0; i < count; i++, expected++) {
+      const RingItem& item = buffer[i];
+      if (item.sequence != expected || item.check != checkWord(expected) || item.pad != expected) {
+        if (result.errors++ < 5) {
+          fprintf(stderr, "  expected %u, got sequence %u check %08x\n", expected, item.sequence, item.check);
+        }
+        expected = item.sequence;
+      }
+    }
+  }
+  producer.join();
+  result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  if (!ring.empty()) {
+    result.errors++;
+    fprintf(stderr, "  ring not empty after the transfer\n");
+  }
+  return result;
+}
+
+template <size_t Capacity>
+static bool runCase(unsigned long items, size_t batch) {
+  BenchResult result = transfer<Capacity>(items, batch);
+  printf("capacity %5zu  batch %2zu  %8.2f Mitems/s  %8lu full  %8lu empty  %s\n",
+         Capacity, batch, items / result.seconds / 1e6, result.producerFull, result.consumerEmpty,
+         result.errors == 0 ? "ok" : "FAILED");
+  return result.errors == 0;
+}
+
+int main(int argc, char** argv) {
+  unsigned long items = 10000000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--items") == 0 && i + 1 < argc) {
+      items = strtoul(argv[++i], nullptr, 10);
+    } else {
+      fprintf(stderr, "usage: %s [--items N]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  printf("SpscRing: %lu items of %zu bytes per case, %u hardware threads\n",
+         items, sizeof(RingItem), std::thread::hardware_concurrency());
+  bool ok = true;
+  ok &= runCase<16>(items, 1);
+  ok &= runCase<16>(items, 8);
+  ok &= runCase<1024>(items, 1);
+  ok &= runCase<1024>(items, 32);
+  ok &= runCase<1024>(items, 64);
+  return ok ? 0 : 1;
+}
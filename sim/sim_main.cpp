@@ -0,0 +1,1021 @@
+// Host simulator: runs the unmodified firmware against a simulated car on a
+// virtual clock and reports what the car physically did.
+//
+//   sim_runner --scenario avoid
+//   sim_runner --world worlds/corridor.world --script scripts/bci_session.txt --duration 30000
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "mission_compiler.h"
+#include "simulation.h"
+#include "world.h"
+#include "../test_bench/include/scan_capture.h"
+#include "../test_bench/include/intent_filter.h"
+#include "../test_bench/src/lib/vehicle/vehicle.h"
+
+// Entry points from test_bench.ino (see firmware.cpp)
+void setup();
+void loop();
+
+// Soft reset of the sketch's global state (see firmware.cpp)
+void resetSketch();
+
+class SketchFirmware : public SimFirmware {
+  public:
+    void setup() override { ::setup(); }
+    void loop() override { ::loop(); }
+    void reset() override { resetSketch(); }
+};
+
+// Trace buffer when --trace is given without --trace-events (24 bytes each)
+static const int DEFAULT_TRACE_EVENTS = 1000000;
+
+// The emergency stop byte must cut the motors within this, whatever the loop is doing
+static const double ESTOP_BUDGET_MS = 1.0;
+
+// Turns typed after 'calibrate' must land within this share of the angle asked for
+static const double TURN_TOLERANCE_PCT = 5.0;
+
+// A mission is uploaded from this time on, one line every MISSION_LINE_GAP_MS
+static const unsigned long MISSION_UPLOAD_MS = 1600;
+static const unsigned long MISSION_LINE_GAP_MS = 10;
+
+// Built-in scenarios for the timing constants the firmware hardcodes
+struct Scenario {
+  const char* name;
+  const char* description;
+  unsigned long durationMillis;
+  const char* world;
+  const char* script;
+  const char* intents;     // True intent schedule for a simulated BCI stream, or nullptr
+  const char* setpoints;   // "<ms> <linear> <turn>" schedule for a teleoperation stream, or nullptr
+  unsigned int streamHz;   // Frame rate of whichever stream runs
+  const char* mission;     // Mission script compiled and uploaded from MISSION_UPLOAD_MS, or nullptr
+  unsigned long unplugFromMillis;  // Sensor disconnected over this window (equal: never)
+  unsigned long unplugUntilMillis;
+  unsigned long hangAtMillis;      // The loop stalls for hangForMillis from here (0: never)
+  unsigned long hangForMillis;
+  unsigned long burstAtMillis;     // The host sends burstLines pings from here (0: never)
+  unsigned int burstLines;
+  unsigned long resetAtMillis;     // The task watchdog resets the board here (0: never)
+  int scrubPwm;                    // PWM the floor takes from in-place turns (0: none)
+};
+
+static const Scenario SCENARIOS[] = {
+  {
+    "turn90",
+    "turn 90 and -90 in open space; checks the default turn table",
+    8000,
+    "arena 600 600\nstart 300 300 90\n",
+    "1500 avoid off\n2000 turn 90\n5000 turn -90\n",
+    nullptr, nullptr, 0, nullptr, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    "avoid",
+    "drive at a wall; checks detection distance and the 500 ms back / 72 degree turn phases",
+    14000,
+    "arena 300 200\nstart 100 100 0\n",
+    "1500 forward\n",
+    nullptr, nullptr, 0, nullptr, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    "bci",
+    "discrete BCI-style command stream through a cluttered room",
+    20000,
+    "arena 400 300\npost 200 150 15\nbox 300 40 40 60\nstart 50 150 0\ngoal 350 250 30\n",
+    "1500 speed 120\n1600 forward\n4000 turn -45\n4700 forward\n7000 stop\n"
+    "7500 turn 90\n9500 forward 3\n13000 turn -90\n15500 forward\n19000 stop\n19500 status\n19600 mem\n19700 ping 7 19700\n",
+    nullptr, nullptr, 0, nullptr, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    "intent",
+    "noisy 50 Hz classifier probability stream; checks decision-to-motion latency and stream-loss stop",
+    14000,
+    "arena 600 600\nstart 300 300 0\n",
+    "1500 avoid off\n1600 intent on\n13900 status\n",
+    "2000 forward\n4500 left\n5500 forward\n7000 right\n7800 rest\n9000 backward\n10500 rest\n"
+    "11500 forward\n12500 off\n",
+    nullptr,
+    50,
+    nullptr, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    "deadend",
+    "dead-end corridor with the host re-sending forward; avoidance turns toward space mapped while turning",
+    32000,
+    "arena 400 300\nbox 250 0 20 300\nstart 100 240 0\n",
+    "1500 avoid on\n1600 forward\n3600 forward\n5600 forward\n7600 forward\n9600 forward\n11600 forward\n"
+    "13600 forward\n15600 forward\n17600 forward\n19600 forward\n21600 forward\n23600 forward\n"
+    "25600 forward\n27600 forward\n29600 forward\n31500 grid\n",
+    nullptr, nullptr, 0, nullptr, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    "teleop",
+    "50 Hz velocity setpoint stream with jitter and dropped frames; checks arcs and the dead-man stop",
+    12000,
+    "arena 600 600\nstart 300 300 0\n",
+    "1500 avoid off\n1600 drive\n11900 status\n",
+    nullptr,
+    "2000 150 0\n4000 150 60\n6000 0 -150\n7000 -120 0\n8500 100 -40\n10000 off\n",
+    50,
+    nullptr, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    "mission",
+    "uploaded patrol program drives to each wall and turns right, four times, with no host traffic while it runs",
+    50000,
+    "arena 300 300\nstart 60 60 90\n",
+    "1500 avoid on\n2000 run\n49500 mission\n",
+    nullptr, nullptr, 0,
+    "# Patrol the room: drive until a wall is near, then turn right\n"
+    "repeat 4\n  forward 150\n  wait until distance < 40\n  stop\n  turn 90\nend\n",
+    0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    "unplug",
+    "sensor unplugged while driving and plugged back in; checks the breaker trips, backs off and restores",
+    24000,
+    "arena 400 300\nstart 60 150 0\n",
+    "1500 avoid on\n1600 forward\n9000 status\n9100 forward\n14500 forward\n23500 status\n",
+    nullptr, nullptr, 0, nullptr,
+    4000, 12000, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    "estop",
+    "Ctrl-C emergency stop while driving and while the loop is hung; checks motors cut inside 1 ms",
+    9000,
+    "arena 400 300\nstart 60 150 0\n",
+    "1500 avoid on\n1600 forward\n3000 \\x03\n3500 forward\n4000 estop off\n4200 forward\n"
+    "6000 \\x03\n8000 status\n8100 estop off\n",
+    nullptr, nullptr, 0, nullptr, 0, 0,
+    5500, 2000, 0, 0, 0, 0,
+  },
+  {
+    "govern",
+    "operator turns late at each wall with the speed governor on; it slows the car so no maneuver is needed",
+    30000,
+    "arena 300 300\nstart 50 50 0\n",
+    "1500 avoid on\n1550 govern on\n1600 forward\n12600 turn -90\n14000 forward\n24600 turn -90\n"
+    "26000 forward\n29500 stop\n29600 status\n",
+    nullptr, nullptr, 0, nullptr, 0, 0, 0, 0, 0, 0, 0, 0,
+  },
+  {
+    "flow",
+    "host bursts 400 pings with credit-based flow control on; checks none is lost or cut",
+    12000,
+    "arena 600 600\nstart 300 300 0\n",
+    "1500 avoid off\n1600 flow on\n11500 status\n",
+    nullptr, nullptr, 0, nullptr, 0, 0, 0, 0,
+    2000, 400, 0, 0,
+  },
+  {
+    "recover",
+    "task watchdog reset while driving; checks state comes back from RTC memory and a re-sent command is not run twice",
+    7000,
+    "arena 400 300\nstart 60 150 0\n",
+    "1500 \\x231 speed 120\n1600 \\x232 govern on\n1700 \\x233 forward\n4500 \\x233 forward\n"
+    "6000 \\x234 stop\n6100 \\x235 status\n",
+    nullptr, nullptr, 0, nullptr, 0, 0, 0, 0, 0, 0,
+    4000,
+    0,
+  },
+  {
+    "calibrate",
+    "carpet slows in-place turns unevenly across speeds; turns miss until the table is calibrated against a wall",
+    100000,
+    "arena 300 300\nstart 60 150 180\n",
+    "1500 avoid off\n2000 turn 90\n5000 turn -90\n8000 calibrate\n90000 turn 90\n94000 turn -90 120\n"
+    "99000 status\n",
+    nullptr, nullptr, 0, nullptr, 0, 0, 0, 0, 0, 0, 0,
+    20,
+  },
+};
+
+// Class index of an intent name in frame order, -1 for "off" (stop sending)
+static int intentIndex(const std::string& name) {
+  for (int i = 0; i < INTENT_COUNT; i++) {
+    if (name == IntentFilter::intentName(i)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Motor direction byte the firmware should latch for an intent
+static int intentDirection(int intent) {
+  switch (intent) {
+    case INTENT_FORWARD:  return Forward;
+    case INTENT_BACKWARD: return Backward;
+    case INTENT_LEFT:     return Contrarotate;
+    case INTENT_RIGHT:    return Clockwise;
+    default:              return Stop;
+  }
+}
+
+// Plays the BCI host: streams classifier probability frames for a schedule of
+// true intents. The true class averages 0.6 with heavy noise, and one frame in
+// twenty is an artifact that spikes a wrong class.
+class IntentStreamOperator : public SimOperator {
+  private:
+    std::vector<ScriptCommand> schedule;
+    uint64_t frameMicros;
+    uint64_t nextFrame;
+    std::mt19937 rng;
+
+  public:
+    IntentStreamOperator(const std::vector<ScriptCommand>& intents, unsigned int hz, unsigned int seed)
+        : schedule(intents), frameMicros(1000000 / hz), nextFrame(0), rng(seed) {}
+
+    void onStep(uint64_t nowMicros, const SimCar& car, SimBoard& board) override {
+      if (nowMicros < nextFrame) {
+        return;
+      }
+      nextFrame = nowMicros + frameMicros;
+
+      int intent = INTENT_COUNT;
+      for (size_t i = 0; i < schedule.size() && schedule[i].atMillis * 1000ULL <= nowMicros; i++) {
+        intent = intentIndex(schedule[i].text);
+      }
+      if (intent < 0 || intent == INTENT_COUNT) {
+        return;
+      }
+
+      std::normal_distribution<double> noise(0.0, 0.18);
+      std::uniform_real_distribution<double> unit(0.0, 1.0);
+      double probability[INTENT_COUNT];
+      double rest = 0;
+      for (int i = 0; i < INTENT_COUNT; i++) {
+        probability[i] = i == intent ? 0.0 : unit(rng);
+        rest += probability[i];
+      }
+      double truth = std::min(0.95, std::max(0.05, 0.6 + noise(rng)));
+      if (unit(rng) < 0.05) {
+        int wrong = (intent + 1 + static_cast<int>(unit(rng) * (INTENT_COUNT - 1))) % INTENT_COUNT;
+        truth = 0.05;
+        probability[wrong] += 4.0 * rest;
+        rest *= 5.0;
+      }
+
+      char frame[2 * INTENT_COUNT + 3];
+      frame[0] = '@';
+      for (int i = 0; i < INTENT_COUNT; i++) {
+        double p = i == intent ? truth : (1.0 - truth) * probability[i] / rest;
+        snprintf(frame + 1 + 2 * i, 3, "%02X", static_cast<unsigned>(p * 255 + 0.5));
+      }
+      frame[2 * INTENT_COUNT + 1] = '\n';
+      frame[2 * INTENT_COUNT + 2] = '\0';
+      board.feedSerial(frame);
+    }
+};
+
+// Plays a teleoperation host: streams '>' velocity setpoints for a schedule of
+// "<linear> <turn>" values until "off". Frames jitter by up to 5 ms and one in
+// twenty is lost, which must not trip the dead-man timeout.
+class SetpointStreamOperator : public SimOperator {
+  private:
+    std::vector<ScriptCommand> schedule;
+    uint64_t frameMicros;
+    uint64_t nextFrame;
+    uint64_t lastFrame;
+    unsigned long framesSent;
+    std::mt19937 rng;
+
+  public:
+    SetpointStreamOperator(const std::vector<ScriptCommand>& setpoints, unsigned int hz, unsigned int seed)
+        : schedule(setpoints), frameMicros(1000000 / hz), nextFrame(0), lastFrame(0), framesSent(0), rng(seed) {}
+
+    void onStep(uint64_t nowMicros, const SimCar& car, SimBoard& board) override {
+      if (nowMicros < nextFrame) {
+        return;
+      }
+      std::uniform_int_distribution<int> jitter(-5000, 5000);
+      std::uniform_real_distribution<double> unit(0.0, 1.0);
+      nextFrame = nowMicros + frameMicros + jitter(rng);
+
+      const std::string* values = nullptr;
+      for (size_t i = 0; i < schedule.size() && schedule[i].atMillis * 1000ULL <= nowMicros; i++) {
+        values = &schedule[i].text;
+      }
+      if (values == nullptr || *values == "off" || unit(rng) < 0.05) {
+        return;
+      }
+
+      std::string frame = ">" + *values + "\n";
+      board.feedSerial(frame.c_str());
+      lastFrame = nowMicros;
+      framesSent++;
+    }
+
+    uint64_t getLastFrame() const { return lastFrame; }
+    unsigned long getFramesSent() const { return framesSent; }
+};
+
+// Plays a host pushing a burst of numbered pings as fast as it is allowed. Until
+// the firmware confirms flow control it sends everything at once; after that it
+// keeps within the credit the firmware advertises and returns in "~N" lines.
+class BurstOperator : public SimOperator, public SimSerialListener {
+  private:
+    uint64_t burstAt;
+    unsigned int lines;
+    unsigned int linesSent;
+    bool flowControl;
+    unsigned long credit;
+    unsigned long creditLines;
+    unsigned long waits;
+    bool waiting;
+    std::string partial;
+
+  public:
+    BurstOperator(unsigned long atMillis, unsigned int count)
+        : burstAt(atMillis * 1000ULL), lines(count), linesSent(0), flowControl(false), credit(0),
+          creditLines(0), waits(0), waiting(false) {}
+
+    void onStep(uint64_t nowMicros, const SimCar& car, SimBoard& board) override {
+      if (lines == 0 || nowMicros < burstAt) {
+        return;
+      }
+      while (linesSent < lines) {
+        char line[24];
+        int length = snprintf(line, sizeof(line), "ping %u\n", linesSent + 1);
+        if (flowControl && credit < static_cast<unsigned long>(length)) {
+          waits += waiting ? 0 : 1;
+          waiting = true;
+          return;
+        }
+        waiting = false;
+        if (flowControl) {
+          credit -= length;
+        }
+        board.feedSerial(line);
+        linesSent++;
+      }
+    }
+
+    void onSerialOutput(uint64_t nowMicros, const char* data, size_t size) override {
+      for (size_t i = 0; i < size; i++) {
+        if (data[i] != '\n') {
+          partial += data[i];
+          continue;
+        }
+        unsigned long value;
+        if (sscanf(partial.c_str(), "Flow control on: %lu bytes", &value) == 1) {
+          flowControl = true;
+          credit = value;
+        } else if (flowControl && sscanf(partial.c_str(), "~%lu", &value) == 1) {
+          credit += value;
+          creditLines++;
+        } else if (partial.compare(0, 16, "Flow control off") == 0) {
+          flowControl = false;
+        }
+        partial.clear();
+      }
+    }
+
+    bool isFlowControlled() const { return flowControl; }
+    unsigned int getLinesSent() const { return linesSent; }
+    unsigned long getCreditLines() const { return creditLines; }
+    unsigned long getWaits() const { return waits; }
+};
+
+// Check that the car kept moving while frames flowed and stopped once they ended
+static void printSetpointReport(const SetpointStreamOperator& stream, const SimCar& car) {
+  const std::vector<SimCar::MotorEvent>& events = car.getEvents();
+  int deadmanStops = 0;
+  double stopAfter = -1;
+  for (size_t e = 0; e < events.size(); e++) {
+    bool stopped = !events[e].enabled || events[e].direction == Stop;
+    if (!stopped) {
+      continue;
+    }
+    if (events[e].atMicros > stream.getLastFrame()) {
+      stopAfter = (events[e].atMicros - stream.getLastFrame()) / 1000.0;
+    } else if (e > 0) {
+      deadmanStops++;  // Stopped while the stream was still running
+    }
+  }
+
+  printf("Setpoints: %lu frames sent; ", stream.getFramesSent());
+  if (stopAfter >= 0) {
+    printf("dead-man stop %.0f ms after the last frame", stopAfter);
+  } else {
+    printf("car never stopped after the last frame");
+  }
+  printf(", %d stops while streaming\n", deadmanStops);
+}
+
+// Time from the last ping before each switch from driving forward to reversing, which is how
+// avoidance starts, to that switch
+static void printReactionLatency(const SimCar& car) {
+  const std::vector<SimCar::MotorEvent>& events = car.getEvents();
+  double total = 0, worst = 0;
+  int reactions = 0;
+  for (size_t e = 1; e < events.size(); e++) {
+    if (!events[e - 1].enabled || events[e - 1].direction != Forward || !events[e].enabled ||
+        events[e].direction != Backward || events[e].lastPingAt == 0) {
+      continue;
+    }
+    double latency = (events[e].atMicros - events[e].lastPingAt) / 1000.0;
+    total += latency;
+    worst = std::max(worst, latency);
+    reactions++;
+  }
+  if (reactions > 0) {
+    printf("; last ping to reversing mean %.1f ms, max %.1f ms", total / reactions, worst);
+  }
+}
+
+// How far the governor slowed forward driving: each step down in forward PWM without stopping is
+// the cap tightening on a reading
+static void printGovernorReport(const SimCar& car, unsigned long maneuvers) {
+  const std::vector<SimCar::MotorEvent>& events = car.getEvents();
+  int steps = 0, lowest = 0;
+  for (size_t e = 1; e < events.size(); e++) {
+    const SimCar::MotorEvent& before = events[e - 1];
+    const SimCar::MotorEvent& after = events[e];
+    if (!before.enabled || before.direction != Forward || !after.enabled || after.direction != Forward) {
+      continue;
+    }
+    int pwm = std::max(after.pwmLeft, after.pwmRight);
+    if (pwm < std::max(before.pwmLeft, before.pwmRight)) {
+      steps++;
+      lowest = lowest == 0 ? pwm : std::min(lowest, pwm);
+    }
+  }
+  printf("Governor: forward speed eased %d times", steps);
+  if (steps > 0) {
+    printf(", down to PWM %d", lowest);
+  }
+  printf("; %lu avoidance maneuvers\n", maneuvers);
+}
+
+// Compare the intent schedule with what the motors actually did
+static void printIntentLatency(const std::vector<ScriptCommand>& schedule, const SimCar& car) {
+  const std::vector<SimCar::MotorEvent>& events = car.getEvents();
+  double total = 0, worst = 0, best = 1e9;
+  int measured = 0, missed = 0, spurious = 0;
+
+  for (size_t i = 0; i < schedule.size(); i++) {
+    uint64_t from = schedule[i].atMillis * 1000ULL;
+    uint64_t until = i + 1 < schedule.size() ? schedule[i + 1].atMillis * 1000ULL : UINT64_MAX;
+    int intent = intentIndex(schedule[i].text);
+    int expected = intentDirection(intent);
+    int previous = i > 0 ? intentDirection(intentIndex(schedule[i - 1].text)) : Stop;
+
+    bool reached = false;
+    for (size_t e = 0; e < events.size(); e++) {
+      if (events[e].atMicros < from || events[e].atMicros >= until) {
+        continue;
+      }
+      int direction = events[e].enabled ? events[e].direction : Stop;
+      if (direction == expected && !reached) {
+        double latency = (events[e].atMicros - from) / 1000.0;
+        total += latency;
+        worst = std::max(worst, latency);
+        best = std::min(best, latency);
+        measured++;
+        reached = true;
+      } else if (direction != expected && (reached || direction != previous)) {
+        spurious++;
+      }
+    }
+    if (!reached) {
+      missed++;
+    }
+  }
+
+  printf("Intent: %zu changes, decision-to-motion latency mean %.0f ms, min %.0f ms, max %.0f ms; "
+         "%d missed, %d spurious motor commands\n",
+         schedule.size(), measured > 0 ? total / measured : 0.0, measured > 0 ? best : 0.0, worst,
+         missed, spurious);
+}
+
+// True if a motor event leaves the car without drive
+static bool motorsCut(const SimCar::MotorEvent& event) {
+  return !event.enabled || event.direction == Stop || (event.pwmLeft == 0 && event.pwmRight == 0);
+}
+
+// Time from each emergency stop byte typed while the car drove to the motors being cut; false if
+// any took over the budget
+static bool printEstopLatency(const std::vector<ScriptCommand>& script, const std::vector<uint64_t>& typedMicros,
+                              const SimCar& car) {
+  const std::vector<SimCar::MotorEvent>& events = car.getEvents();
+  double total = 0, worst = 0;
+  int measured = 0, missed = 0, whileStopped = 0;
+
+  for (size_t i = 0; i < script.size() && i < typedMicros.size(); i++) {
+    if (script[i].text.find(static_cast<char>(ESTOP_BYTE)) == std::string::npos) {
+      continue;
+    }
+    size_t e = 0;
+    while (e < events.size() && events[e].atMicros < typedMicros[i]) {
+      e++;
+    }
+    if (e == 0 || motorsCut(events[e - 1])) {
+      whileStopped++;
+      continue;
+    }
+    bool cut = false;
+    for (; e < events.size() && !cut; e++) {
+      if (motorsCut(events[e])) {
+        double latency = (events[e].atMicros - typedMicros[i]) / 1000.0;
+        total += latency;
+        worst = std::max(worst, latency);
+        measured++;
+        cut = true;
+      }
+    }
+    if (!cut) {
+      missed++;
+    }
+  }
+  if (measured + missed + whileStopped == 0) {
+    return true;
+  }
+
+  bool ok = missed == 0 && worst <= ESTOP_BUDGET_MS;
+  printf("Emergency stop: %d bytes while driving, byte-to-motors-cut mean %.3f ms, max %.3f ms; "
+         "%d missed, %d sent while stopped%s\n",
+         measured + missed, measured > 0 ? total / measured : 0.0, worst, missed, whileStopped,
+         ok ? "" : " - FAIL");
+  return ok;
+}
+
+// How fast the firmware got going again after the injected reset; false if it came back without
+// its checkpoint
+static bool printRecoveryReport(const Simulation& simulation) {
+  uint64_t resetAt = simulation.getResetMicros();
+  if (resetAt == 0) {
+    printf("Reset: not reached before the end of the run\n");
+    return true;
+  }
+
+  // First write after the reset that drives the motors again
+  const std::vector<SimCar::MotorEvent>& events = simulation.getCar().getEvents();
+  double drivingAfter = -1;
+  for (size_t e = 0; e < events.size() && drivingAfter < 0; e++) {
+    if (events[e].atMicros >= resetAt && !motorsCut(events[e])) {
+      drivingAfter = (events[e].atMicros - resetAt) / 1000.0;
+    }
+  }
+
+  std::string resumed = simulation.lastOutput("Resumed after");
+  printf("Reset: task watchdog at %.1f ms, setup() again took %.1f ms; ", resetAt / 1000.0,
+         (simulation.getRecoveredMicros() - resetAt) / 1000.0);
+  if (drivingAfter >= 0) {
+    printf("motors driving again %.1f ms after the reset", drivingAfter);
+  } else {
+    printf("motors never driven again");
+  }
+  // The firmware's own tally, from a status command late in the script
+  unsigned long run = 0, duplicates = 0;
+  if (sscanf(simulation.lastOutput("Sequenced commands:").c_str(),
+             "Sequenced commands: %lu run, %lu duplicates", &run, &duplicates) == 2) {
+    printf("; %lu commands acknowledged, %lu of them re-sent after the reset and not run again",
+           simulation.countOutput("ack "), duplicates);
+  }
+  printf("%s\n", resumed.empty() ? " - FAIL: state not recovered" : "");
+  return !resumed.empty();
+}
+
+// Rotation each scripted turn produced, coasting included, against the angle it asked for; false
+// if one typed after 'calibrate' missed by more than the tolerance
+static bool printTurnReport(const std::vector<ScriptCommand>& script, const std::vector<uint64_t>& typedMicros,
+                            const SimCar& car) {
+  const std::vector<SimCar::MotorEvent>& events = car.getEvents();
+  bool calibrated = false;
+  bool ok = true;
+
+  for (size_t i = 0; i < script.size() && i < typedMicros.size(); i++) {
+    if (script[i].text == "calibrate") {
+      calibrated = true;
+    }
+    int degrees = 0, speed = TURN_SPEED;
+    if (sscanf(script[i].text.c_str(), "turn %d %d", &degrees, &speed) < 1 || degrees == 0) {
+      continue;
+    }
+
+    // The spin the command started, then whatever follows it stopping
+    size_t e = 0;
+    while (e < events.size() && (events[e].atMicros < typedMicros[i] || motorsCut(events[e]) ||
+                                 (events[e].direction != Clockwise && events[e].direction != Contrarotate))) {
+      e++;
+    }
+    if (e == events.size()) {
+      printf("Turn %d deg at PWM %d: never started\n", degrees, speed);
+      continue;
+    }
+    size_t stop = e + 1;
+    while (stop < events.size() && events[stop].direction == events[e].direction && !motorsCut(events[stop])) {
+      stop++;
+    }
+    double rotatedUntil = stop + 1 < events.size() ? events[stop + 1].clockwiseRotation : car.getClockwiseRotation();
+    double rotated = rotatedUntil - events[e].clockwiseRotation;
+    double errorPct = 100.0 * (rotated - degrees) / std::abs(degrees);
+    bool miss = calibrated && std::abs(errorPct) > TURN_TOLERANCE_PCT;
+    ok = ok && !miss;
+    printf("Turn %d deg at PWM %d: rotated %.1f deg (%+.1f%%)%s%s\n", degrees, speed, rotated, errorPct,
+           calibrated ? ", calibrated table" : "", miss ? " - FAIL" : "");
+  }
+  return ok;
+}
+
+static const Scenario* findScenario(const char* name) {
+  for (size_t i = 0; i < sizeof(SCENARIOS) / sizeof(SCENARIOS[0]); i++) {
+    if (strcmp(SCENARIOS[i].name, name) == 0) {
+      return &SCENARIOS[i];
+    }
+  }
+  return nullptr;
+}
+
+static void printUsage(const char* program) {
+  printf("Usage: %s [options]\n", program);
+  printf("  --scenario NAME    Built-in scenario:");
+  for (size_t i = 0; i < sizeof(SCENARIOS) / sizeof(SCENARIOS[0]); i++) {
+    printf(" %s", SCENARIOS[i].name);
+  }
+  printf("\n");
+  printf("  --world FILE       Obstacle map (wall/box/arena/post/start/goal lines, cm)\n");
+  printf("  --script FILE      Serial input, one '<ms> <command>' per line\n");
+  printf("  --duration MS      Virtual time to simulate\n");
+  printf("  --loop-us US       Virtual cost of one loop() iteration (default 1000)\n");
+  printf("  --seed N           Sensor noise seed\n");
+  printf("  --noise CM         Ultrasonic noise standard deviation\n");
+  printf("  --dropout P        Probability that a ping gets no echo\n");
+  printf("  --scrub PWM        PWM the floor takes from in-place turns, as carpet would\n");
+  printf("  --unplugged        Simulate a disconnected ultrasonic sensor\n");
+  printf("  --unplug FROM:TO   Disconnect the sensor between these times (ms)\n");
+  printf("  --hang AT:MS       Stall the loop for MS from AT (ms), as if stuck in a driver\n");
+  printf("  --burst AT:N       Send N pings at once from AT (ms), within the credit once 'flow on' is confirmed\n");
+  printf("  --reset AT         Reset the board at AT (ms) as the task watchdog would, keeping RTC memory\n");
+  printf("  --quiet            Do not print firmware serial output\n");
+  printf("  --no-alloc         Fail if the firmware allocates from the heap inside loop()\n");
+  printf("  --scan-out FILE    Decode the last 'scan' dump to CSV (at_us,echo_us,distance_cm)\n");
+  printf("  --mission FILE     Compile a mission script and upload it from %lu ms (the script sends 'run')\n",
+         MISSION_UPLOAD_MS);
+  printf("  --trace FILE       Write a Chrome trace of loop stages and blocking calls (open in Perfetto)\n");
+  printf("  --trace-events N   Trace buffer size in events (default %d)\n", DEFAULT_TRACE_EVENTS);
+}
+
+// Check a scan dump frame and write its samples as CSV
+static bool writeScanCsv(const std::vector<uint8_t>& frame, const std::string& path) {
+  ScanDumpHeader header;
+  if (frame.size() < sizeof(header) + sizeof(uint32_t)) {
+    fprintf(stderr, "Scan: no dump captured\n");
+    return false;
+  }
+  memcpy(&header, frame.data(), sizeof(header));
+  size_t sampleBytes = static_cast<size_t>(header.sampleCount) * header.sampleSize;
+  if (memcmp(header.magic, "SCN1", 4) != 0 || header.sampleSize != sizeof(ScanSample) ||
+      frame.size() != sizeof(header) + sampleBytes + sizeof(uint32_t)) {
+    fprintf(stderr, "Scan: malformed dump\n");
+    return false;
+  }
+
+  uint32_t sum = 0, checksum;
+  for (size_t i = 0; i < sizeof(header) + sampleBytes; i++) {
+    sum += frame[i];
+  }
+  memcpy(&checksum, frame.data() + sizeof(header) + sampleBytes, sizeof(checksum));
+  if (sum != checksum) {
+    fprintf(stderr, "Scan: checksum mismatch\n");
+    return false;
+  }
+
+  FILE* out = fopen(path.c_str(), "w");
+  if (out == nullptr) {
+    fprintf(stderr, "Scan: cannot write %s\n", path.c_str());
+    return false;
+  }
+  fprintf(out, "at_us,echo_us,distance_cm\n");
+  for (size_t i = 0; i < header.sampleCount; i++) {
+    ScanSample sample;
+    memcpy(&sample, frame.data() + sizeof(header) + i * sizeof(sample), sizeof(sample));
+    fprintf(out, "%u,%u,%.1f\n", static_cast<unsigned>(sample.atMicros), static_cast<unsigned>(sample.echoMicros),
+            sample.echoMicros * 0.0343 / 2);
+  }
+  fclose(out);
+  printf("Scan: %u samples over %.1f ms written to %s\n", static_cast<unsigned>(header.sampleCount),
+         header.durationMicros / 1000.0, path.c_str());
+  return true;
+}
+
+static void printTimeline(const SimCar& car, uint64_t endMicros) {
+  const std::vector<SimCar::MotorEvent>& events = car.getEvents();
+  printf("Motor timeline:\n");
+  printf("  %9s %9s  %-13s %7s %10s %10s\n", "t(ms)", "dur(ms)", "command", "pwm", "rot(deg)", "dist(cm)");
+
+  for (size_t i = 0; i < events.size(); i++) {
+    const SimCar::MotorEvent& e = events[i];
+    bool last = i + 1 == events.size();
+    uint64_t until = last ? endMicros : events[i + 1].atMicros;
+    double rotationAfter = last ? car.getClockwiseRotation() : events[i + 1].clockwiseRotation;
+    double distanceAfter = last ? car.getDistanceTravelled() : events[i + 1].distanceTravelled;
+
+    // Left/right duty when the sides differ
+    char pwm[16];
+    if (e.pwmLeft == e.pwmRight) {
+      snprintf(pwm, sizeof(pwm), "%d", e.pwmLeft);
+    } else {
+      snprintf(pwm, sizeof(pwm), "%d/%d", e.pwmLeft, e.pwmRight);
+    }
+    printf("  %9.1f %9.1f  %-13s %7s %10.1f %10.1f\n",
+           e.atMicros / 1000.0, (until - e.atMicros) / 1000.0,
+           e.enabled ? directionName(e.direction) : "Disabled", pwm,
+           rotationAfter - e.clockwiseRotation, distanceAfter - e.distanceTravelled);
+  }
+}
+
+int main(int argc, char** argv) {
+  const Scenario* scenario = nullptr;
+  std::string worldPath, scriptPath, scanOutPath, tracePath, missionPath;
+  SimulationOptions options;
+  CarModel model;
+  bool durationSet = false;
+  bool unplugSet = false;
+  bool hangSet = false;
+  bool burstSet = false;
+  bool resetSet = false;
+  bool scrubSet = false;
+  unsigned long burstAtMillis = 0;
+  unsigned int burstLines = 0;
+  bool failOnLoopAllocation = false;
+  options.echoOutput = true;
+  options.recordMotorEvents = true;
+  options.recordOutput = true;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(arg, "--scenario") == 0 && hasValue) {
+      scenario = findScenario(argv[++i]);
+      if (scenario == nullptr) {
+        fprintf(stderr, "Unknown scenario '%s'\n", argv[i]);
+        return 2;
+      }
+    } else if (strcmp(arg, "--world") == 0 && hasValue) {
+      worldPath = argv[++i];
+    } else if (strcmp(arg, "--script") == 0 && hasValue) {
+      scriptPath = argv[++i];
+    } else if (strcmp(arg, "--duration") == 0 && hasValue) {
+      options.durationMillis = strtoul(argv[++i], nullptr, 10);
+      durationSet = true;
+    } else if (strcmp(arg, "--loop-us") == 0 && hasValue) {
+      options.loopMicros = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(arg, "--seed") == 0 && hasValue) {
+      options.seed = static_cast<unsigned int>(strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(arg, "--noise") == 0 && hasValue) {
+      model.noiseStdDev = atof(argv[++i]);
+    } else if (strcmp(arg, "--dropout") == 0 && hasValue) {
+      model.dropoutRate = atof(argv[++i]);
+    } else if (strcmp(arg, "--scrub") == 0 && hasValue) {
+      model.scrubPwm = atoi(argv[++i]);
+      scrubSet = true;
+    } else if (strcmp(arg, "--unplugged") == 0) {
+      model.sensorConnected = false;
+    } else if (strcmp(arg, "--unplug") == 0 && hasValue) {
+      if (sscanf(argv[++i], "%lu:%lu", &model.unplugFromMillis, &model.unplugUntilMillis) != 2) {
+        fprintf(stderr, "Bad unplug window '%s'\n", argv[i]);
+        return 2;
+      }
+      unplugSet = true;
+    } else if (strcmp(arg, "--hang") == 0 && hasValue) {
+      if (sscanf(argv[++i], "%lu:%lu", &options.hangAtMillis, &options.hangForMillis) != 2) {
+        fprintf(stderr, "Bad hang '%s'\n", argv[i]);
+        return 2;
+      }
+      hangSet = true;
+    } else if (strcmp(arg, "--burst") == 0 && hasValue) {
+      if (sscanf(argv[++i], "%lu:%u", &burstAtMillis, &burstLines) != 2) {
+        fprintf(stderr, "Bad burst '%s'\n", argv[i]);
+        return 2;
+      }
+      burstSet = true;
+    } else if (strcmp(arg, "--reset") == 0 && hasValue) {
+      options.resetAtMillis = strtoul(argv[++i], nullptr, 10);
+      resetSet = true;
+    } else if (strcmp(arg, "--quiet") == 0) {
+      options.echoOutput = false;
+    } else if (strcmp(arg, "--no-alloc") == 0) {
+      failOnLoopAllocation = true;
+    } else if (strcmp(arg, "--scan-out") == 0 && hasValue) {
+      scanOutPath = argv[++i];
+    } else if (strcmp(arg, "--mission") == 0 && hasValue) {
+      missionPath = argv[++i];
+    } else if (strcmp(arg, "--trace") == 0 && hasValue) {
+      tracePath = argv[++i];
+    } else if (strcmp(arg, "--trace-events") == 0 && hasValue) {
+      options.traceEvents = strtoul(argv[++i], nullptr, 10);
+    } else {
+      printUsage(argv[0]);
+      return strcmp(arg, "--help") == 0 ? 0 : 2;
+    }
+  }
+
+  if (scenario == nullptr && worldPath.empty() && scriptPath.empty()) {
+    printUsage(argv[0]);
+    return 2;
+  }
+  if (options.loopMicros == 0) {
+    options.loopMicros = 1;
+  }
+  if (!tracePath.empty() && options.traceEvents == 0) {
+    options.traceEvents = DEFAULT_TRACE_EVENTS;
+  }
+
+  World world;
+  std::vector<ScriptCommand> script;
+  std::vector<ScriptCommand> intents;
+  std::vector<ScriptCommand> setpoints;
+  std::string error;
+
+  if (scenario != nullptr) {
+    printf("Scenario %s: %s\n", scenario->name, scenario->description);
+    world.parse(scenario->world, &error);
+    parseScript(scenario->script, &script, &error);
+    if (scenario->intents != nullptr) {
+      parseScript(scenario->intents, &intents, &error);
+    }
+    if (scenario->setpoints != nullptr) {
+      parseScript(scenario->setpoints, &setpoints, &error);
+    }
+    if (!durationSet) {
+      options.durationMillis = scenario->durationMillis;
+    }
+    if (!unplugSet) {
+      model.unplugFromMillis = scenario->unplugFromMillis;
+      model.unplugUntilMillis = scenario->unplugUntilMillis;
+    }
+    if (!hangSet) {
+      options.hangAtMillis = scenario->hangAtMillis;
+      options.hangForMillis = scenario->hangForMillis;
+    }
+    if (!burstSet) {
+      burstAtMillis = scenario->burstAtMillis;
+      burstLines = scenario->burstLines;
+    }
+    if (!resetSet) {
+      options.resetAtMillis = scenario->resetAtMillis;
+    }
+    if (!scrubSet) {
+      model.scrubPwm = scenario->scrubPwm;
+    }
+  }
+  if (!worldPath.empty() && !world.loadFile(worldPath, &error)) {
+    fprintf(stderr, "World: %s\n", error.c_str());
+    return 2;
+  }
+  if (!scriptPath.empty()) {
+    script.clear();
+    if (!loadScriptFile(scriptPath, &script, &error)) {
+      fprintf(stderr, "Script: %s\n", error.c_str());
+      return 2;
+    }
+  }
+
+  // Compile the mission and type its upload lines alongside the script
+  std::vector<uint8_t> mission;
+  bool missionOk = true;
+  if (!missionPath.empty()) {
+    missionOk = compileMissionFile(missionPath, &mission, &error);
+  } else if (scenario != nullptr && scenario->mission != nullptr) {
+    missionOk = compileMission(scenario->mission, &mission, &error);
+  }
+  if (!missionOk) {
+    fprintf(stderr, "Mission: %s\n", error.c_str());
+    return 2;
+  }
+  if (!mission.empty()) {
+    std::vector<std::string> upload = missionUploadLines(mission);
+    for (size_t i = 0; i < upload.size(); i++) {
+      script.push_back({MISSION_UPLOAD_MS + i * MISSION_LINE_GAP_MS, upload[i]});
+    }
+    std::stable_sort(script.begin(), script.end(), [](const ScriptCommand& a, const ScriptCommand& b) {
+      return a.atMillis < b.atMillis;
+    });
+  }
+
+  SketchFirmware firmware;
+  Simulation simulation(world, model, options);
+
+  std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+  unsigned int streamHz = scenario != nullptr && scenario->streamHz > 0 ? scenario->streamHz : 50;
+  IntentStreamOperator intentStream(intents, streamHz, options.seed);
+  SetpointStreamOperator setpointStream(setpoints, streamHz, options.seed);
+  BurstOperator burst(burstAtMillis, burstLines);
+  SimOperator* streamOperator = nullptr;
+  if (!intents.empty()) {
+    streamOperator = &intentStream;
+  } else if (!setpoints.empty()) {
+    streamOperator = &setpointStream;
+  } else if (burstLines > 0) {
+    streamOperator = &burst;
+    simulation.setOutputTap(&burst);
+  }
+  simulation.run(firmware, script, streamOperator);
+  double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+  const SimCar& car = simulation.getCar();
+  const SimBoardStats& stats = simulation.getBoard().getStats();
+  double simSeconds = simulation.getBoard().now() / 1e6;
+
+  printf("\nSimulated %.3f s in %.3f s wall (%.0fx real time), %lu loop iterations\n",
+         simSeconds, wallSeconds, wallSeconds > 0 ? simSeconds / wallSeconds : 0.0,
+         simulation.getLoopIterations());
+  printf("Final pose: x=%.1f cm y=%.1f cm heading=%.1f deg; travelled %.1f cm, rotated %.1f deg clockwise\n",
+         car.getX(), car.getY(), car.getHeadingDegrees(), car.getDistanceTravelled(),
+         car.getClockwiseRotation());
+  printf("Collisions: %lu, minimum clearance %.1f cm\n", car.getCollisions(), car.getMinClearance());
+  if (world.hasGoal()) {
+    if (car.getGoalReachedAt() >= 0) {
+      printf("Goal reached at %.3f s\n", car.getGoalReachedAt() / 1e6);
+    } else {
+      printf("Goal not reached\n");
+    }
+  }
+  printf("Boot: setup() took %.1f ms\n", simulation.getSetupMicros() / 1000.0);
+  printf("Sensor: %lu pings, %.1f ms blocked in pulseIn (%.1f%% of run)\n",
+         stats.pings, stats.pulseInMicros / 1000.0,
+         simSeconds > 0 ? 100.0 * stats.pulseInMicros / 1e6 / simSeconds : 0.0);
+  printf("Serial: %.1f ms blocked waiting for the transmit FIFO\n", stats.serialMicros / 1000.0);
+  printf("Idle: %.1f%% of the run asleep waiting for a timer or input, %lu early wakes\n",
+         simSeconds > 0 ? 100.0 * stats.idleMicros / 1e6 / simSeconds : 0.0, stats.wakes);
+  const SimHeapStats& heap = simulation.getBoard().getHeapStats();
+  printf("Heap: %lu allocations in loop(), %zu bytes live, %zu bytes peak\n",
+         simulation.getLoopAllocations(), heap.liveBytes, heap.peakBytes);
+  printTimeline(car, simulation.getBoard().now());
+  unsigned long maneuvers = simulation.countOutput("Starting avoidance maneuver");
+  if (maneuvers > 0) {
+    printf("Avoidance: %lu maneuvers", maneuvers);
+    printReactionLatency(car);
+    printf("\n");
+  }
+  if (simulation.countOutput("Speed governor enabled") > 0) {
+    printGovernorReport(car, maneuvers);
+  }
+  if (!mission.empty()) {
+    std::string outcome = simulation.lastOutput("Mission complete");
+    if (outcome.empty()) {
+      outcome = simulation.lastOutput("Mission aborted");
+    }
+    printf("Mission: %zu bytes in %zu upload lines; %s\n", mission.size(), missionUploadLines(mission).size(),
+           outcome.empty() ? "still running at the end of the run" : outcome.c_str());
+  }
+  if (model.unplugUntilMillis > model.unplugFromMillis) {
+    std::string tripped = simulation.lastOutput("WARNING: Ultrasonic sensor failed");
+    std::string restored = simulation.lastOutput("Ultrasonic sensor restored");
+    printf("Sensor outage %lu-%lu ms: %s; %s\n", model.unplugFromMillis, model.unplugUntilMillis,
+           tripped.empty() ? "breaker never tripped" : "breaker tripped",
+           restored.empty() ? "not restored" : restored.c_str());
+  }
+  bool estopOk = printEstopLatency(script, simulation.getTypedMicros(), car);
+  if (!intents.empty()) {
+    printIntentLatency(intents, car);
+  }
+  if (!setpoints.empty()) {
+    printSetpointReport(setpointStream, car);
+  }
+  bool turnsOk = printTurnReport(script, simulation.getTypedMicros(), car);
+  bool recoveryOk = options.resetAtMillis == 0 || printRecoveryReport(simulation);
+  bool burstOk = true;
+  if (burstLines > 0) {
+    unsigned long answered = simulation.countOutput("pong ");
+    printf("Burst: %u pings sent, %lu answered, %lu lost; %lu overlong lines dropped; "
+           "%lu credit lines, host waited for credit %lu times\n",
+           burst.getLinesSent(), answered, burst.getLinesSent() - answered,
+           simulation.countOutput("Error: line longer"), burst.getCreditLines(), burst.getWaits());
+    // Without flow control losses are expected; they are what the burst is there to show
+    burstOk = !burst.isFlowControlled() || answered == burst.getLinesSent();
+  }
+
+  if (!scanOutPath.empty() && !writeScanCsv(simulation.getBinaryFrame(), scanOutPath)) {
+    return 1;
+  }
+  if (!tracePath.empty()) {
+    const SimTrace& trace = simulation.getTrace();
+    if (!trace.writeJson(tracePath, scenario != nullptr ? scenario->name : "test_bench")) {
+      fprintf(stderr, "Cannot write %s\n", tracePath.c_str());
+      return 1;
+    }
+    printf("Trace: %zu events written to %s", trace.size(), tracePath.c_str());
+    if (trace.getDropped() > 0) {
+      printf(", %lu dropped once the buffer filled (raise --trace-events)", trace.getDropped());
+    }
+    printf("\n");
+  }
+
+  if (failOnLoopAllocation && simulation.getLoopAllocations() > 0) {
+    printf("FAIL: the loop path allocated from the heap\n");
+    return 1;
+  }
+  if (!estopOk || !burstOk || !recoveryOk || !turnsOk) {
+    return 1;
+  }
+  return car.getCollisions() > 0 ? 1 : 0;
+}
@@ -0,0 +1,261 @@
+#include "simulation.h"
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include "../test_bench/include/config.h"
+#include "../test_bench/src/lib/vehicle/vehicle.h"
+
+bool parseScript(const std::string& text, std::vector<ScriptCommand>* commands, std::string* error) {
+  std::istringstream lines(text);
+  std::string line;
+  int lineNumber = 0;
+
+  while (std::getline(lines, line)) {
+    lineNumber++;
+    std::string::size_type hash = line.find('#');
+    if (hash != std::string::npos) {
+      line = line.substr(0, hash);
+    }
+
+    std::istringstream fields(line);
+    unsigned long atMillis;
+    if (!(fields >> atMillis)) {
+      if (line.find_first_not_of(" \t\r") == std::string::npos) {
+        continue;
+      }
+      if (error) *error = "line " + std::to_string(lineNumber) + ": expected '<ms> <command>'";
+      return false;
+    }
+
+    std::string rest;
+    std::getline(fields, rest);
+    std::string::size_type start = rest.find_first_not_of(" \t");
+    std::string::size_type end = rest.find_last_not_of(" \t\r");
+    ScriptCommand command;
+    command.atMillis = atMillis;
+    command.text = start == std::string::npos ? "" : rest.substr(start, end - start + 1);
+    for (std::string::size_type escape = command.text.find("\\x"); escape != std::string::npos;
+         escape = command.text.find("\\x", escape + 1)) {
+      if (escape + 4 > command.text.size() || !isxdigit(static_cast<unsigned char>(command.text[escape + 2])) ||
+          !isxdigit(static_cast<unsigned char>(command.text[escape + 3]))) {
+        if (error) *error = "line " + std::to_string(lineNumber) + ": expected two hex digits after \\x";
+        return false;
+      }
+      char byte = static_cast<char>(std::stoi(command.text.substr(escape + 2, 2), nullptr, 16));
+      command.text.replace(escape, 4, 1, byte);
+    }
+    commands->push_back(command);
+  }
+  return true;
+}
+
+bool loadScriptFile(const std::string& path, std::vector<ScriptCommand>* commands, std::string* error) {
+  std::ifstream in(path.c_str());
+  if (!in) {
+    if (error) *error = "cannot open " + path;
+    return false;
+  }
+  std::stringstream text;
+  text << in.rdbuf();
+  return parseScript(text.str(), commands, error);
+}
+
+SimulationOptions::SimulationOptions() {
+  durationMillis = 10000;
+  loopMicros = 1000;
+  seed = 1;
+  echoOutput = false;
+  recordMotorEvents = false;
+  recordOutput = false;
+  stopAtGoal = false;
+  traceEvents = 0;
+  hangAtMillis = 0;
+  hangForMillis = 0;
+  resetAtMillis = 0;
+}
+
+Simulation::Simulation(const World& world, const CarModel& model, const SimulationOptions& simOptions)
+    : options(simOptions), car(world, model, simOptions.seed), trace(simOptions.traceEvents) {
+  outputTap = nullptr;
+  stopRequested = false;
+  loopIterations = 0;
+  setupAllocations = 0;
+  setupMicros = 0;
+  resetMicros = 0;
+  recoveredMicros = 0;
+  pendingLineStart = 0;
+  binaryRemaining = 0;
+  firmware = nullptr;
+  running = false;
+  script = nullptr;
+  nextCommand = 0;
+  simOperator = nullptr;
+  board.setMotorPins(EN_PIN, DATA_PIN, SHCP_PIN, STCP_PIN, PWM1_PIN, PWM2_PIN);
+  board.setUltrasonicPins(ULTRASONIC_TRIG_PIN, ULTRASONIC_ECHO_PIN);
+  car.setRecordEvents(options.recordMotorEvents);
+  board.setSerialListener(this);
+  board.setIdleListener(this);
+  board.attachPlant(&car);
+  if (options.traceEvents > 0) {
+    board.setTrace(&trace);
+  }
+  if (options.hangForMillis > 0) {
+    board.setHang(options.hangAtMillis * 1000ULL, options.hangForMillis * 1000ULL);
+  }
+}
+
+void Simulation::onSerialOutput(uint64_t nowMicros, const char* data, size_t size) {
+  if (outputTap != nullptr) {
+    outputTap->onSerialOutput(nowMicros, data, size);
+  }
+  for (size_t i = 0; i < size; i++) {
+    if (binaryRemaining > 0) {
+      binaryFrame.push_back(static_cast<uint8_t>(data[i]));
+      if (--binaryRemaining == 0 && options.echoOutput) {
+        printf("[%9.3f] <%zu byte binary frame>\n", nowMicros / 1e6, binaryFrame.size());
+      }
+      continue;
+    }
+    if (pendingLine.empty()) {
+      pendingLineStart = nowMicros;
+    }
+    if (data[i] == '\n') {
+      if (options.echoOutput) {
+        printf("[%9.3f] %s\n", pendingLineStart / 1e6, pendingLine.c_str());
+      }
+      if (options.recordOutput) {
+        outputLines.push_back(pendingLine);
+      }
+      std::string::size_type dump = pendingLine.find(" dump: ");
+      unsigned long frameBytes;
+      if (dump != std::string::npos &&
+          sscanf(pendingLine.c_str() + dump, " dump: %lu bytes follow", &frameBytes) == 1) {
+        binaryFrame.clear();
+        binaryRemaining = frameBytes;
+      }
+      pendingLine.clear();
+    } else if (data[i] != '\r') {
+      pendingLine += data[i];
+    }
+  }
+}
+
+unsigned long Simulation::countOutput(const std::string& prefix) const {
+  unsigned long count = 0;
+  for (size_t i = 0; i < outputLines.size(); i++) {
+    if (outputLines[i].compare(0, prefix.size(), prefix) == 0) {
+      count++;
+    }
+  }
+  return count;
+}
+
+std::string Simulation::lastOutput(const std::string& prefix) const {
+  for (size_t i = outputLines.size(); i > 0; i--) {
+    if (outputLines[i - 1].compare(0, prefix.size(), prefix) == 0) {
+      return outputLines[i - 1];
+    }
+  }
+  return "";
+}
+
+void Simulation::pollHost() {
+  // Type every command that is due, one line each
+  while (nextCommand < script->size() && (*script)[nextCommand].atMillis * 1000ULL <= board.now()) {
+    board.feedSerial(((*script)[nextCommand].text + "\n").c_str());
+    typedMicros.push_back(board.now());
+    if (options.traceEvents > 0) {
+      trace.instant(board.now(), (*script)[nextCommand].text.c_str(), TRACK_HOST);
+    }
+    nextCommand++;
+  }
+  if (simOperator != nullptr) {
+    simOperator->onStep(board.now(), car, board);
+  }
+}
+
+void Simulation::onIdleStep(uint64_t nowMicros) {
+  if (script != nullptr) {
+    pollHost();
+  }
+}
+
+void Simulation::run(SimFirmware& simFirmware, const std::vector<ScriptCommand>& commands,
+                     SimOperator* hostOperator) {
+  SimBoard::Scope scope(&board);
+  begin(simFirmware, commands, hostOperator);
+  runUntil(UINT64_MAX);
+  end();
+}
+
+void Simulation::begin(SimFirmware& simFirmware, const std::vector<ScriptCommand>& commands,
+                       SimOperator* hostOperator) {
+  SimBoard::Scope scope(&board);
+  firmware = &simFirmware;
+  script = &commands;
+  nextCommand = 0;
+  typedMicros.clear();
+  simOperator = hostOperator;
+  stopRequested = false;
+  running = true;
+
+  {
+    SimBoard::FirmwareScope inFirmware;
+    firmware->setup();
+  }
+  setupAllocations = board.getHeapStats().allocations;
+  setupMicros = board.now();
+}
+
+bool Simulation::runUntil(uint64_t untilMicros) {
+  SimBoard::Scope scope(&board);
+  const uint64_t endMicros = static_cast<uint64_t>(options.durationMillis) * 1000;
+  board.setYieldAt(untilMicros);
+
+  while (running && board.now() < untilMicros && board.now() < endMicros) {
+    pollHost();
+
+    {
+      SimBoard::FirmwareScope inFirmware;
+      if (options.traceEvents > 0) {
+        trace.begin(board.now(), "loop()");
+      }
+      firmware->loop();
+      if (options.traceEvents > 0) {
+        trace.end(board.now(), "loop()");
+      }
+    }
+    loopIterations++;
+    board.spend(options.loopMicros);
+
+    if (options.resetAtMillis > 0 && resetMicros == 0 && board.now() >= options.resetAtMillis * 1000ULL) {
+      // Whatever setup() allocates again is not loop allocation
+      unsigned long allocationsBefore = board.getHeapStats().allocations;
+      resetMicros = board.now();
+      board.reset(ESP_RST_TASK_WDT);
+      {
+        SimBoard::FirmwareScope inFirmware;
+        firmware->reset();
+        firmware->setup();
+      }
+      recoveredMicros = board.now();
+      setupAllocations += board.getHeapStats().allocations - allocationsBefore;
+    }
+
+    if (stopRequested || (options.stopAtGoal && car.getGoalReachedAt() >= 0)) {
+      running = false;
+    }
+  }
+  if (board.now() >= endMicros) {
+    running = false;
+  }
+  return running;
+}
+
+void Simulation::end() {
+  running = false;
+  firmware = nullptr;
+  script = nullptr;
+  simOperator = nullptr;
+}
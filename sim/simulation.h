@@ -0,0 +1,134 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <string>
+#include <vector>
+#include "hal/sim_board.h"
+#include "world.h"
+
+// A command line to type into the serial port at a given virtual time
+struct ScriptCommand {
+  unsigned long atMillis;
+  std::string text;
+};
+
+// Parse "<ms> <command>" lines; '#' starts a comment and \xNN types a raw byte
+bool parseScript(const std::string& text, std::vector<ScriptCommand>* commands, std::string* error);
+bool loadScriptFile(const std::string& path, std::vector<ScriptCommand>* commands, std::string* error);
+
+// Firmware entry points driven by the simulation
+class SimFirmware {
+  public:
+    virtual ~SimFirmware() {}
+    virtual void setup() = 0;
+    virtual void loop() = 0;
+    // Soft reset: drop RAM state as the chip would, keeping RTC memory; setup() runs next
+    virtual void reset() {}
+};
+
+// Host-side behaviour that watches the car between loop iterations and may type commands
+class SimOperator {
+  public:
+    virtual ~SimOperator() {}
+    virtual void onStep(uint64_t nowMicros, const SimCar& car, SimBoard& board) = 0;
+};
+
+struct SimulationOptions {
+  unsigned long durationMillis; // Virtual time to run for
+  unsigned long loopMicros;     // Virtual cost charged per loop() iteration
+  unsigned int seed;            // Sensor noise seed
+  bool echoOutput;              // Print firmware serial output with timestamps
+  bool recordMotorEvents;       // Keep the motor command timeline
+  bool recordOutput;            // Keep every line of firmware output
+  bool stopAtGoal;              // End the run once the goal is reached
+  size_t traceEvents;           // Timeline events to keep for a Chrome trace, 0 for none
+  unsigned long hangAtMillis;   // The loop stalls once for hangForMillis from here
+  unsigned long hangForMillis;  // 0: never
+  unsigned long resetAtMillis;  // The task watchdog resets the board once here (0: never)
+
+  SimulationOptions();
+};
+
+// One firmware instance on one virtual board driving one simulated car
+class Simulation : public SimSerialListener, public SimIdleListener {
+  private:
+    SimulationOptions options;
+    SimBoard board;
+    SimCar car;
+    std::string pendingLine;
+    uint64_t pendingLineStart;
+    size_t binaryRemaining;
+    std::vector<uint8_t> binaryFrame;
+    std::vector<std::string> outputLines;
+    SimTrace trace;
+    SimSerialListener* outputTap;
+    bool stopRequested;
+    unsigned long loopIterations;
+    unsigned long setupAllocations;
+    uint64_t setupMicros;
+    uint64_t resetMicros;
+    uint64_t recoveredMicros;
+
+    // Host side of the run in progress
+    SimFirmware* firmware;
+    bool running;
+    const std::vector<ScriptCommand>* script;
+    size_t nextCommand;
+    std::vector<uint64_t> typedMicros;
+    SimOperator* simOperator;
+
+    // Type every script command that is due and let the operator act
+    void pollHost();
+
+  public:
+    Simulation(const World& world, const CarModel& model, const SimulationOptions& simOptions);
+
+    // SimSerialListener: prints firmware output stamped with the time it was written. A
+    // "... dump: N bytes follow" line announces a binary frame, which is kept instead.
+    void onSerialOutput(uint64_t nowMicros, const char* data, size_t size) override;
+
+    // SimIdleListener: input keeps arriving while the firmware works or sleeps
+    void onIdleStep(uint64_t nowMicros) override;
+
+    // Run setup() then loop() until the duration elapses, typing the script as its times come up
+    void run(SimFirmware& simFirmware, const std::vector<ScriptCommand>& commands,
+             SimOperator* hostOperator = nullptr);
+
+    // The same run in steps, for a caller that advances many simulations together, possibly
+    // each step on a different thread: begin() powers on and runs setup(), runUntil() runs
+    // loop() iterations until the board reaches untilMicros and returns false once the run is
+    // over, and end() lets go of the script and the operator
+    void begin(SimFirmware& simFirmware, const std::vector<ScriptCommand>& commands,
+               SimOperator* hostOperator = nullptr);
+    bool runUntil(uint64_t untilMicros);
+    void end();
+
+    // Also pass every byte the firmware writes, unparsed, to tap (nullptr: none)
+    void setOutputTap(SimSerialListener* tap) { outputTap = tap; }
+
+    // End the run after the current loop iteration; safe to call from the operator
+    void requestStop() { stopRequested = true; }
+
+    const SimBoard& getBoard() const { return board; }
+    const SimCar& getCar() const { return car; }
+    unsigned long getLoopIterations() const { return loopIterations; }
+    // Virtual time setup() took, from power-on until the first loop()
+    uint64_t getSetupMicros() const { return setupMicros; }
+    // Virtual time of the injected reset, and when setup() after it returned (0: no reset yet)
+    uint64_t getResetMicros() const { return resetMicros; }
+    uint64_t getRecoveredMicros() const { return recoveredMicros; }
+    // Virtual time each script command was actually typed, in script order
+    const std::vector<uint64_t>& getTypedMicros() const { return typedMicros; }
+    // Most recent binary frame the firmware sent (empty if none)
+    const std::vector<uint8_t>& getBinaryFrame() const { return binaryFrame; }
+    // Timeline of the run; empty unless options.traceEvents was set
+    const SimTrace& getTrace() const { return trace; }
+    // Number of recorded output lines that start with prefix
+    unsigned long countOutput(const std::string& prefix) const;
+    // Most recent recorded output line that starts with prefix, or "" if none
+    std::string lastOutput(const std::string& prefix) const;
+    // Heap allocations the firmware made inside loop(), after setup() finished
+    unsigned long getLoopAllocations() const { return board.getHeapStats().allocations - setupAllocations; }
+};
+
+#endif
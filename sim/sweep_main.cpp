@@ -0,0 +1,336 @@
+// Parameter sweep: runs the firmware's sensing and avoidance logic against a
+// simulated course for every combination (or a random sample) of the
+// obstacle and timing constants from config.h, spread over all CPU cores,
+// and prints one CSV row per configuration.
+//
+//   sweep_runner --param obstacle=15:40:5 --param turn=45:105:15 --runs 8 > sweep.csv
+//   sweep_runner --random 200 --param interval=50:400 --param attempts=1:5
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include "../test_bench/include/vehicle_system.h"
+#include "simulation.h"
+#include "work_stealing_pool.h"
+#include "world.h"
+
+// One tunable constant and the range to explore
+struct SweepParameter {
+  const char* name;
+  const char* constant;
+  long minValue;
+  long maxValue;
+  long step;
+};
+
+enum ParameterIndex {
+  PARAM_OBSTACLE,
+  PARAM_INTERVAL,
+  PARAM_ATTEMPTS,
+  PARAM_BACKUP,
+  PARAM_TURN,
+  PARAM_COUNT
+};
+
+static SweepParameter parameters[PARAM_COUNT] = {
+  {"obstacle", "OBSTACLE_DETECTION_DISTANCE", OBSTACLE_DETECTION_DISTANCE, OBSTACLE_DETECTION_DISTANCE, 1},
+  {"interval", "OBSTACLE_CHECK_INTERVAL", OBSTACLE_CHECK_INTERVAL, OBSTACLE_CHECK_INTERVAL, 1},
+  {"attempts", "MAX_READING_ATTEMPTS", MAX_READING_ATTEMPTS, MAX_READING_ATTEMPTS, 1},
+  {"backup", "AVOID_BACKUP_DURATION", AVOID_BACKUP_DURATION, AVOID_BACKUP_DURATION, 1},
+  {"turn", "AVOID_TURN_DEGREES", AVOID_TURN_DEGREES, AVOID_TURN_DEGREES, 1},
+};
+
+// Default course: a room with scattered posts and a goal in the far corner
+static const char* DEFAULT_WORLD =
+  "arena 400 300\n"
+  "post 130 90 12\n"
+  "post 160 210 15\n"
+  "box 230 120 40 40\n"
+  "post 310 60 10\n"
+  "post 330 220 12\n"
+  "start 40 60 20\n"
+  "goal 360 260 35\n";
+
+// Accumulated results for one configuration
+struct ConfigResult {
+  long values[PARAM_COUNT];
+  int runs;
+  int runsWithCollision;
+  int goalsReached;
+  double timeToGoalSum;     // seconds, over runs that reached the goal
+  double pulseInSeconds;
+  double simulatedSeconds;
+};
+
+// Plays the BCI host: keeps asking for "forward" whenever the car has come to rest
+class ForwardOperator : public SimOperator {
+  private:
+    uint64_t startMicros;
+    uint64_t idleSince;
+    bool idle;
+
+  public:
+    explicit ForwardOperator(uint64_t start) : startMicros(start), idleSince(0), idle(false) {}
+
+    void onStep(uint64_t nowMicros, const SimCar& car, SimBoard& board) override {
+      if (nowMicros < startMicros) {
+        return;
+      }
+      if (std::fabs(car.getSpeed()) > 0.5) {
+        idle = false;
+        return;
+      }
+      if (!idle) {
+        idle = true;
+        idleSince = nowMicros;
+      }
+      if (nowMicros - idleSince >= 300000) {
+        board.feedSerial("forward\n");
+        idle = false;
+      }
+    }
+};
+
+class SystemFirmware : public SimFirmware {
+  private:
+    VehicleSystem& system;
+
+  public:
+    explicit SystemFirmware(VehicleSystem& vehicleSystem) : system(vehicleSystem) {}
+    void setup() override { system.setup(); }
+    void loop() override { system.loop(); }
+};
+
+static bool parseParameter(const char* spec) {
+  const char* equals = strchr(spec, '=');
+  if (equals == nullptr) {
+    return false;
+  }
+  std::string name(spec, equals - spec);
+  for (int i = 0; i < PARAM_COUNT; i++) {
+    if (name != parameters[i].name) {
+      continue;
+    }
+    long a = 0, b = 0, c = 1;
+    int fields = sscanf(equals + 1, "%ld:%ld:%ld", &a, &b, &c);
+    if (fields < 1 || c <= 0) {
+      return false;
+    }
+    parameters[i].minValue = a;
+    parameters[i].maxValue = fields >= 2 ? b : a;
+    parameters[i].step = fields >= 3 ? c : 1;
+    return parameters[i].maxValue >= parameters[i].minValue;
+  }
+  return false;
+}
+
+static void printUsage(const char* program) {
+  printf("Usage: %s [options]\n", program);
+  printf("  --param NAME=MIN[:MAX[:STEP]]  Range to sweep; NAME is one of:\n");
+  for (int i = 0; i < PARAM_COUNT; i++) {
+    printf("                                   %-9s %s (default %ld)\n",
+           parameters[i].name, parameters[i].constant, parameters[i].minValue);
+  }
+  printf("  --random N       Sample N random configurations instead of the full grid\n");
+  printf("  --runs N         Runs per configuration with different noise and start heading (default 4)\n");
+  printf("  --duration MS    Virtual time per run (default 60000)\n");
+  printf("  --world FILE     Course to drive (default: built-in room with posts)\n");
+  printf("  --threads N      Worker threads (default: all cores)\n");
+  printf("  --seed N         Seed for random sampling and sensor noise\n");
+  printf("  --out FILE       Write CSV to FILE instead of stdout\n");
+}
+
+static void buildGrid(std::vector<ConfigResult>* configs) {
+  ConfigResult config;
+  memset(&config, 0, sizeof(config));
+  for (int i = 0; i < PARAM_COUNT; i++) {
+    config.values[i] = parameters[i].minValue;
+  }
+
+  for (;;) {
+    configs->push_back(config);
+    // Odometer-style increment over every parameter
+    int i = 0;
+    for (; i < PARAM_COUNT; i++) {
+      config.values[i] += parameters[i].step;
+      if (config.values[i] <= parameters[i].maxValue) {
+        break;
+      }
+      config.values[i] = parameters[i].minValue;
+    }
+    if (i == PARAM_COUNT) {
+      return;
+    }
+  }
+}
+
+static void buildRandom(std::vector<ConfigResult>* configs, int count, unsigned int seed) {
+  std::mt19937 rng(seed);
+  for (int n = 0; n < count; n++) {
+    ConfigResult config;
+    memset(&config, 0, sizeof(config));
+    for (int i = 0; i < PARAM_COUNT; i++) {
+      long steps = (parameters[i].maxValue - parameters[i].minValue) / parameters[i].step;
+      std::uniform_int_distribution<long> pick(0, steps);
+      config.values[i] = parameters[i].minValue + pick(rng) * parameters[i].step;
+    }
+    configs->push_back(config);
+  }
+}
+
+int main(int argc, char** argv) {
+  int randomCount = 0;
+  int runsPerConfig = 4;
+  unsigned long durationMillis = 60000;
+  unsigned int threads = 0;
+  unsigned int seed = 1;
+  std::string worldPath, outPath;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(arg, "--param") == 0 && hasValue) {
+      if (!parseParameter(argv[++i])) {
+        fprintf(stderr, "Bad parameter range '%s'\n", argv[i]);
+        return 2;
+      }
+    } else if (strcmp(arg, "--random") == 0 && hasValue) {
+      randomCount = atoi(argv[++i]);
+    } else if (strcmp(arg, "--runs") == 0 && hasValue) {
+      runsPerConfig = atoi(argv[++i]);
+    } else if (strcmp(arg, "--duration") == 0 && hasValue) {
+      durationMillis = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(arg, "--world") == 0 && hasValue) {
+      worldPath = argv[++i];
+    } else if (strcmp(arg, "--threads") == 0 && hasValue) {
+      threads = static_cast<unsigned int>(atoi(argv[++i]));
+    } else if (strcmp(arg, "--seed") == 0 && hasValue) {
+      seed = static_cast<unsigned int>(strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(arg, "--out") == 0 && hasValue) {
+      outPath = argv[++i];
+    } else {
+      printUsage(argv[0]);
+      return strcmp(arg, "--help") == 0 ? 0 : 2;
+    }
+  }
+  if (runsPerConfig < 1) {
+    runsPerConfig = 1;
+  }
+
+  World world;
+  std::string error;
+  if (worldPath.empty() ? !world.parse(DEFAULT_WORLD, &error) : !world.loadFile(worldPath, &error)) {
+    fprintf(stderr, "World: %s\n", error.c_str());
+    return 2;
+  }
+  if (!world.hasGoal()) {
+    fprintf(stderr, "World has no goal; time-to-goal will be empty\n");
+  }
+
+  std::vector<ConfigResult> configs;
+  if (randomCount > 0) {
+    buildRandom(&configs, randomCount, seed);
+  } else {
+    buildGrid(&configs);
+  }
+
+  FILE* out = stdout;
+  if (!outPath.empty()) {
+    out = fopen(outPath.c_str(), "w");
+    if (out == nullptr) {
+      fprintf(stderr, "Cannot open %s\n", outPath.c_str());
+      return 2;
+    }
+  }
+
+  WorkStealingPool pool(threads);
+  size_t totalRuns = configs.size() * runsPerConfig;
+  std::vector<std::mutex> configLocks(configs.size());
+  std::atomic<size_t> finished(0);
+
+  fprintf(stderr, "Sweeping %zu configurations x %d runs on %u threads\n",
+          configs.size(), runsPerConfig, pool.getThreadCount());
+
+  pool.run(totalRuns, [&](size_t task) {
+    size_t configIndex = task / runsPerConfig;
+    unsigned int run = static_cast<unsigned int>(task % runsPerConfig);
+    const long* values = configs[configIndex].values;
+
+    // Vary the start heading per run so one lucky angle does not decide the result
+    World course = world;
+    std::mt19937 jitterRng(seed * 7919u + run);
+    std::uniform_real_distribution<double> jitter(-20.0, 20.0);
+    course.setStart(world.getStartX(), world.getStartY(), world.getStartHeading() + jitter(jitterRng));
+
+    SimulationOptions options;
+    options.durationMillis = durationMillis;
+    options.seed = seed + run;
+    options.stopAtGoal = true;
+
+    VehicleSystem system;
+    system.getSensorManager().setObstacleDistance(static_cast<int>(values[PARAM_OBSTACLE]));
+    system.getSensorManager().setObstacleCheckInterval(static_cast<unsigned long>(values[PARAM_INTERVAL]));
+    system.getSensorManager().setReadingAttempts(static_cast<int>(values[PARAM_ATTEMPTS]));
+    system.getMovementController().setAvoidanceTimings(static_cast<unsigned long>(values[PARAM_BACKUP]),
+                                                       static_cast<int>(values[PARAM_TURN]));
+
+    SystemFirmware firmware(system);
+    ForwardOperator host(1500000);
+    Simulation simulation(course, CarModel(), options);
+    simulation.run(firmware, std::vector<ScriptCommand>(), &host);
+
+    const SimCar& car = simulation.getCar();
+    {
+      std::lock_guard<std::mutex> guard(configLocks[configIndex]);
+      ConfigResult& result = configs[configIndex];
+      result.runs++;
+      if (car.getCollisions() > 0) {
+        result.runsWithCollision++;
+      }
+      if (car.getGoalReachedAt() >= 0) {
+        result.goalsReached++;
+        result.timeToGoalSum += car.getGoalReachedAt() / 1e6;
+      }
+      result.pulseInSeconds += simulation.getBoard().getStats().pulseInMicros / 1e6;
+      result.simulatedSeconds += simulation.getBoard().now() / 1e6;
+    }
+
+    size_t done = ++finished;
+    if (done % 100 == 0 || done == totalRuns) {
+      fprintf(stderr, "\r%zu/%zu runs", done, totalRuns);
+    }
+  });
+  fprintf(stderr, "\n");
+
+  for (int i = 0; i < PARAM_COUNT; i++) {
+    fprintf(out, "%s,", parameters[i].constant);
+  }
+  fprintf(out, "runs,collision_rate,goal_rate,mean_time_to_goal_s,sensor_duty_pct\n");
+
+  for (size_t c = 0; c < configs.size(); c++) {
+    const ConfigResult& result = configs[c];
+    for (int i = 0; i < PARAM_COUNT; i++) {
+      fprintf(out, "%ld,", result.values[i]);
+    }
+    fprintf(out, "%d,%.3f,%.3f,", result.runs,
+            static_cast<double>(result.runsWithCollision) / result.runs,
+            static_cast<double>(result.goalsReached) / result.runs);
+    if (result.goalsReached > 0) {
+      fprintf(out, "%.2f,", result.timeToGoalSum / result.goalsReached);
+    } else {
+      fprintf(out, ",");
+    }
+    fprintf(out, "%.2f\n", result.simulatedSeconds > 0 ? 100.0 * result.pulseInSeconds / result.simulatedSeconds : 0.0);
+  }
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}
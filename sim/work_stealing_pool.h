@@ -0,0 +1,150 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own queue of task indices.
+// A worker takes from the back of its own queue and, once that is empty,
+// steals from the front of the others, so long simulations on one core do
+// not leave the rest idle. The workers live as long as the pool and wait
+// between batches, so a caller can hand it one batch per time step.
+class WorkStealingPool {
+  private:
+    struct WorkerQueue {
+      std::mutex lock;
+      std::deque<size_t> tasks;
+    };
+
+    unsigned int threadCount;
+    std::vector<WorkerQueue> queues;
+    std::vector<std::thread> workers;
+
+    // Batch hand-over: run() publishes a batch and waits for remaining to reach 0
+    std::mutex lock;
+    std::condition_variable batchReady;
+    std::condition_variable batchDone;
+    const std::function<void(size_t)>* task;
+    uint64_t batch;
+    size_t remaining;
+    bool stopping;
+
+    static bool popOwn(WorkerQueue& queue, size_t* task) {
+      std::lock_guard<std::mutex> guard(queue.lock);
+      if (queue.tasks.empty()) {
+        return false;
+      }
+      *task = queue.tasks.back();
+      queue.tasks.pop_back();
+      return true;
+    }
+
+    static bool steal(WorkerQueue& queue, size_t* task) {
+      std::lock_guard<std::mutex> guard(queue.lock);
+      if (queue.tasks.empty()) {
+        return false;
+      }
+      *task = queue.tasks.front();
+      queue.tasks.pop_front();
+      return true;
+    }
+
+    bool next(unsigned int id, size_t* index) {
+      if (popOwn(queues[id], index)) {
+        return true;
+      }
+      for (unsigned int offset = 1; offset < threadCount; offset++) {
+        if (steal(queues[(id + offset) % threadCount], index)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void work(unsigned int id) {
+      uint64_t seen = 0;
+      for (;;) {
+        {
+          std::unique_lock<std::mutex> guard(lock);
+          batchReady.wait(guard, [this, seen]() { return stopping || batch != seen; });
+          if (stopping) {
+            return;
+          }
+          seen = batch;
+        }
+
+        // Every queue empty means the batch is handed out; the last one to finish reports it.
+        // An index may already belong to the next batch, so the task is looked up for each one.
+        size_t index;
+        while (next(id, &index)) {
+          const std::function<void(size_t)>* current;
+          {
+            std::lock_guard<std::mutex> guard(lock);
+            current = task;
+          }
+          (*current)(index);
+          std::lock_guard<std::mutex> guard(lock);
+          if (--remaining == 0) {
+            batchDone.notify_all();
+          }
+        }
+      }
+    }
+
+  public:
+    explicit WorkStealingPool(unsigned int threads = 0)
+        : task(nullptr), batch(0), remaining(0), stopping(false) {
+      threadCount = threads > 0 ? threads : std::thread::hardware_concurrency();
+      if (threadCount == 0) {
+        threadCount = 1;
+      }
+      queues = std::vector<WorkerQueue>(threadCount);
+      for (unsigned int id = 0; id < threadCount; id++) {
+        workers.push_back(std::thread([this, id]() { work(id); }));
+      }
+    }
+
+    ~WorkStealingPool() {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+      }
+      batchReady.notify_all();
+      for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+      }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    unsigned int getThreadCount() const { return threadCount; }
+
+    // Run task(i) for every i in [0, count) and return once all have finished
+    void run(size_t count, const std::function<void(size_t)>& batchTask) {
+      if (count == 0) {
+        return;
+      }
+      std::unique_lock<std::mutex> guard(lock);
+      task = &batchTask;
+      remaining = count;
+
+      // Contiguous slices keep neighbouring grid points, or the same vehicles, on the same worker
+      for (size_t i = 0; i < count; i++) {
+        WorkerQueue& queue = queues[i * threadCount / count];
+        std::lock_guard<std::mutex> queueGuard(queue.lock);
+        queue.tasks.push_back(i);
+      }
+      batch++;
+      batchReady.notify_all();
+      batchDone.wait(guard, [this]() { return remaining == 0; });
+    }
+};
+
+#endif
@@ -0,0 +1,385 @@
+#include "world.h"
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include "../test_bench/src/lib/vehicle/vehicle.h"
+
+static const double PI = 3.14159265358979323846;
+static const double SOUND_CM_PER_US = 0.0343;  // Same constant the ultrasonic driver uses
+static const double MAX_STEP_SECONDS = 0.001;  // Integration step
+static const int BEAM_RAYS = 7;
+
+static double toRadians(double degrees) {
+  return degrees * PI / 180.0;
+}
+
+static double pointSegmentDistance(double px, double py, const World::Wall& w) {
+  double dx = w.x2 - w.x1;
+  double dy = w.y2 - w.y1;
+  double lengthSq = dx * dx + dy * dy;
+  double t = lengthSq > 0 ? ((px - w.x1) * dx + (py - w.y1) * dy) / lengthSq : 0;
+  if (t < 0) t = 0;
+  if (t > 1) t = 1;
+  double cx = w.x1 + t * dx - px;
+  double cy = w.y1 + t * dy - py;
+  return std::sqrt(cx * cx + cy * cy);
+}
+
+World::World() {
+  startX = 0;
+  startY = 0;
+  startHeading = 0;
+  goalSet = false;
+  goalX = goalY = goalRadius = 0;
+}
+
+bool World::loadFile(const std::string& path, std::string* error) {
+  std::ifstream in(path.c_str());
+  if (!in) {
+    if (error) *error = "cannot open " + path;
+    return false;
+  }
+  std::stringstream text;
+  text << in.rdbuf();
+  return parse(text.str(), error);
+}
+
+bool World::parse(const std::string& text, std::string* error) {
+  std::istringstream lines(text);
+  std::string line;
+  int lineNumber = 0;
+
+  while (std::getline(lines, line)) {
+    lineNumber++;
+    std::string::size_type hash = line.find('#');
+    if (hash != std::string::npos) {
+      line = line.substr(0, hash);
+    }
+
+    std::istringstream fields(line);
+    std::string keyword;
+    if (!(fields >> keyword)) {
+      continue;
+    }
+
+    double a, b, c, d;
+    bool ok = true;
+    if (keyword == "wall") {
+      ok = static_cast<bool>(fields >> a >> b >> c >> d);
+      if (ok) addWall(a, b, c, d);
+    } else if (keyword == "box") {
+      ok = static_cast<bool>(fields >> a >> b >> c >> d);
+      if (ok) addBox(a, b, c, d);
+    } else if (keyword == "arena") {
+      // Closed rectangle from the origin
+      ok = static_cast<bool>(fields >> a >> b);
+      if (ok) addBox(0, 0, a, b);
+    } else if (keyword == "post") {
+      ok = static_cast<bool>(fields >> a >> b >> c);
+      if (ok) addPost(a, b, c);
+    } else if (keyword == "start") {
+      ok = static_cast<bool>(fields >> a >> b >> c);
+      if (ok) setStart(a, b, c);
+    } else if (keyword == "goal") {
+      ok = static_cast<bool>(fields >> a >> b >> c);
+      if (ok) setGoal(a, b, c);
+    } else {
+      ok = false;
+    }
+
+    if (!ok) {
+      if (error) *error = "line " + std::to_string(lineNumber) + ": cannot parse '" + line + "'";
+      return false;
+    }
+  }
+  return true;
+}
+
+void World::addWall(double x1, double y1, double x2, double y2) {
+  Wall wall = {x1, y1, x2, y2};
+  walls.push_back(wall);
+}
+
+void World::addBox(double x, double y, double w, double h) {
+  addWall(x, y, x + w, y);
+  addWall(x + w, y, x + w, y + h);
+  addWall(x + w, y + h, x, y + h);
+  addWall(x, y + h, x, y);
+}
+
+void World::addPost(double x, double y, double r) {
+  Post post = {x, y, r};
+  posts.push_back(post);
+}
+
+void World::setStart(double x, double y, double headingDeg) {
+  startX = x;
+  startY = y;
+  startHeading = headingDeg;
+}
+
+void World::setGoal(double x, double y, double r) {
+  goalSet = true;
+  goalX = x;
+  goalY = y;
+  goalRadius = r;
+}
+
+double World::rayCast(double x, double y, double headingRad, double maxRange) const {
+  double dx = std::cos(headingRad);
+  double dy = std::sin(headingRad);
+  double best = maxRange;
+
+  for (size_t i = 0; i < walls.size(); i++) {
+    const Wall& w = walls[i];
+    double ex = w.x2 - w.x1;
+    double ey = w.y2 - w.y1;
+    double denom = dx * ey - dy * ex;
+    if (std::fabs(denom) < 1e-12) {
+      continue;  // Parallel
+    }
+    double qx = w.x1 - x;
+    double qy = w.y1 - y;
+    double t = (qx * ey - qy * ex) / denom;
+    double u = (qx * dy - qy * dx) / denom;
+    if (t >= 0 && u >= 0 && u <= 1 && t < best) {
+      best = t;
+    }
+  }
+
+  for (size_t i = 0; i < posts.size(); i++) {
+    const Post& p = posts[i];
+    double fx = x - p.x;
+    double fy = y - p.y;
+    double b = fx * dx + fy * dy;
+    double c = fx * fx + fy * fy - p.r * p.r;
+    double disc = b * b - c;
+    if (disc < 0) {
+      continue;
+    }
+    double t = -b - std::sqrt(disc);
+    if (t >= 0 && t < best) {
+      best = t;
+    }
+  }
+
+  return best;
+}
+
+double World::clearance(double x, double y) const {
+  double best = 1e9;
+  for (size_t i = 0; i < walls.size(); i++) {
+    double d = pointSegmentDistance(x, y, walls[i]);
+    if (d < best) best = d;
+  }
+  for (size_t i = 0; i < posts.size(); i++) {
+    double d = std::hypot(x - posts[i].x, y - posts[i].y) - posts[i].r;
+    if (d < best) best = d;
+  }
+  return best;
+}
+
+bool World::inGoal(double x, double y) const {
+  return goalSet && std::hypot(x - goalX, y - goalY) <= goalRadius;
+}
+
+CarModel::CarModel() {
+  trackWidth = 14.0;
+  maxWheelSpeed = 37.7;
+  deadbandPwm = 30;
+  turnEfficiency = 0.35;
+  scrubPwm = 0;
+  motorTimeConstant = 0.03;
+  radius = 10.0;
+  sensorOffset = 8.0;
+  beamHalfAngle = 15.0;
+  maxEchoRange = 400.0;
+  noiseStdDev = 0.3;
+  dropoutRate = 0.0;
+  sensorConnected = true;
+  unplugFromMillis = 0;
+  unplugUntilMillis = 0;
+}
+
+SimCar::SimCar(const World& map, const CarModel& carModel, unsigned int seed)
+    : world(map), model(carModel), rng(seed) {
+  lastMicros = 0;
+  x = world.getStartX();
+  y = world.getStartY();
+  heading = toRadians(world.getStartHeading());
+  totalRotation = 0;
+  leftSpeed = rightSpeed = 0;
+  leftTarget = rightTarget = 0;
+  inCollision = false;
+  collisions = 0;
+  minClearance = world.clearance(x, y) - model.radius;
+  distanceTravelled = 0;
+  goalReachedAt = -1;
+  recordEvents = false;
+  lastPingAt = 0;
+}
+
+double SimCar::wheelSpeedForPwm(int pwm) const {
+  if (pwm <= model.deadbandPwm) {
+    return 0;
+  }
+  return model.maxWheelSpeed * (pwm - model.deadbandPwm) / (255.0 - model.deadbandPwm);
+}
+
+void SimCar::step(double dt) {
+  // First-order motor response towards the commanded wheel speeds
+  double blend = model.motorTimeConstant > 0 ? 1.0 - std::exp(-dt / model.motorTimeConstant) : 1.0;
+  leftSpeed += (leftTarget - leftSpeed) * blend;
+  rightSpeed += (rightTarget - rightSpeed) * blend;
+
+  double linear = (leftSpeed + rightSpeed) / 2.0;
+  double angular = (rightSpeed - leftSpeed) / model.trackWidth * model.turnEfficiency;
+
+  heading += angular * dt;
+  totalRotation += angular * dt;
+
+  double nx = x + linear * std::cos(heading) * dt;
+  double ny = y + linear * std::sin(heading) * dt;
+  double clearance = world.clearance(nx, ny) - model.radius;
+
+  if (clearance <= 0) {
+    // Blocked: the chassis stays in contact and the wheels slip
+    if (!inCollision) {
+      collisions++;
+      inCollision = true;
+    }
+  } else {
+    distanceTravelled += std::hypot(nx - x, ny - y);
+    x = nx;
+    y = ny;
+    inCollision = false;
+    if (clearance < minClearance) {
+      minClearance = clearance;
+    }
+  }
+}
+
+void SimCar::advanceTo(uint64_t nowMicros) {
+  while (lastMicros < nowMicros) {
+    uint64_t stepMicros = nowMicros - lastMicros;
+    if (stepMicros > static_cast<uint64_t>(MAX_STEP_SECONDS * 1e6)) {
+      stepMicros = static_cast<uint64_t>(MAX_STEP_SECONDS * 1e6);
+    }
+    step(stepMicros / 1e6);
+    lastMicros += stepMicros;
+
+    if (goalReachedAt < 0 && world.inGoal(x, y)) {
+      goalReachedAt = static_cast<int64_t>(lastMicros);
+    }
+  }
+}
+
+void SimCar::setMotorOutputs(uint64_t nowMicros, uint8_t direction, bool enabled,
+                             int pwmLeft, int pwmRight) {
+  advanceTo(nowMicros);
+
+  // Each side gets the mean drive of its two motors (M1/M2 left, M3/M4 right)
+  int m1 = (direction & M1_Forward) ? 1 : ((direction & M1_Backward) ? -1 : 0);
+  int m2 = (direction & M2_Forward) ? 1 : ((direction & M2_Backward) ? -1 : 0);
+  int m3 = (direction & M3_Forward) ? 1 : ((direction & M3_Backward) ? -1 : 0);
+  int m4 = (direction & M4_Forward) ? 1 : ((direction & M4_Backward) ? -1 : 0);
+
+  if (enabled) {
+    // Turning in place drags the tyres sideways, which a rough floor resists
+    int scrub = (m1 + m2) * (m3 + m4) < 0 ? model.scrubPwm : 0;
+    leftTarget = (m1 + m2) / 2.0 * wheelSpeedForPwm(pwmLeft - scrub);
+    rightTarget = (m3 + m4) / 2.0 * wheelSpeedForPwm(pwmRight - scrub);
+  } else {
+    leftTarget = rightTarget = 0;
+  }
+
+  if (recordEvents) {
+    // vehicle::Move() writes PWM and direction separately; fold writes at the same instant
+    if (!events.empty() && events.back().atMicros == nowMicros) {
+      events.pop_back();
+    }
+    MotorEvent event = {nowMicros, direction, enabled, pwmLeft, pwmRight,
+                         getClockwiseRotation(), distanceTravelled, lastPingAt};
+    if (events.empty() || events.back().direction != direction || events.back().enabled != enabled ||
+        events.back().pwmLeft != pwmLeft || events.back().pwmRight != pwmRight) {
+      events.push_back(event);
+    }
+  }
+}
+
+unsigned long SimCar::echoMicros(uint64_t nowMicros) {
+  advanceTo(nowMicros);
+  lastPingAt = nowMicros;
+
+  uint64_t nowMillis = nowMicros / 1000;
+  if (!model.sensorConnected || (nowMillis >= model.unplugFromMillis && nowMillis < model.unplugUntilMillis)) {
+    return 0;
+  }
+
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  if (model.dropoutRate > 0 && uniform(rng) < model.dropoutRate) {
+    return 0;
+  }
+
+  // The nearest surface anywhere inside the cone answers first
+  double sx = x + model.sensorOffset * std::cos(heading);
+  double sy = y + model.sensorOffset * std::sin(heading);
+  double nearest = model.maxEchoRange + 1;
+  for (int i = 0; i < BEAM_RAYS; i++) {
+    double offset = -model.beamHalfAngle + 2.0 * model.beamHalfAngle * i / (BEAM_RAYS - 1);
+    double d = world.rayCast(sx, sy, heading + toRadians(offset), model.maxEchoRange + 1);
+    if (d < nearest) nearest = d;
+  }
+
+  if (nearest > model.maxEchoRange) {
+    return 0;
+  }
+
+  if (model.noiseStdDev > 0) {
+    std::normal_distribution<double> noise(0.0, model.noiseStdDev);
+    nearest += noise(rng);
+  }
+  if (nearest < 0.5) {
+    nearest = 0.5;
+  }
+
+  return static_cast<unsigned long>(nearest * 2.0 / SOUND_CM_PER_US);
+}
+
+void SimCar::setRecordEvents(bool record) {
+  recordEvents = record;
+}
+
+const std::vector<SimCar::MotorEvent>& SimCar::getEvents() const {
+  return events;
+}
+
+double SimCar::getHeadingDegrees() const {
+  double degrees = std::fmod(heading * 180.0 / PI, 360.0);
+  return degrees < 0 ? degrees + 360.0 : degrees;
+}
+
+double SimCar::getClockwiseRotation() const {
+  return -totalRotation * 180.0 / PI;
+}
+
+double SimCar::getSpeed() const {
+  return (leftSpeed + rightSpeed) / 2.0;
+}
+
+const char* directionName(uint8_t direction) {
+  switch (direction) {
+    case Stop:         return "Stop";
+    case Forward:      return "Forward";
+    case Backward:     return "Backward";
+    case Clockwise:    return "Clockwise";
+    case Contrarotate: return "Contrarotate";
+    case Move_Left:    return "Move_Left";
+    case Move_Right:   return "Move_Right";
+    case Top_Left:     return "Top_Left";
+    case Top_Right:    return "Top_Right";
+    case Bottom_Left:  return "Bottom_Left";
+    case Bottom_Right: return "Bottom_Right";
+    default:           return "Custom";
+  }
+}
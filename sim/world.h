@@ -0,0 +1,141 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include <random>
+#include <string>
+#include <vector>
+#include "hal/sim_board.h"
+
+// 2D obstacle map. Units are centimetres; headings are degrees,
+// counter-clockwise from the +x axis.
+class World {
+  public:
+    struct Wall { double x1, y1, x2, y2; };
+    struct Post { double x, y, r; };
+
+  private:
+    std::vector<Wall> walls;
+    std::vector<Post> posts;
+    double startX, startY, startHeading;
+    bool goalSet;
+    double goalX, goalY, goalRadius;
+
+  public:
+    World();
+
+    // Load a map from a file or from text; returns false and fills error on bad input
+    bool loadFile(const std::string& path, std::string* error);
+    bool parse(const std::string& text, std::string* error);
+
+    // Map building
+    void addWall(double x1, double y1, double x2, double y2);
+    void addBox(double x, double y, double w, double h);
+    void addPost(double x, double y, double r);
+    void setStart(double x, double y, double headingDeg);
+    void setGoal(double x, double y, double r);
+
+    // Distance along a ray to the first obstacle, or maxRange if none
+    double rayCast(double x, double y, double headingRad, double maxRange) const;
+
+    // Distance from a point to the nearest obstacle surface
+    double clearance(double x, double y) const;
+
+    double getStartX() const { return startX; }
+    double getStartY() const { return startY; }
+    double getStartHeading() const { return startHeading; }
+    bool hasGoal() const { return goalSet; }
+    bool inGoal(double x, double y) const;
+};
+
+// Physical parameters of the car. The defaults put an in-place turn at
+// TURN_SPEED (180) at about 72 deg/s once the motors have spun up, which
+// is what the firmware's default turn table assumes at every level.
+struct CarModel {
+  double trackWidth;        // Distance between left and right wheels (cm)
+  double maxWheelSpeed;     // Wheel surface speed at PWM 255 (cm/s)
+  int deadbandPwm;          // PWM below which the motors do not turn
+  double turnEfficiency;    // Fraction of wheel speed that survives skid steering
+  int scrubPwm;             // Extra PWM lost to tyre scrub while the sides drive against each other
+  double motorTimeConstant; // First-order motor spin-up/down constant (s)
+  double radius;            // Collision radius of the chassis (cm)
+  double sensorOffset;      // Ultrasonic sensor distance ahead of centre (cm)
+  double beamHalfAngle;     // Half-width of the ultrasonic cone (deg)
+  double maxEchoRange;      // Range beyond which no echo returns (cm)
+  double noiseStdDev;       // Gaussian range noise (cm)
+  double dropoutRate;       // Probability that a ping gets no echo
+  bool sensorConnected;     // False simulates an unplugged HC-SR04
+  unsigned long unplugFromMillis;  // The sensor is also disconnected from this time...
+  unsigned long unplugUntilMillis; // ...until this one (equal: never)
+
+  CarModel();
+};
+
+// Differential-drive car wired to the simulated board: decodes the motor
+// shift-register byte and PWM duty into wheel speeds, integrates the pose,
+// and answers ultrasonic pings from the world map.
+class SimCar : public SimPlant {
+  public:
+    struct MotorEvent {
+      uint64_t atMicros;
+      uint8_t direction;
+      bool enabled;
+      int pwmLeft;
+      int pwmRight;
+      double clockwiseRotation;  // Total clockwise rotation when the event happened (deg)
+      double distanceTravelled;  // Odometer reading when the event happened (cm)
+      uint64_t lastPingAt;       // Most recent ultrasonic trigger before the event (0: none yet)
+    };
+
+  private:
+    const World& world;
+    CarModel model;
+    std::mt19937 rng;
+
+    uint64_t lastMicros;
+    double x, y, heading;        // heading in radians
+    double totalRotation;        // unwrapped heading change (radians, CCW positive)
+    double leftSpeed, rightSpeed;    // actual wheel speeds (cm/s)
+    double leftTarget, rightTarget;  // commanded wheel speeds (cm/s)
+
+    bool inCollision;
+    unsigned long collisions;
+    double minClearance;
+    double distanceTravelled;
+    int64_t goalReachedAt;
+
+    bool recordEvents;
+    std::vector<MotorEvent> events;
+    uint64_t lastPingAt;
+
+    double wheelSpeedForPwm(int pwm) const;
+    void step(double dt);
+
+  public:
+    SimCar(const World& map, const CarModel& carModel, unsigned int seed);
+
+    // SimPlant interface
+    void advanceTo(uint64_t nowMicros) override;
+    void setMotorOutputs(uint64_t nowMicros, uint8_t direction, bool enabled,
+                         int pwmLeft, int pwmRight) override;
+    unsigned long echoMicros(uint64_t nowMicros) override;
+
+    void setRecordEvents(bool record);
+    const std::vector<MotorEvent>& getEvents() const;
+
+    double getX() const { return x; }
+    double getY() const { return y; }
+    double getHeadingDegrees() const;
+    // Total clockwise rotation since start (degrees), matching the firmware's sign for turns
+    double getClockwiseRotation() const;
+    double getSpeed() const;
+    unsigned long getCollisions() const { return collisions; }
+    double getMinClearance() const { return minClearance; }
+    double getDistanceTravelled() const { return distanceTravelled; }
+    // Virtual time the goal was first reached, or -1
+    int64_t getGoalReachedAt() const { return goalReachedAt; }
+};
+
+// Human-readable name of a vehicle::Move() direction byte
+const char* directionName(uint8_t direction);
+
+#endif
@@ -4,52 +4,169 @@
 #include "config.h"
 #include "movement_controller.h"
 #include "sensor_manager.h"
-#include "bt_manager.h"
+#include "loop_watchdog.h"
+#include "scan_capture.h"
+#include "intent_filter.h"
+#include "idle_scheduler.h"
+#include "serial_receiver.h"
+#include "sweep_mapper.h"
+#include "mission_vm.h"
+#include "speed_governor.h"
+#include "state_checkpoint.h"
+#include "turn_calibrator.h"
 
 class CommandProcessor {
   private:
     MovementController* movementCtrl;
     SensorManager* sensorMgr;
-    BtManager* btMgr;
-    
-    // Command type enumeration for more efficient parsing
-    enum CommandType {
-      CMD_UNKNOWN,
-      CMD_FORWARD,
-      CMD_BACKWARD,
-      CMD_STOP,
-      CMD_TURN,
-      CMD_SPEED,
-      CMD_DISTANCE,
-      CMD_AVOID,
-      CMD_DEBUG,
-      CMD_HELP,
-      CMD_PING,
-      CMD_STATUS
+    LoopWatchdog* watchdog;
+    ScanCapture* scanCapture;
+    IntentFilter* intentFilter;
+    IdleScheduler* idleScheduler;
+    SweepMapper* sweepMapper;
+    MissionVm* missionVm;
+    SerialReceiver* serialReceiver;
+    SpeedGovernor* speedGovernor;
+    StateCheckpoint* stateCheckpoint;
+    TurnCalibrator* turnCalibrator;
+    
+    // How the words after a command name are interpreted
+    enum ArgKind {
+      ARGS_NONE,      // No arguments
+      ARGS_INT,       // minArgs..maxArgs integers; the trailing ones are optional
+      ARGS_INT_TAIL,  // minArgs..maxArgs integers; the leading ones are optional
+      ARGS_INT_TOKEN, // As ARGS_INT, but the last of maxArgs is any word, kept only as text
+      ARGS_FLAG       // Exactly one of "on" or "off"
+    };
+    
+    // Inclusive bounds of one integer argument
+    struct ArgRange {
+      int min;
+      int max;
     };
     
-    // Structure to hold parsed command data
-    struct ParsedCommand {
-      CommandType type;
-      int param1;
-      int param2;
-      bool flagValue;
+    // Arguments validated against a command's schema
+    struct CommandArgs {
+      int count;
+      int values[MAX_COMMAND_ARGS];
+      const char* words[MAX_COMMAND_ARGS]; // Each argument as typed, lowercased
+      bool flag;
     };
     
-    // Parse a command string into a more usable structure
-    ParsedCommand parseCommand(const String& cmd);
+    typedef void (CommandProcessor::*CommandHandler)(const CommandArgs& args);
+    
+    // One entry of the command table; every string lives in flash
+    struct CommandSpec {
+      const char* name;        // Lowercase command name
+      const char* alias;       // Lowercase shorthand, or nullptr
+      ArgKind kind;
+      int minArgs;
+      int maxArgs;
+      ArgRange ranges[MAX_COMMAND_ARGS]; // Bounds of each argument of the longest form
+      bool echo;               // Print "Command received" first; off for latency probes
+      const char* section;     // Help heading, printed when it changes
+      const char* usage;       // Argument synopsis shown in help, or ""
+      const char* description;
+      CommandHandler handler;
+    };
+    
+    // The command table: parser, validation, dispatch and help are all driven from it
+    static const CommandSpec commandTable[];
+    static const int commandCount;
+    
+    // Command line being assembled from serial input
+    char inputBuffer[MAX_COMMAND_LENGTH + 1];
+    int inputLength;
+    
+    // Set when the line being assembled overran the buffer; the whole line is dropped at its end
+    bool discardingLine;
+    unsigned long overlongLines;
+    
+    // Sequence numbers of the most recent '#<seq>' commands run, a ring of CHECKPOINT_SEQUENCES
+    uint16_t recentSequences[CHECKPOINT_SEQUENCES];
+    int sequenceHead;
+    int sequenceCount;
+    unsigned long sequencedCommands;
+    unsigned long duplicateCommands;
+    
+    // micros() stamps for the command being run, reported by a timestamped ping
+    unsigned long lineArrivalMicros;     // First byte of the line being assembled came off the UART
+    unsigned long commandArrivalMicros;  // First byte of the running command came off the UART
+    unsigned long parseDoneMicros;       // Its arguments were validated
+    
+    // Find the table entry whose name or alias matches, or nullptr
+    static const CommandSpec* findCommand(const char* name);
+    
+    // Check the argument words against the command's schema, count and bounds included,
+    // reporting usage on failure
+    bool parseArgs(const CommandSpec* spec, char* params, CommandArgs* args);
+    
+    // Report the expected syntax of a command
+    void printUsage(const CommandSpec* spec);
+    
+    // Command handlers
+    void handleHelp(const CommandArgs& args);
+    void handleForward(const CommandArgs& args);
+    void handleBackward(const CommandArgs& args);
+    void handleStop(const CommandArgs& args);
+    void handleEstop(const CommandArgs& args);
+    void handleTurn(const CommandArgs& args);
+    void handleDrive(const CommandArgs& args);
+    void handleSpeed(const CommandArgs& args);
+    void handleDistance(const CommandArgs& args);
+    void handleAvoid(const CommandArgs& args);
+    void handleGovern(const CommandArgs& args);
+    void handlePing(const CommandArgs& args);
+    void handleFlow(const CommandArgs& args);
+    void handleStatus(const CommandArgs& args);
+    void handleIntent(const CommandArgs& args);
+#if FEATURE_DIAGNOSTICS
+    void handleDebug(const CommandArgs& args);
+    void handleMem(const CommandArgs& args);
+    void handleStalls(const CommandArgs& args);
+    void handleGrid(const CommandArgs& args);
+#endif
+#if FEATURE_CALIBRATION
+    void handleCalibrate(const CommandArgs& args);
+#endif
+#if FEATURE_SCAN
+    void handleScan(const CommandArgs& args);
+#endif
+#if FEATURE_MISSIONS
+    void handleMission(const CommandArgs& args);
+    void handleRun(const CommandArgs& args);
+#endif
+    
+    // Run a "#<seq> <command>" line unless seq is among the recent ones, then acknowledge it
+    void handleSequencedLine(char* line);
+    
+    // Parse a "<linear> <turn>" setpoint frame (after the '>') and hand it to the movement controller
+    void handleSetpointFrame(const char* frame);
     
   public:
-    CommandProcessor(MovementController* moveCtrl, SensorManager* sensMgr, BtManager* bluetoothMgr);
+    CommandProcessor(MovementController* moveCtrl, SensorManager* sensMgr,
+                     LoopWatchdog* loopWatchdog, ScanCapture* scan, IntentFilter* intent, IdleScheduler* idle,
+                     SweepMapper* mapper, MissionVm* mission, SerialReceiver* receiver,
+                     SpeedGovernor* governor, StateCheckpoint* checkpoint,
+                     TurnCalibrator* calibrator);
     
-    // Process a command string
-    void processCommand(const String& command);
+    // Process a command string whose first byte arrived at arrivalMicros; false if it was empty,
+    // unknown or had arguments its schema rejects, so nothing ran
+    bool processCommand(const char* command, unsigned long arrivalMicros = micros());
     
     // Print help information
     void printHelpInfo();
     
-    // Process serial input
-    void processSerialInput(String& inputBuffer);
+    // Copy the recent command sequence numbers, oldest first, into sequences (room for
+    // CHECKPOINT_SEQUENCES); returns how many there are
+    int getRecentSequences(uint16_t* sequences) const;
+    
+    // Seed the recent sequence numbers, oldest first, e.g. from a checkpoint after a reset
+    void restoreSequences(const uint16_t* sequences, int count);
+    
+    // Process serial input, running each complete line as a command, intent or setpoint frame,
+    // or mission upload chunk
+    void processSerialInput();
 };
 
 #endif // COMMAND_PROCESSOR_H
\ No newline at end of file
@@ -3,6 +3,38 @@
 
 #include <Arduino.h>
 
+// Build profiles. Pass -DBUILD_PROFILE=PROFILE_MINIMAL (or PROFILE_BENCH) to compile
+// subsystems the vehicle will not use out of the image; the default is everything.
+#define PROFILE_MINIMAL 1  // BCI runtime: motion, avoidance, mapping, intent and setpoint streams
+#define PROFILE_BENCH 2    // Minimal plus bench tools: help text, sensor debug, scan, grid, turn calibration, stalls, mem
+#define PROFILE_FULL 3     // Bench plus uploaded missions
+#ifndef BUILD_PROFILE
+#define BUILD_PROFILE PROFILE_FULL
+#endif
+
+// What the profile keeps, as 0 or 1 so each works in #if and as a constant condition
+#define FEATURE_HELP_TEXT (BUILD_PROFILE >= PROFILE_BENCH)   // Command descriptions and the command list at boot
+#define FEATURE_DIAGNOSTICS (BUILD_PROFILE >= PROFILE_BENCH) // Sensor debug output; debug, grid, stalls and mem commands
+#define FEATURE_SCAN (BUILD_PROFILE >= PROFILE_BENCH)        // Raw echo capture (its buffer is 24 KB of RAM)
+#define FEATURE_CALIBRATION (BUILD_PROFILE >= PROFILE_BENCH) // Turn-rate calibration against a wall
+#define FEATURE_MISSIONS (BUILD_PROFILE >= PROFILE_FULL)     // Mission upload and VM
+#ifndef FEATURE_BLUETOOTH
+#define FEATURE_BLUETOOTH 0  // BtManager; nothing drives it yet, so no profile links the Bluetooth stack
+#endif
+
+#if BUILD_PROFILE == PROFILE_MINIMAL
+#define BUILD_PROFILE_NAME "minimal"
+#define BOOT_SERIAL_DELAY_MS 0     // The BCI host pings before sending, so nothing waits for the banner
+#elif BUILD_PROFILE == PROFILE_BENCH
+#define BUILD_PROFILE_NAME "bench"
+#define BOOT_SERIAL_DELAY_MS 1000  // Give a terminal time to open the port and see the banner
+#elif BUILD_PROFILE == PROFILE_FULL
+#define BUILD_PROFILE_NAME "full"
+#define BOOT_SERIAL_DELAY_MS 1000
+#else
+#error "BUILD_PROFILE must be PROFILE_MINIMAL, PROFILE_BENCH or PROFILE_FULL"
+#endif
+
 // LED pin definitions
 #define LEFT_LED 12  // Left LED for movement and hazard indication
 #define RIGHT_LED 2  // Right LED for connection status
@@ -14,12 +46,27 @@
 #define FAST_BLINK_INTERVAL 150        // Fast blink for turning
 #define OBSTACLE_BLINK_INTERVAL 100    // Very fast blink for obstacle detection
 #define OBSTACLE_CHECK_INTERVAL 200    // Check for obstacles every 200ms
+#define OBSTACLE_MAX_CHECK_INTERVAL 1000 // Longest gap between checks with clear space ahead
+#define RANGE_GATE_CM 100              // Within this, checks use one ping that only waits for near echoes
+#define NEAR_CHECK_INTERVAL 50         // Check interval while something is within RANGE_GATE_CM
 #define MIN_VALID_DISTANCE 2           // Ignore readings below this value (cm)
 #define MAX_VALID_DISTANCE 400         // Maximum valid reading distance (cm)
 #define MAX_READING_ATTEMPTS 3         // Number of attempts to get valid reading
+#define READING_ATTEMPTS_LIMIT 9       // Upper bound for a runtime-tuned attempt count
 #define FALLBACK_DISTANCE 1000         // Default distance when readings fail
 #define OBSTACLE_DETECTION_DISTANCE 25 // Distance at which to detect obstacles (cm)
 
+// Command input
+#define MAX_COMMAND_LENGTH 64  // Longest command line kept in the input buffer
+#define MAX_COMMAND_ARGS 2     // Most numeric arguments any command accepts
+#define SERIAL_RX_QUEUE 256    // Bytes the receive callback holds for the loop (power of two)
+#define SERIAL_RX_STAMPS 16    // Receive-callback arrival stamps held for the loop (power of two)
+#define FLOW_CREDIT_BATCH 64   // With flow control on, bytes read before their credit goes back to the host
+
+// Emergency stop: this byte is acted on in the UART receive callback, never queued as input.
+// It cuts the motor outputs there and latches them off until "estop off" acknowledges it.
+#define ESTOP_BYTE 0x03        // Ctrl-C in a terminal
+
 // Ultrasonic sensor pins
 #define ULTRASONIC_TRIG_PIN 13
 #define ULTRASONIC_ECHO_PIN 14
@@ -30,6 +77,99 @@
 #define MAX_SPEED 255      // Maximum allowed speed (PWM max)
 #define TURN_SPEED 180
 
+// Motion model, measured on the bench; used to time turns and dead-reckon the pose. The turn
+// rate between table levels is interpolated, and 'calibrate' measures the table on the floor
+// the car is on; paste the line it prints here to keep the result.
+#define TURN_TABLE_SIZE 5
+#define TURN_TABLE_PWM 100, 140, 180, 220, 255           // PWM levels, ascending
+#define TURN_TABLE_MS_PER_90 2679, 1705, 1250, 987, 833  // Time to rotate 90 degrees in place at each level
+#define DRIVE_TOP_SPEED_CM_S 37    // Straight-line speed at PWM 255
+#define MOTOR_DEADBAND_PWM 30      // PWM below which the motors do not turn
+
+// Avoidance maneuver
+#define AVOID_BACKUP_SPEED 150     // Speed while backing away from an obstacle
+#define AVOID_BACKUP_DURATION 500  // How long to back up (ms)
+#define AVOID_TURN_SPEED 180       // Speed while turning away
+#define AVOID_TURN_DEGREES 72      // How far to turn left when nothing has been mapped
+
+// Speed governor ("govern on"): forward PWM is capped by the distance ahead and the closing
+// speed, and the avoidance maneuver only starts once a reading breaches the hard floor
+#define GOVERNOR_SLOW_CM 90        // The cap starts falling inside this distance
+#define GOVERNOR_FLOOR_CM 15       // Hard floor; replaces OBSTACLE_DETECTION_DISTANCE while governing
+#define GOVERNOR_MIN_PWM 60        // Creep speed at the floor, just clear of the motor deadband
+#define GOVERNOR_HORIZON_MS 1500   // The cap keeps the car at least this far in time from the floor
+#define GOVERNOR_SMOOTHING_MS 300  // Time constant of the closing speed filter
+#define GOVERNOR_READING_GAP_MS 1500 // Readings further apart do not give a closing speed
+
+// Ultrasonic circuit breaker: after this many readings in a row without an echo the sensor is
+// treated as failed, full readings stop and single probe pings are sent with exponential backoff
+#define SENSOR_TRIP_FAILURES 2     // Consecutive failed readings that trip the breaker
+#define SENSOR_PROBE_TIMEOUT 25000 // Echo timeout of a probe ping (us), ~4.3 m
+#define SENSOR_PROBE_MIN_MS 250    // First probe interval after a trip
+#define SENSOR_PROBE_MAX_MS 4000   // Longest probe interval; the backoff doubles up to this
+
+// Occupancy grid built from pings taken while turning in place
+#define GRID_CELLS 40              // Cells per side (4-bit log-odds, two per byte: 800 bytes)
+#define GRID_CELL_CM 10            // Cell size; the grid covers 4 m x 4 m around the car
+#define GRID_MAX_RANGE_CM 150      // Readings are trusted out to this range
+#define GRID_PING_TIMEOUT 10000    // Echo timeout per mapping ping (us), a little past the range
+#define GRID_SAMPLE_INTERVAL_MS 50 // Ping spacing while rotating, ~3.6 degrees at TURN_SPEED
+#define GRID_BEAM_HALF_ANGLE 10    // Free space is marked across the sensor cone out to this angle
+#define GRID_NO_ECHO_FREE_CM 40    // A ping with no echo clears only this far, and only along the centre
+#define GRID_CORRIDOR_HALF_ANGLE 10 // A heading's clearance is the worst ray within this angle of it
+#define GRID_AHEAD_EXCLUDE_DEG 60  // Avoidance never turns less than this toward the blocked heading
+#define GRID_MIN_CLEAR_CM 50       // Clearance a heading needs before avoidance turns to it
+
+// Turn calibration ('calibrate'): the car faces a wall and spins clockwise at each table level,
+// timing one full revolution between two passes of the wall
+#define CALIBRATION_MIN_CM 20      // Nearest reference wall accepted
+#define CALIBRATION_MAX_CM 100     // Farthest; nothing else may be within CALIBRATION_WINDOW_PCT of it
+#define CALIBRATION_WINDOW_PCT 115 // Readings within this share of the wall distance face the wall
+#define CALIBRATION_HYSTERESIS_CM 2 // Margin a reading needs past the window to leave it
+#define CALIBRATION_PING_MS 10     // Ping spacing while spinning
+#define CALIBRATION_ECHO_START_US 500 // pulseIn's timeout also covers the ~460 us before the echo starts
+#define CALIBRATION_SETTLE_MS 500  // Spin time at a new level before timing starts
+#define CALIBRATION_LEVEL_TIMEOUT_MS 60000 // A level needs two passes, up to two revolutions; fail after this long
+
+// Loop stall watchdog
+#define LOOP_STALL_BUDGET_MS 50    // A loop stage running longer than this is logged as a stall
+#define STALL_LOG_SIZE 8           // Stall records kept across soft resets
+
+// Warm-boot recovery: runtime state is checkpointed to RTC memory every loop iteration and
+// restored after a watchdog or panic reset
+#define CHECKPOINT_SEQUENCES 8     // Most recent '#<seq>' command numbers kept to spot re-sent commands
+#define CHECKPOINT_STABLE_MS 5000  // Uptime after which the next reset is no longer part of a crash loop
+
+// BCI intent stream: '@' followed by two hex digits of probability (00-FF) per
+// class, in the order rest, forward, backward, left, right
+#define INTENT_SMOOTHING_MS 60     // Time constant of the exponential smoothing
+#define INTENT_ENTER_LEVEL 0.45f   // Smoothed probability a class needs to take over
+#define INTENT_EXIT_LEVEL 0.30f    // Smoothed probability below which the current class lets go
+#define INTENT_DWELL_MS 80         // How long a new class must stay qualified before it is acted on
+#define INTENT_TIMEOUT_MS 300      // Stop if frames stop arriving for this long
+
+// Tickless idle: while stopped the loop blocks until its next timer or serial input
+#define IDLE_MIN_SLEEP_MS 2        // Shorter waits are spun rather than slept
+#define IDLE_MAX_SLEEP_MS 1000     // Longest single sleep, well inside the task watchdog timeout
+#define IDLE_WAKE_BUDGET_US 2000   // Serial wake to command dispatched; slower wakes are counted
+
+// Velocity setpoint stream: '>' followed by signed linear and turn values in PWM
+// units (-255..255), e.g. ">120 -40"; a positive turn rotates clockwise
+#define SETPOINT_TIMEOUT_MS 250    // Default dead-man window; stop if no setpoint arrives within it
+#define SETPOINT_DEADBAND 10       // Side duty below which that side is switched off
+
+// Raw ultrasonic capture
+#define SCAN_BUFFER_SAMPLES 4096   // Samples held in RAM for one capture (6 bytes each)
+#define SCAN_SLICE_MICROS 40000    // Longest burst of back-to-back pings per loop iteration; fits a timed-out ping
+#define SCAN_PING_TIMEOUT 30000    // Echo timeout per ping (us), ~5 m
+
+// Mission bytecode VM
+#define MISSION_MAX_BYTES 256      // Largest program that can be uploaded
+#define MISSION_STEPS_PER_TICK 16  // Instructions run per loop iteration at most
+#define MISSION_PING_TIMEOUT 12000 // Echo timeout of a mission range reading (us), ~2 m
+#define MISSION_RANGE_INTERVAL_MS 25 // Shortest time between mission range readings (lets echoes die down)
+#define MISSION_NO_ECHO_CM 999     // Distance a range reading gives when no echo returns
+
 // Movement types (from vehicle.h, included here for reference)
 // enum Movement { Stop, Forward, Backward, Clockwise, Contrarotate };
 
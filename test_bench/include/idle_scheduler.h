@@ -0,0 +1,58 @@
+#ifndef IDLE_SCHEDULER_H
+#define IDLE_SCHEDULER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+class SerialReceiver;
+
+// Tickless idle for the loop task. While the vehicle is stopped, the loop
+// blocks on a task notification until its next timer is due instead of
+// spinning; the UART receive callback (SerialReceiver) gives the notification,
+// so a command wakes it early, and stamps the bytes it queues, which times the wake. With power management enabled in the SDK configuration,
+// FreeRTOS drops into light sleep while the loop is blocked.
+class IdleScheduler {
+  private:
+    TaskHandle_t loopTask;
+    SerialReceiver* serialReceiver;
+    
+    // Arrival of the first byte after a serial wake
+    unsigned long receiveMicros;
+    bool wokeBySerial;
+    bool latencyPending;
+    
+    // Statistics since init()
+    unsigned long startMillis;
+    uint64_t sleptMicros;
+    unsigned long sleeps;
+    unsigned long serialWakes;
+    unsigned long maxWakeLatency;
+    unsigned long wakesOverBudget;
+    
+  public:
+    IdleScheduler();
+    
+    // Bind to the loop task and the ring input waits in; call from setup(), which runs in the task
+    void init(SerialReceiver* receiver);
+    
+    // Wake the loop task; call from the UART receive callback
+    void onSerialReceive();
+    
+    // Block for up to waitMillis (capped at IDLE_MAX_SLEEP_MS) unless input is already waiting
+    void sleepFor(unsigned long waitMillis);
+    
+    // True once after a sleep that serial input cut short; the loop then serves commands first
+    bool consumeSerialWake();
+    
+    // Call as a line is dispatched: the first one after a serial wake records how long the wake
+    // took to reach it
+    void lineDispatched();
+    
+    // Call after the command stage; a wake whose input did not complete a line goes unmeasured
+    void commandsServiced();
+    
+    // Report the share of time asleep and the wake-to-command latency
+    void printStatus() const;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef INTENT_FILTER_H
+#define INTENT_FILTER_H
+
+#include "config.h"
+#include "movement_controller.h"
+
+// Classes of the BCI classifier, in frame order
+enum IntentClass {
+  INTENT_REST,
+  INTENT_FORWARD,
+  INTENT_BACKWARD,
+  INTENT_LEFT,
+  INTENT_RIGHT,
+  INTENT_COUNT   // Also means "no decision"
+};
+
+// Turns a stream of classifier probability frames into movement decisions:
+// exponential smoothing per class, an enter/exit hysteresis band and a dwell
+// time before a new class is acted on. Stops the car if the stream goes quiet.
+class IntentFilter {
+  private:
+    MovementController* movementCtrl;
+    bool enabled;
+    
+    // Smoothed probability per class (0-1)
+    float smoothed[INTENT_COUNT];
+    
+    // Class acted on last, and the class waiting out its dwell time
+    int decision;
+    int candidate;
+    unsigned long candidateSince;
+    
+    bool streaming;
+    unsigned long lastFrameTime;
+    
+    unsigned long frameCount;
+    unsigned long rejectedFrames;
+    unsigned long decisionCount;
+    
+    // Forget the stream state, stopping the car if a decision was moving it
+    void reset(const char* reason);
+    
+    // Call the movement controller for a committed decision
+    void act(int intent);
+    
+  public:
+    IntentFilter(MovementController* moveCtrl);
+    
+    // Accept or ignore probability frames
+    void setEnabled(bool enable);
+    
+    bool isEnabled() const;
+    
+    // Feed one frame (the hex digits after '@'); returns false if it was rejected
+    bool processFrame(const char* hex, unsigned long currentTime);
+    
+    // Stop the car if frames stopped arriving
+    void update(unsigned long currentTime);
+    
+    // Report stream and decision counters
+    void printStatus() const;
+    
+    // Printable name of a class
+    static const char* intentName(int intent);
+};
+
+#endif
\ No newline at end of file
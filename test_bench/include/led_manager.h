@@ -26,6 +26,9 @@ class LedManager {
     
     // Get the current left LED status
     LedStatus getCurrentLeftLedStatus() const;
+    
+    // Milliseconds until a blinking pattern next changes, or ULONG_MAX if both LEDs are steady
+    unsigned long millisUntilChange(unsigned long currentTime, bool isConnected) const;
 };
 
 #endif
\ No newline at end of file
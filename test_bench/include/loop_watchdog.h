@@ -0,0 +1,97 @@
+#ifndef LOOP_WATCHDOG_H
+#define LOOP_WATCHDOG_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Sections of the main loop, checkpointed so a stall can be attributed
+enum LoopStage {
+  STAGE_IDLE,        // Between loop iterations
+  STAGE_LEDS,
+  STAGE_MOTION,      // Timed moves and the avoidance state machine
+  STAGE_MISSION,     // Uploaded mission program
+  STAGE_RANGING,     // Ultrasonic obstacle check
+  STAGE_SCAN,        // Raw ultrasonic capture slice
+  STAGE_COMMANDS,    // Serial input and command handlers
+  STAGE_MOTOR_WRITE,
+  STAGE_HEARTBEAT,
+  STAGE_COUNT
+};
+
+// What a stall record describes
+enum StallKind {
+  STALL_STAGE,  // One stage overran the budget
+  STALL_LOOP,   // No single stage did, but the whole iteration overran
+  STALL_RESET   // The board reset while the stage was running
+};
+
+// One loop overrun, kept in the post-mortem buffer
+struct StallRecord {
+  uint32_t atMillis;       // When the stage ended (or started, for resets)
+  uint32_t durationMicros; // 0 when the stage never finished
+  uint32_t serialMicros;   // Part of the duration spent blocked writing Serial
+  uint8_t kind;            // StallKind
+  uint8_t stage;           // LoopStage; the longest stage for STALL_LOOP
+  uint8_t resetReason;     // esp_reset_reason_t for STALL_RESET, else 0
+};
+
+// Times each loop stage against a stall budget and keeps the overruns in RTC
+// memory, so they can still be read after a watchdog or panic reset. The loop
+// task is also subscribed to the ESP32 task watchdog so a hard hang resets the
+// board; the stage it was in is then recovered at the next boot.
+class LoopWatchdog {
+  private:
+    unsigned long stallBudgetMicros;
+    
+    // Stage being timed
+    LoopStage stage;
+    unsigned long stageStart;
+    uint32_t stageSerialStart;
+    
+    // Longest stage of the current iteration, for stalls spread over several stages
+    unsigned long loopStart;
+    uint32_t loopSerialStart;
+    LoopStage longestStage;
+    unsigned long longestStageMicros;
+    bool stalledThisLoop;
+    
+    // Close the current stage and log it if it overran
+    void finishStage(unsigned long now);
+    
+    // Append a record to the post-mortem ring
+    void record(StallKind kind, LoopStage stalledStage, uint32_t atMillis, uint32_t durationMicros, uint32_t serialMicros);
+    
+  public:
+    LoopWatchdog();
+    
+    // Recover the post-mortem buffer from before a reset and subscribe the loop task
+    void init();
+    
+    // Feed the task watchdog and start timing a loop iteration
+    void beginLoop();
+    
+    // Move on to the next loop stage
+    void enterStage(LoopStage next);
+    
+    // Finish timing the loop iteration
+    void endLoop();
+    
+    // Set the stall budget (ms)
+    void setStallBudget(unsigned long budgetMillis);
+    
+    unsigned long getStallBudget() const;
+    
+    // Number of records in the post-mortem buffer
+    int getStallCount() const;
+    
+    // Print the post-mortem buffer, oldest first
+    void report() const;
+    
+    // Printable name of a stage
+    static const char* stageName(uint8_t stage);
+    
+    // Printable name of an esp_reset_reason_t
+    static const char* resetReasonName(uint8_t reason);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,14 @@
+#ifndef MEMORY_MONITOR_H
+#define MEMORY_MONITOR_H
+
+#include "config.h"
+
+// Heap and stack usage reporting for the `mem` command
+class MemoryMonitor {
+  public:
+    // Report free heap, largest free block, minimum-ever free heap and the
+    // stack high-water mark of each system task that exists
+    static void report();
+};
+
+#endif
\ No newline at end of file
@@ -4,10 +4,24 @@
 #include <Arduino.h>
 
 class MessageManager {
+  private:
+    // Time the calling task has spent blocked in Serial writes (µs); per task so
+    // output from other tasks is not charged to the main loop
+    static uint32_t& writeMicros() {
+      static thread_local uint32_t total = 0;
+      return total;
+    }
+    
+    static void write(const char* message) {
+      unsigned long start = micros();
+      Serial.println(message);
+      writeMicros() += micros() - start;
+    }
+    
   public:
     // Send a simple message - always uses Serial
-    static void send(const String& message) {
-      Serial.println(message);
+    static void send(const char* message) {
+      write(message);
     }
     
     // Send a formatted message - always uses Serial
@@ -18,7 +32,19 @@ class MessageManager {
       vsnprintf(buffer, sizeof(buffer), format, args);
       va_end(args);
       
-      Serial.println(buffer);
+      write(buffer);
+    }
+    
+    // Send raw bytes as they are, for binary transfers
+    static void sendBinary(const uint8_t* data, size_t size) {
+      unsigned long start = micros();
+      Serial.write(data, size);
+      writeMicros() += micros() - start;
+    }
+    
+    // Running total of time spent writing messages, for attributing loop stalls (µs)
+    static uint32_t getWriteMicros() {
+      return writeMicros();
     }
     
     // For compatibility - always returns true for "connected"
@@ -0,0 +1,63 @@
+#ifndef MISSION_BYTECODE_H
+#define MISSION_BYTECODE_H
+
+#include <stdint.h>
+
+// Mission bytecode, shared by the on-device VM and the host compiler. Each
+// instruction is an opcode byte followed by its operands; 16-bit operands are
+// little-endian and jump targets are byte offsets from the program start.
+enum MissionOp : uint8_t {
+  MOP_END = 0,      // Stop the car and finish
+  MOP_MOVE,         // dir(u8) speed(u8): drive until the next move; speed 0 uses the current speed,
+                    //   or TURN_SPEED for a spin
+  MOP_TURN,         // degrees(i16): turn in place, positive clockwise, and wait for it to finish
+  MOP_WAIT,         // millis(u16): pause the program, the car keeps doing what it was doing
+  MOP_RANGE,        // Ping once into the distance register; ends the tick
+  MOP_JUMP_LT,      // cm(u16) target(u16): jump if distance < cm
+  MOP_JUMP_GE,      // cm(u16) target(u16): jump if distance >= cm
+  MOP_JUMP,         // target(u16)
+  MOP_SET_COUNTER,  // counter(u8) value(u16)
+  MOP_LOOP,         // counter(u8) target(u16): decrement the counter and jump while it is non-zero
+  MOP_COUNT
+};
+
+// MOP_MOVE directions
+enum MissionDirection : uint8_t {
+  MDIR_STOP = 0,
+  MDIR_FORWARD,
+  MDIR_BACKWARD,
+  MDIR_SPIN_LEFT,
+  MDIR_SPIN_RIGHT,
+  MDIR_COUNT
+};
+
+// Loop counters available to MOP_SET_COUNTER and MOP_LOOP, one per nesting level
+#define MISSION_COUNTERS 4
+
+// Encoded size of an instruction, 0 for an unknown opcode
+inline uint8_t missionInstructionSize(uint8_t op) {
+  switch (op) {
+    case MOP_END:         return 1;
+    case MOP_MOVE:        return 3;
+    case MOP_TURN:        return 3;
+    case MOP_WAIT:        return 3;
+    case MOP_RANGE:       return 1;
+    case MOP_JUMP_LT:     return 5;
+    case MOP_JUMP_GE:     return 5;
+    case MOP_JUMP:        return 3;
+    case MOP_SET_COUNTER: return 4;
+    case MOP_LOOP:        return 4;
+    default:              return 0;
+  }
+}
+
+// Upload checksum: 16-bit sum of every program byte
+inline uint16_t missionChecksum(const uint8_t* program, int length) {
+  uint16_t sum = 0;
+  for (int i = 0; i < length; i++) {
+    sum += program[i];
+  }
+  return sum;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,114 @@
+#ifndef MISSION_VM_H
+#define MISSION_VM_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "mission_bytecode.h"
+#include "movement_controller.h"
+#include "sensor_manager.h"
+
+#if FEATURE_MISSIONS
+
+// Runs an uploaded mission program (see mission_bytecode.h) from the loop, so
+// reactive sequences like "drive until closer than 30 cm, then turn" run at
+// loop rate without a round trip to the host for every step. Each loop
+// iteration executes at most MISSION_STEPS_PER_TICK instructions and at most
+// one range reading, and readings are at least MISSION_RANGE_INTERVAL_MS
+// apart; waits, turns and backward jumps also end the tick.
+// Programs are checked when the upload completes, so execution never reads
+// outside the program or uses a counter that does not exist.
+class MissionVm {
+  private:
+    // What the program is blocked on between ticks
+    enum WaitState {
+      WAIT_NONE,
+      WAIT_TIME,   // MOP_WAIT until waitUntil
+      WAIT_MOTION  // MOP_TURN until the timed turn completes
+    };
+    
+    MovementController* movementCtrl;
+    SensorManager* sensorMgr;
+    
+    uint8_t program[MISSION_MAX_BYTES];
+    int length;
+    bool loaded;
+    
+    // Upload in progress
+    bool uploading;
+    int expectedLength;
+    uint16_t expectedChecksum;
+    
+    // Execution state
+    bool running;
+    int pc;
+    uint16_t counters[MISSION_COUNTERS];
+    int distance;
+    unsigned long lastRangeTime;
+    WaitState waitState;
+    unsigned long waitUntil;
+    uint8_t moveDirection;   // Last MOP_MOVE, re-applied when avoidance hands control back
+    uint8_t moveSpeed;
+    bool pausedForAvoidance;
+    
+    // Statistics for the current or last run
+    unsigned long startMillis;
+    unsigned long instructions;
+    unsigned long ticks;
+    unsigned long rangeReadings;
+    
+    // Check that every instruction is known, fits, and jumps to an instruction start
+    bool verify(const char** error) const;
+    
+    // Execute the instruction at pc; false once the tick should end
+    bool step(unsigned long currentTime);
+    
+    // Drive as a MOP_MOVE asks
+    void applyMove(uint8_t direction, uint8_t speed);
+    
+    // End the run, reporting why
+    void finish(const char* outcome);
+    
+  public:
+    MissionVm(MovementController* moveCtrl, SensorManager* sensMgr);
+    
+    // Start receiving a program of size bytes; stops a running mission
+    void beginUpload(int size, int checksum);
+    
+    // Take one '$' line of hex program bytes; verifies the program once all have arrived
+    void receiveChunk(const char* hex);
+    
+    // Run the loaded program from the start
+    void start();
+    
+    // Stop a running mission without touching the motors (the caller decides what they do next)
+    void abort(const char* reason);
+    
+    // Check whether a mission is running
+    bool isRunning() const;
+    
+    // Run one tick of the program
+    void update(unsigned long currentTime);
+    
+    // Time until the program next needs a tick: 0 if runnable now, ULONG_MAX if not running
+    unsigned long millisUntilNextStep(unsigned long currentTime) const;
+    
+    // Report what is loaded and how the last run went
+    void printStatus() const;
+};
+
+#else
+
+// Missions are compiled out of this profile: nothing is ever loaded or running
+class MissionVm {
+  public:
+    MissionVm(MovementController* moveCtrl, SensorManager* sensMgr) {}
+    void abort(const char* reason) {}
+    bool isRunning() const { return false; }
+    void update(unsigned long currentTime) {}
+    unsigned long millisUntilNextStep(unsigned long currentTime) const { return ULONG_MAX; }
+    void printStatus() const {}
+};
+
+#endif // FEATURE_MISSIONS
+
+#endif
\ No newline at end of file
@@ -0,0 +1,97 @@
+#ifndef MOTION_ARBITER_H
+#define MOTION_ARBITER_H
+
+#include <atomic>
+#include "config.h"
+#include "../src/lib/vehicle/vehicle.h"
+
+// Motion sources in ascending priority; a higher level preempts every lower one
+enum MotionPriority {
+  PRIORITY_MANUAL,     // Operator moves, timed moves and turns
+  PRIORITY_AVOIDANCE,  // Obstacle avoidance maneuver
+  PRIORITY_SAFETY,     // Stop holds that nothing may override
+  PRIORITY_LEVELS
+};
+
+// A direction byte for vehicle::Drive() and the PWM duty of each side
+struct MotorCommand {
+  int direction;
+  int leftSpeed;
+  int rightSpeed;
+};
+
+// True for a direction byte that moves the car ahead: some side forward and none backward
+inline bool drivesForward(int direction) {
+  return (direction & (M1_Forward | M3_Forward)) && !(direction & (M1_Backward | M3_Backward));
+}
+
+// Sole writer of the motors. Each behavior keeps a proposal in its priority
+// slot until it releases it; apply() writes the highest active proposal once
+// per loop tick, and only touches the hardware when the winner changes.
+// The emergency stop sits outside the priorities: it may be set from another
+// task at any moment, cuts the outputs itself, and while latched nothing but
+// Stop is written, whatever is proposed.
+class MotionArbiter {
+  private:
+    vehicle car;
+    MotorCommand proposals[PRIORITY_LEVELS];
+    bool active[PRIORITY_LEVELS];
+    MotorCommand lastWritten;
+    bool hasWritten;
+    
+    // Highest PWM written to a side while driving forward
+    int forwardLimit;
+    
+    // Set by emergencyStop() from any task, cleared only by the loop
+    std::atomic<bool> estopLatched;
+    std::atomic<uint32_t> estopMicros;
+    
+  public:
+    MotionArbiter();
+    
+    // Initialize the motor driver pins
+    void init();
+    
+    // Set or replace the proposal of a priority level
+    void propose(MotionPriority priority, int direction, int speed);
+    
+    // Same, with a separate duty for the left (M1/M2) and right (M3/M4) motors
+    void propose(MotionPriority priority, int direction, int leftSpeed, int rightSpeed);
+    
+    // Withdraw the proposal of a priority level
+    void release(MotionPriority priority);
+    
+    // Check whether a priority level currently has a proposal
+    bool isActive(MotionPriority priority) const;
+    
+    // Proposal kept at a priority level; only meaningful while isActive()
+    MotorCommand getProposal(MotionPriority priority) const;
+    
+    // Highest active level, or PRIORITY_LEVELS when nothing is proposed (motors stopped)
+    MotionPriority getWinner() const;
+    
+    // Command the winning proposal is asking for (Stop when nothing is proposed), scaled down to
+    // the forward limit when it drives ahead
+    MotorCommand getCommand() const;
+    
+    // Cap the PWM of forward motion, keeping the ratio between the sides; MAX_SPEED lifts the cap
+    void setForwardLimit(int pwm);
+    
+    // Write the winning proposal to the motors if it differs from the last write
+    void apply();
+    
+    // Cut PWM and the driver outputs now and latch them off. Safe from the UART receive callback
+    // while the loop is anywhere, including inside apply().
+    void emergencyStop();
+    
+    // Check whether the emergency stop is latched
+    bool isEmergencyStopped() const;
+    
+    // micros() when the latched emergency stop cut the motors
+    uint32_t getEmergencyStopMicros() const;
+    
+    // Release the latch; proposals take effect again at the next apply()
+    void clearEmergencyStop();
+};
+
+#endif
\ No newline at end of file
@@ -2,10 +2,9 @@
 #define MOVEMENT_CONTROLLER_H
 
 #include "config.h"
-#include "../src/lib/vehicle/vehicle.h"
+#include "motion_arbiter.h"
+#include "sweep_mapper.h"
 #include "led_manager.h"
-#include "bt_manager.h"
-#include "serial_manager.h"
 
 // State machine for non-blocking avoidance maneuver
 enum AvoidanceState { 
@@ -17,17 +16,49 @@ enum AvoidanceState {
 
 class MovementController {
   private:
-    vehicle* car;
+    MotionArbiter arbiter;
     LedManager* ledManager;
+    SweepMapper* sweepMapper;
     unsigned long timedMoveEnd;
+    bool timedMoveIsTurn;
     int currentSpeed;
     
+    // Velocity setpoint stream
+    bool setpointMode;
+    bool setpointDriving;
+    unsigned long setpointTimeout;
+    unsigned long lastSetpointTime;
+    
     // For non-blocking avoidance maneuver
     AvoidanceState avoidanceState;
     unsigned long stateChangeTime;
     
+    // Set while the sensor is failed; manual forward motion is dropped
+    bool forwardBlocked;
+    unsigned long lastBlockedReport;
+    
+    // Obstacle reactions: sample completion to the motor write that ended the approach
+    unsigned long obstacleReactions;
+    unsigned long maxReactionMicros;
+    uint64_t totalReactionMicros;
+    
+    // Emergency stops the loop has settled since boot; estopSettled is set once the current one is
+    bool estopSettled;
+    unsigned long emergencyStops;
+    
+    // Avoidance maneuver backup time and unmapped turn (defaults from config.h)
+    unsigned long avoidBackupDuration;
+    int avoidTurnDegrees;
+    
+    // Start a manual proposal, lifting any stop hold; durationMillis of 0 keeps it until replaced.
+    // Refused, with a message, while the emergency stop is latched.
+    bool startManual(int direction, int speed, unsigned long durationMillis, bool isTurn);
+    
+    // Left LED pattern for what the arbiter is currently driving
+    LedStatus motionLedStatus() const;
+    
   public:
-    MovementController(LedManager* ledMgr);
+    MovementController(LedManager* ledMgr, SweepMapper* mapper);
     
     // Initialize the car
     void init();
@@ -50,19 +81,86 @@ class MovementController {
     // Get the current speed
     int getSpeed() const;
     
-    // Stop movement
+    // Stop movement and hold the car stopped above every other behavior until the next move command
     void stop();
     
-    // Turn by specified degrees (positive for right, negative for left)
-    void turnByDegrees(int degrees);
+    // Cut the motors at once and latch them off until clearEmergencyStop(); move commands do not
+    // lift it. Safe from the UART receive callback whatever the loop is doing.
+    void emergencyStop();
+    
+    // Loop side of an emergency stop: true once per latch, after dropping every motion plan so
+    // nothing resumes when it is released
+    bool takeEmergencyStop();
+    
+    // Acknowledge the emergency stop; the car then holds stopped until the next move command
+    void clearEmergencyStop();
+    
+    bool isEmergencyStopped() const;
+    unsigned long getEmergencyStopCount() const;
+    
+    // Turn by specified degrees (positive for right, negative for left) without blocking the loop,
+    // timed from the turn table at the given PWM
+    void turnByDegrees(int degrees, int speed = TURN_SPEED);
+    
+    // Rotate in place until another movement command replaces it
+    void rotate(bool clockwise, int speed = TURN_SPEED);
+    
+    // Accept velocity setpoints, stopping if none arrives within timeoutMillis; lifts a stop hold
+    void enableSetpoints(unsigned long timeoutMillis);
+    
+    // Stop accepting velocity setpoints, stopping the car if one is driving it
+    void disableSetpoints();
+    
+    bool isSetpointMode() const;
+    unsigned long getSetpointTimeout() const;
     
-    // Perform obstacle avoidance maneuver
+    // Drive from a signed linear and turn value (PWM units, positive turn is clockwise).
+    // Ignored outside setpoint mode and while a stop hold is active.
+    void applySetpoint(int linear, int turn, unsigned long currentTime);
+    
+    // Manual move an operator command started and that is still running: direction byte, PWM,
+    // time left (0 until replaced) and whether it is a timed turn. False for none, for setpoint
+    // driving, and while a stop hold or the emergency stop is in force.
+    bool getResumableMotion(int* direction, int* speed, unsigned long* remainingMillis, bool* isTurn) const;
+    
+    // Restart a manual move saved by getResumableMotion(), e.g. across a reset
+    void resumeMotion(int direction, int speed, unsigned long remainingMillis, bool isTurn);
+    
+    // Perform obstacle avoidance maneuver; ignored while one is running or a stop hold is active
     void performAvoidanceManeuver();
     
+    // Check whether an obstacle may start a new avoidance maneuver
+    bool canStartAvoidance() const;
+    
+    // Start avoidance for an obstacle reading that completed at sampleMicros and write the motors
+    // at once, rather than at the loop's motor stage; false if no maneuver could start
+    bool reactToObstacle(int distanceCm, unsigned long sampleMicros);
+    
+    // Report the sample-to-motor latency of obstacle reactions for the status command
+    void printReactionStats() const;
+    
+    // Check whether the avoidance maneuver is running
+    bool isAvoiding() const;
+    
+    // Check whether the motors are stopped with nothing scheduled to move them
+    bool isIdle() const;
+    
+    // Refuse manual motion that drives forward (turns and reversing still work), for a blind car
+    void setForwardBlocked(bool blocked);
+    
+    // Cap the PWM of forward motion from any source; MAX_SPEED lifts the cap
+    void setForwardLimit(int pwm);
+    
+    // Write the winning motion proposal to the motors; call once per loop tick
+    void applyMotion();
+    
+    // Command the motors were last told to run
+    MotorCommand getMotorCommand() const;
+    
     // Update the avoidance maneuver state machine
     void updateAvoidanceManeuver(unsigned long currentTime);
     
-    // Check and handle timed movements
+    // Check and handle timed movements and the setpoint dead-man timeout
     void checkTimedMovements(unsigned long currentTime);
     
     // Get the current timed move end time
@@ -70,6 +168,13 @@ class MovementController {
     
     // Cancel any timed movement
     void cancelTimedMovement();
+    
+    // Set how long the avoidance maneuver backs up (ms), and how far it turns left when the map
+    // has no clear heading to offer (degrees)
+    void setAvoidanceTimings(unsigned long backupDuration, int turnDegrees);
+    
+    unsigned long getAvoidBackupDuration() const;
+    int getAvoidTurnDegrees() const;
 };
 
 #endif
\ No newline at end of file
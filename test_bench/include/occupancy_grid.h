@@ -0,0 +1,51 @@
+#ifndef OCCUPANCY_GRID_H
+#define OCCUPANCY_GRID_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Log-odds occupancy grid in a fixed RAM budget: GRID_CELLS x GRID_CELLS cells
+// of GRID_CELL_CM, each a 4-bit log-odds value packed two to a byte. The grid
+// is a window onto a world frame in cm (x ahead at power-on, y to the left)
+// that scrolls with the car; storage wraps around, so scrolling only clears
+// the rows and columns that come into view.
+class OccupancyGrid {
+  private:
+    uint8_t cells[GRID_CELLS * GRID_CELLS / 2];
+    int originX;  // World cell index of the window's first column
+    int originY;  // World cell index of the window's first row
+    
+    // Log-odds of a world cell, from -8 (free) through 0 (unknown) to 7 (occupied)
+    int get(int cellX, int cellY) const;
+    void set(int cellX, int cellY, int logOdds);
+    bool inWindow(int cellX, int cellY) const;
+    
+    // Reset one column or row of the window (world indices) to unknown
+    void clearColumn(int cellX);
+    void clearRow(int cellY);
+    
+  public:
+    OccupancyGrid();
+    
+    // Forget everything
+    void clear();
+    
+    // Scroll the window so the world point (x, y) lies near its centre
+    void recenter(float x, float y);
+    
+    // Fold in one range reading taken from (x, y) along heading (radians, counterclockwise).
+    // distanceCm of 0 means no echo within maxCm: the whole ray is free.
+    void addRange(float x, float y, float heading, int distanceCm, int maxCm);
+    
+    // Mark the cell at (x, y) free, e.g. because the car is standing in it
+    void markFree(float x, float y);
+    
+    // Walk a ray from (x, y) and return the distance to the first occupied cell (maxCm if none);
+    // unknownCm receives how much of that distance crossed cells with no evidence either way
+    int clearance(float x, float y, float heading, int maxCm, int* unknownCm) const;
+    
+    // Number of cells with any evidence
+    int knownCells() const;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,70 @@
+#ifndef SCAN_CAPTURE_H
+#define SCAN_CAPTURE_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "sensor_manager.h"
+
+// One raw ultrasonic sample as stored and dumped (little-endian, no padding)
+struct ScanSample {
+  uint32_t atMicros;   // Trigger time relative to the start of the capture
+  uint16_t echoMicros; // Echo pulse width, 0 when the ping timed out
+} __attribute__((packed));
+
+// Binary dump layout: header, sampleCount samples, then a 32-bit sum of every
+// header and sample byte. The frame follows a "Scan dump: ..." text line that
+// gives its total size.
+struct ScanDumpHeader {
+  char magic[4];         // "SCN1"
+  uint16_t sampleCount;
+  uint16_t sampleSize;   // sizeof(ScanSample)
+  uint32_t durationMicros;
+} __attribute__((packed));
+
+#if FEATURE_SCAN
+
+// Burst capture of raw echo times into a preallocated buffer. Pings are fired
+// back to back with no filtering or printing; each loop iteration runs one
+// slice of at most SCAN_SLICE_MICROS so commands and the watchdog keep going.
+class ScanCapture {
+  private:
+    SensorManager* sensorMgr;
+    ScanSample samples[SCAN_BUFFER_SAMPLES];
+    int targetCount;
+    int sampleCount;
+    int timeouts;
+    bool active;
+    unsigned long startMicros;
+    
+    // Report the capture and send the buffer as one binary frame
+    void dump();
+    
+  public:
+    ScanCapture(SensorManager* sensMgr);
+    
+    // Start capturing count samples (the whole buffer when count is 0 or too large)
+    void start(int count);
+    
+    // Abandon a capture without dumping it
+    void abort();
+    
+    // Check whether a capture is running
+    bool isActive() const;
+    
+    // Take samples for one slice; dumps the buffer when the capture completes
+    void update();
+};
+
+#else
+
+// Capture is compiled out of this profile: nothing ever runs and the buffer takes no RAM
+class ScanCapture {
+  public:
+    ScanCapture(SensorManager* sensMgr) {}
+    bool isActive() const { return false; }
+    void update() {}
+};
+
+#endif // FEATURE_SCAN
+
+#endif
\ No newline at end of file
@@ -19,26 +19,97 @@
 
 class SensorManager {
   private:
-    ultrasonic* sensor;
+    ultrasonic sensor;
     bool debugEnabled;
-    unsigned long lastObstacleCheck;
     bool avoidanceEnabled;
     int consecutiveFailedReadings;
     int lastValidDistance;
     
+    // Ranging schedule: the next reading is due sampleInterval after the last one
+    unsigned long lastSampleTime;
+    unsigned long sampleInterval;
+    
+    // Near field: while the last reading was within RANGE_GATE_CM, each check is a single gated
+    // ping and the reading is the median of the last readingAttempts of them
+    bool nearField;
+    int nearPings[READING_ATTEMPTS_LIMIT];
+    int nearPingCount;
+    int nearPingNext;
+    unsigned long nearReadings;
+    unsigned long fullReadings;
+    
+    // Set when a reading completes, until takeReading()
+    bool readingPending;
+    int pendingDistance;
+    unsigned long pendingMicros;
+    
+    // Tunable detection parameters (defaults from config.h)
+    int obstacleDistance;
+    unsigned long obstacleCheckInterval;
+    int readingAttempts;
+    
+    // Circuit breaker: while the sensor is failed no full readings are taken
+    bool sensorFailed;
+    bool tripPending;
+    unsigned long failedSince;
+    unsigned long lastProbeTime;
+    unsigned long probeInterval;
+    unsigned long probes;
+    unsigned long trips;
+    
+    // Enter degraded mode after repeated readings without an echo
+    void trip();
+    
+    // Hand a completed reading to the loop and schedule the next one
+    void onSample(int distance);
+    
+    // One gated ping folded into the near-field median; false once nothing is within the gate
+    bool takeNearFieldReading();
+    
+    // Sort values in place and return the middle one
+    static int median(int* values, int count);
+    
   public:
     SensorManager();
     
-    ~SensorManager();
+    // Initialize the ultrasonic sensor, taking a first reading to warm it up unless it was
+    // powered all along (a warm boot)
+    void init(int trigPin, int echoPin, bool warmUp = true);
     
-    // Initialize the ultrasonic sensor
-    void init(int trigPin, int echoPin);
-    
-    // Get a valid distance reading from the ultrasonic sensor
+    // Get a valid full-range distance reading from the ultrasonic sensor (FALLBACK_DISTANCE while
+    // it is failed)
     int getValidDistance();
     
-    // Check for obstacles and return true if one is detected
-    bool checkForObstacles(unsigned long currentTime);
+    // Fire a single ping and return the raw echo time (us, 0 on timeout), without filtering
+    unsigned long pingRaw(unsigned long timeoutMicros);
+    
+    // Take a reading for obstacle avoidance if one is due; true if a reading was taken. Within
+    // RANGE_GATE_CM readings are single gated pings every NEAR_CHECK_INTERVAL. Beyond a metre of
+    // clear space the gap widens, but never past the time the car needs at top speed to close half
+    // of it, nor OBSTACLE_MAX_CHECK_INTERVAL.
+    bool updateRanging(unsigned long currentTime);
+    
+    // Milliseconds until updateRanging() takes its next reading
+    unsigned long millisUntilNextSample(unsigned long currentTime) const;
+    
+    // True once for each valid reading, from any caller, giving its distance and the micros() at
+    // which it completed
+    bool takeReading(int* distanceCm, unsigned long* sampleMicros);
+    
+    // While the sensor is failed, send a probe ping when one is due; an echo restores full ranging
+    void updateBreaker(unsigned long currentTime);
+    
+    // Check whether the breaker has tripped: readings and obstacle checks are suspended
+    bool isSensorFailed() const;
+    
+    // Report a trip once, so the vehicle can apply its degraded-mode safety policy
+    bool takeTripEvent();
+    
+    // Milliseconds until the next probe ping, or ULONG_MAX while the sensor is healthy
+    unsigned long millisUntilNextProbe(unsigned long currentTime) const;
+    
+    // Print the breaker state for the status command
+    void printStatus() const;
     
     // Enable/disable obstacle avoidance
     void setAvoidanceEnabled(bool enabled);
@@ -51,6 +122,19 @@ class SensorManager {
     
     // Get debug mode state
     bool isDebugEnabled() const;
+    
+    // Set the distance at which an obstacle is reported (cm)
+    void setObstacleDistance(int distance);
+    
+    // Set the shortest time between obstacle readings (ms)
+    void setObstacleCheckInterval(unsigned long interval);
+    
+    // Set the number of pings per distance reading (1 to READING_ATTEMPTS_LIMIT)
+    void setReadingAttempts(int attempts);
+    
+    int getObstacleDistance() const;
+    unsigned long getObstacleCheckInterval() const;
+    int getReadingAttempts() const;
 };
 
 #endif
\ No newline at end of file
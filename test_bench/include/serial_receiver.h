@@ -0,0 +1,89 @@
+#ifndef SERIAL_RECEIVER_H
+#define SERIAL_RECEIVER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "spsc_ring.h"
+#include "movement_controller.h"
+#include "idle_scheduler.h"
+
+// Owns the UART receive callback. The callback drains the driver into a ring
+// the loop reads commands from, acting on ESTOP_BYTE as it passes: the stop
+// happens in the UART event task, which preempts the loop, so it does not
+// wait for the loop to get round to parsing a line.
+//
+// With flow control on, the host starts with SERIAL_RX_QUEUE bytes of credit,
+// spends one per byte it sends (ESTOP_BYTE is free) and gets them back as the
+// loop reads them, so a host that never exceeds its credit cannot overrun the
+// ring.
+class SerialReceiver {
+  private:
+    MovementController* movementCtrl;
+    IdleScheduler* idleScheduler;
+    
+    // Bytes for the loop, pushed by the receive callback
+    SpscRing<char, SERIAL_RX_QUEUE> received;
+    
+    // When each callback ran, and the running count of bytes queued once it was done
+    struct ReceiveStamp {
+      uint32_t endCount;
+      uint32_t atMicros;
+    };
+    SpscRing<ReceiveStamp, SERIAL_RX_STAMPS> stamps;
+    uint32_t queuedBytes;        // Written only by the receive callback
+    
+    // Loop side: bytes read so far, and the stamp of the callback that queued the last one
+    uint32_t readBytes;
+    ReceiveStamp readStamp;
+    
+    // Written only by the receive callback
+    volatile unsigned long droppedBytes;
+    
+    // Loop side of flow control: bytes read since credit was last returned
+    bool flowControl;
+    unsigned long creditsOwed;
+    unsigned long creditsReturned;
+    
+    // Receive callback: stop on ESTOP_BYTE, queue everything else and wake the loop
+    void onReceive();
+    
+    // When the callback queued byte number byteCount (counting from 1 since boot); now, if its
+    // stamp was lost. Loop side: passes over the stamps of bytes before it.
+    unsigned long arrivalOf(uint32_t byteCount);
+    
+  public:
+    SerialReceiver(MovementController* moveCtrl, IdleScheduler* idleSched);
+    
+    // Attach to the UART; call once from setup()
+    void init();
+    
+    // Next received byte for the loop; false when none is waiting. arrivalMicros, if given, gets
+    // the time the receive callback took the byte from the UART (now, if its stamp was lost).
+    bool read(char& c, unsigned long* arrivalMicros = nullptr);
+    
+    // Arrival time of the next byte waiting for the loop, as read() would give it; false if none
+    bool nextArrival(unsigned long* arrivalMicros);
+    
+    // True if bytes are waiting for the loop
+    bool available() const;
+    
+    // Bytes waiting for the loop
+    size_t waiting() const;
+    
+    // Turn flow control on or off; turning it on restarts the host's credit at SERIAL_RX_QUEUE,
+    // so the host must wait for the reply before sending more
+    void setFlowControl(bool enabled);
+    bool isFlowControlEnabled() const;
+    
+    // Credit to return to the host: the bytes read since the last return once there are at
+    // least FLOW_CREDIT_BATCH of them, else 0
+    unsigned long takeCredits();
+    
+    // Credit returned since flow control was turned on
+    unsigned long getCreditsReturned() const;
+    
+    // Bytes lost because the loop fell SERIAL_RX_QUEUE behind
+    unsigned long getDroppedBytes() const;
+};
+
+#endif
\ No newline at end of file
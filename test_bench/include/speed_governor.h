@@ -0,0 +1,52 @@
+#ifndef SPEED_GOVERNOR_H
+#define SPEED_GOVERNOR_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Caps forward PWM from each obstacle reading instead of leaving every
+// approach to the stop-back-turn maneuver. The cap falls with the distance
+// left above the hard floor and with the time to reach the floor at the
+// filtered closing speed, down to a creep just above the motor deadband. While
+// it is enabled, avoidance only starts once a reading breaches the floor.
+class SpeedGovernor {
+  private:
+    bool enabled;
+    
+    // Previous reading, for the closing speed
+    bool hasReading;
+    int lastDistance;
+    unsigned long lastReadingMicros;
+    
+    // Filtered rate at which the gap ahead shrinks (cm/s, negative when opening)
+    float closingSpeed;
+    
+    // Forward PWM cap from the last reading
+    int limit;
+    
+    // Statistics since the governor was enabled
+    unsigned long readings;
+    unsigned long governedReadings;
+    int lowestLimit;
+    
+  public:
+    SpeedGovernor();
+    
+    // Enable or disable the governor; disabling lifts the cap
+    void setEnabled(bool enable);
+    bool isEnabled() const;
+    
+    // Fold in a completed obstacle reading taken at sampleMicros and recompute the cap
+    void update(int distanceCm, unsigned long sampleMicros);
+    
+    // Forward PWM cap; MAX_SPEED while disabled
+    int getLimit() const;
+    
+    // Distance at or below which a reading starts the avoidance maneuver
+    int floorDistance(int obstacleDistance) const;
+    
+    // Report the cap and closing speed for the status command
+    void printStatus() const;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,140 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Internal SRAM on the ESP32 is not cached, so the two indices can share a
+// line there; on the host they are kept apart to avoid false sharing.
+#if defined(ARDUINO_ARCH_ESP32)
+#define SPSC_RING_ALIGN 4
+#else
+#define SPSC_RING_ALIGN 64
+#endif
+
+// Fixed-capacity single-producer single-consumer ring for handing data from an
+// interrupt or callback to the main loop without locks or heap allocation.
+// Exactly one context may push and exactly one may pop. Capacity must be a
+// power of two; the indices run freely and are masked on access, so all
+// Capacity slots are usable. Called from an ISR, the ring must live in DRAM
+// (any global or member does) and the ISR itself must be in IRAM.
+template <typename T, size_t Capacity>
+class SpscRing {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+  static_assert(std::atomic<size_t>::is_always_lock_free, "SpscRing indices must be lock-free to be used from an ISR");
+  
+  private:
+    static const size_t MASK = Capacity - 1;
+    
+    // Written only by the producer: the slot's data is published by the release store of head
+    alignas(SPSC_RING_ALIGN) std::atomic<size_t> head;
+    size_t cachedTail;
+    
+    // Written only by the consumer: the release store of tail hands the slot back
+    alignas(SPSC_RING_ALIGN) std::atomic<size_t> tail;
+    size_t cachedHead;
+    
+    alignas(SPSC_RING_ALIGN) T slots[Capacity];
+    
+    // Free slots as seen by the producer, rereading the consumer's index only when needed
+    size_t freeSlots(size_t writeIndex, size_t wanted) {
+      size_t available = Capacity - (writeIndex - cachedTail);
+      if (available < wanted) {
+        cachedTail = tail.load(std::memory_order_acquire);
+        available = Capacity - (writeIndex - cachedTail);
+      }
+      return available;
+    }
+    
+    // Filled slots as seen by the consumer, rereading the producer's index only when needed
+    size_t filledSlots(size_t readIndex, size_t wanted) {
+      size_t available = cachedHead - readIndex;
+      if (available < wanted) {
+        cachedHead = head.load(std::memory_order_acquire);
+        available = cachedHead - readIndex;
+      }
+      return available;
+    }
+    
+  public:
+    SpscRing() : head(0), cachedTail(0), tail(0), cachedHead(0) {}
+    
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+    
+    // Producer: append one item; false if the ring is full
+    bool push(const T& item) {
+      size_t writeIndex = head.load(std::memory_order_relaxed);
+      if (freeSlots(writeIndex, 1) == 0) {
+        return false;
+      }
+      slots[writeIndex & MASK] = item;
+      head.store(writeIndex + 1, std::memory_order_release);
+      return true;
+    }
+    
+    // Producer: append up to count items in order; returns how many fit
+    size_t pushBatch(const T* items, size_t count) {
+      size_t writeIndex = head.load(std::memory_order_relaxed);
+      size_t available = freeSlots(writeIndex, count);
+      if (count > available) {
+        count = available;
+      }
+      for (size_t i = 0; i < count; i++) {
+        slots[(writeIndex + i) & MASK] = items[i];
+      }
+      if (count > 0) {
+        head.store(writeIndex + count, std::memory_order_release);
+      }
+      return count;
+    }
+    
+    // Consumer: take the oldest item; false if the ring is empty
+    bool pop(T& item) {
+      size_t readIndex = tail.load(std::memory_order_relaxed);
+      if (filledSlots(readIndex, 1) == 0) {
+        return false;
+      }
+      item = slots[readIndex & MASK];
+      tail.store(readIndex + 1, std::memory_order_release);
+      return true;
+    }
+    
+    // Consumer: take up to maxCount of the oldest items; returns how many were taken
+    size_t popBatch(T* items, size_t maxCount) {
+      size_t readIndex = tail.load(std::memory_order_relaxed);
+      size_t available = filledSlots(readIndex, maxCount);
+      if (maxCount > available) {
+        maxCount = available;
+      }
+      for (size_t i = 0; i < maxCount; i++) {
+        items[i] = slots[(readIndex + i) & MASK];
+      }
+      if (maxCount > 0) {
+        tail.store(readIndex + maxCount, std::memory_order_release);
+      }
+      return maxCount;
+    }
+    
+    // Consumer: drop everything pushed so far; returns how many items were dropped
+    size_t discard() {
+      size_t readIndex = tail.load(std::memory_order_relaxed);
+      size_t writeIndex = head.load(std::memory_order_acquire);
+      cachedHead = writeIndex;
+      tail.store(writeIndex, std::memory_order_release);
+      return writeIndex - readIndex;
+    }
+    
+    // Items waiting; only a snapshot while the other side is running
+    size_t size() const {
+      size_t readIndex = tail.load(std::memory_order_acquire);
+      return head.load(std::memory_order_acquire) - readIndex;
+    }
+    
+    bool empty() const { return size() == 0; }
+    
+    static constexpr size_t capacity() { return Capacity; }
+};
+
+#endif
\ No newline at end of file
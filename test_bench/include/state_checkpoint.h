@@ -0,0 +1,76 @@
+#ifndef STATE_CHECKPOINT_H
+#define STATE_CHECKPOINT_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Bits of RuntimeState::flags
+enum RuntimeStateFlag {
+  STATE_AVOIDANCE = 1 << 0,
+  STATE_GOVERNOR = 1 << 1,
+  STATE_SETPOINTS = 1 << 2,
+  STATE_INTENT = 1 << 3,
+  STATE_ESTOP = 1 << 4,      // Emergency stop latched
+  STATE_MOTION = 1 << 5      // The motion fields hold a manual move in progress
+};
+
+// What a warm boot needs to carry on where the vehicle left off. Laid out without padding,
+// so the checksum covers only written bytes.
+struct RuntimeState {
+  uint8_t flags;
+  uint8_t direction;               // Manual move: motor direction byte
+  uint8_t motionIsTurn;            // Manual move: a timed turn rather than a drive
+  uint8_t sequenceCount;
+  int16_t speed;                   // Global speed
+  int16_t motionSpeed;             // Manual move: PWM
+  uint32_t motionRemainingMillis;  // Manual move: time left, 0 until replaced
+  uint32_t setpointTimeout;
+  uint16_t sequences[CHECKPOINT_SEQUENCES];  // Most recent command sequence numbers, oldest first
+};
+
+// Keeps a RuntimeState in RTC memory, which a watchdog or panic reset does not
+// clear. Two slots are written in turn, each with a generation count and a
+// checksum, so a reset in the middle of a write leaves the previous checkpoint
+// to recover from.
+class StateCheckpoint {
+  private:
+    bool warmBoot;
+    uint8_t resetReason;
+    uint32_t generation;
+    uint32_t unstableBoots;
+    unsigned long bootMillis;
+    RuntimeState recovered;
+    
+  public:
+    StateCheckpoint();
+    
+    // Recover the newest checkpoint that verifies after a soft reset; false after power-on or
+    // when neither slot verifies. Call first thing in setup().
+    bool init();
+    
+    bool isWarmBoot() const;
+    
+    // State written just before the reset; valid after init() returned true
+    const RuntimeState& getRecovered() const;
+    
+    // Warm boots in a row, this one included, none of which ran CHECKPOINT_STABLE_MS
+    uint32_t getUnstableBoots() const;
+    
+    // millis() when init() ran
+    unsigned long getBootMillis() const;
+    
+    // esp_reset_reason_t of this boot
+    uint8_t getResetReason() const;
+    
+    // True when a watchdog or panic cut a run short. An external, brownout or software reset
+    // was asked for or means the power is in doubt, so it restores settings but not motion.
+    bool isCrashReset() const;
+    
+    // Write the state to the older slot; a few microseconds, cheap enough for every iteration
+    void save(const RuntimeState& state);
+    
+    // Report the boot kind and checkpoint count for the status command
+    void printStatus() const;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,82 @@
+#ifndef SWEEP_MAPPER_H
+#define SWEEP_MAPPER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "motion_arbiter.h"
+#include "occupancy_grid.h"
+#include "sensor_manager.h"
+
+// Maps the surroundings from the rotations the car makes anyway. The pose is
+// dead-reckoned from the motor commands actually written, using the bench
+// motion model in config.h and the turn-rate table, which calibration may
+// replace at runtime; while the car spins in place, a raw ping every
+// GRID_SAMPLE_INTERVAL_MS is folded into the occupancy grid at the estimated
+// heading.
+class SweepMapper {
+  private:
+    SensorManager* sensorMgr;
+    OccupancyGrid grid;
+    
+    // Estimated pose: cm from the power-on position, heading in radians counterclockwise
+    float x, y, heading;
+    MotorCommand command;
+    unsigned long lastTrackMicros;
+    bool tracking;
+    
+    unsigned long lastSample;
+    unsigned long samples;
+    
+    // Time to rotate 90 degrees in place at each TURN_TABLE_PWM level (ms)
+    uint16_t turnMsPer90[TURN_TABLE_SIZE];
+    bool turnTableCalibrated;
+    
+    // Estimated wheel surface speed for a PWM duty (cm/s)
+    static float wheelSpeed(int pwm);
+    
+    // In-place rotation rate at a PWM duty (degrees/s), interpolated linearly in PWM between table
+    // levels and down to zero at the motor deadband; held at the top level above it
+    float turnRate(int pwm) const;
+    
+  public:
+    SweepMapper(SensorManager* sensMgr);
+    
+    // Advance the pose under the previous command, then adopt the one just written to the motors
+    void track(const MotorCommand& applied, unsigned long nowMicros);
+    
+    // Check whether the car is rotating in place
+    bool isRotating() const;
+    
+    // Take a mapping ping if the car is rotating and one is due
+    void update(unsigned long currentTime);
+    
+    // Clockwise degrees to the clearest heading at least GRID_AHEAD_EXCLUDE_DEG from the current
+    // one, or 0 when the map has no evidence around the car or no heading has GRID_MIN_CLEAR_CM
+    int clearestTurn() const;
+    
+    // How long an in-place turn of degrees takes at the given PWM
+    unsigned long turnMillis(int degrees, int pwm) const;
+    
+    // PWM of a turn table level
+    static int turnTablePwm(int level);
+    
+    unsigned long getTurnMsPer90(int level) const;
+    
+    // Replace the time a level takes to rotate 90 degrees; calibrated marks a measured table
+    void setTurnMsPer90(int level, unsigned long msPer90, bool calibrated);
+    
+    // Install the table the last calibration saved to NVS, if it was measured at the current
+    // TURN_TABLE_PWM levels. Call from setup(), in every profile and after a reset of any kind.
+    void loadTurnTable();
+    
+    // Write the table to NVS for loadTurnTable(); false if the write failed
+    bool saveTurnTable() const;
+    
+    // Report the turn table and where it came from
+    void printTurnTable() const;
+    
+    // Report the pose estimate, the mapped area and the clearest turn
+    void printStatus() const;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Timeline hooks around loop stages and calls worth seeing on a trace. They
+// compile to nothing unless TRACE_ENABLED is defined; the host simulator
+// defines it and records the events against its virtual clock. Names must be
+// string literals (or otherwise outlive the trace). Stage spans may be left
+// out of the trace when nothing happened in them; call spans always appear.
+#ifdef TRACE_ENABLED
+
+void traceBegin(const char* name);
+void traceStageBegin(const char* name);
+void traceEnd(const char* name);
+void traceInstant(const char* name);
+void traceCounter(const char* name, long value);
+
+// Begin/end pair for the enclosing block
+class TraceScope {
+  private:
+    const char* name;
+    
+  public:
+    explicit TraceScope(const char* scopeName) : name(scopeName) { traceBegin(name); }
+    ~TraceScope() { traceEnd(name); }
+};
+
+#define TRACE_JOIN_(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_JOIN(traceScope, __LINE__)(name)
+#define TRACE_STAGE_BEGIN(name) traceStageBegin(name)
+#define TRACE_STAGE_END(name) traceEnd(name)
+#define TRACE_INSTANT(name) traceInstant(name)
+#define TRACE_COUNTER(name, value) traceCounter(name, value)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_STAGE_BEGIN(name)
+#define TRACE_STAGE_END(name)
+#define TRACE_INSTANT(name)
+#define TRACE_COUNTER(name, value)
+
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+#ifndef TURN_CALIBRATOR_H
+#define TURN_CALIBRATOR_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "movement_controller.h"
+#include "sensor_manager.h"
+#include "sweep_mapper.h"
+
+#if FEATURE_CALIBRATION
+
+// Measures the turn table on the floor the car stands on. Facing a wall, the
+// car spins clockwise at each table level. The wall echoes back inside a window
+// of headings once per revolution, so the time between the centres of two
+// passes is one revolution at that level, whatever the spin-up took. One ping
+// per loop iteration at most, so commands and the watchdog keep going; any
+// other motion ends the calibration and leaves the table as it was.
+class TurnCalibrator {
+  private:
+    // Where the car is in the current revolution
+    enum Phase {
+      PHASE_SETTLE,    // Spinning up to the level's speed
+      PHASE_LEAVE,     // Still facing the wall it started or settled at
+      PHASE_APPROACH,  // Facing away, waiting for the wall to come round
+      PHASE_FACING     // Inside the window
+    };
+    
+    MovementController* movementCtrl;
+    SensorManager* sensorMgr;
+    SweepMapper* sweepMapper;
+    bool active;
+    Phase phase;
+    int level;
+    
+    // Reference wall and the echo window around it
+    int wallCm;
+    int windowCm;
+    unsigned long pingTimeout;
+    
+    unsigned long startTime;
+    unsigned long levelStart;
+    unsigned long lastPing;
+    
+    // Timing of the current level's passes (micros())
+    unsigned long enterMicros;
+    unsigned long leaveMicros;
+    int awayReadings;          // Readings in a row outside the window while facing
+    int passes;
+    unsigned long firstCentreMicros;
+    
+    unsigned long measured[TURN_TABLE_SIZE];
+    
+    // Spin at the current level and start timing it
+    void startLevel(unsigned long currentTime);
+    
+    // Act on one reading: true while it is in the window, away once past the hysteresis
+    void onReading(bool facing, bool away, unsigned long nowMicros, unsigned long currentTime);
+    
+    // Install the measured table and stop the car
+    void finish(unsigned long currentTime);
+    
+  public:
+    TurnCalibrator(MovementController* moveCtrl, SensorManager* sensMgr, SweepMapper* mapper);
+    
+    // Take a reference reading and start spinning; refused unless a wall is in range ahead
+    void start();
+    
+    // End a calibration without touching the table; stopCar stops the spin as well
+    void abort(const char* reason, bool stopCar);
+    
+    // Check whether a calibration is running
+    bool isActive() const;
+    
+    // Take the next ping when due and advance through the levels
+    void update(unsigned long currentTime);
+};
+
+#else
+
+// Calibration is compiled out of this profile; SweepMapper still loads a table saved by one that has it
+class TurnCalibrator {
+  public:
+    TurnCalibrator(MovementController* moveCtrl, SensorManager* sensMgr, SweepMapper* mapper) {}
+    bool isActive() const { return false; }
+    void update(unsigned long currentTime) {}
+};
+
+#endif // FEATURE_CALIBRATION
+
+#endif
\ No newline at end of file
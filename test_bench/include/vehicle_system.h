@@ -0,0 +1,73 @@
+#ifndef VEHICLE_SYSTEM_H
+#define VEHICLE_SYSTEM_H
+
+#include "config.h"
+#include "led_manager.h"
+#include "sensor_manager.h"
+#include "movement_controller.h"
+#include "command_processor.h"
+#include "loop_watchdog.h"
+#include "scan_capture.h"
+#include "intent_filter.h"
+#include "idle_scheduler.h"
+#include "serial_receiver.h"
+#include "sweep_mapper.h"
+#include "mission_vm.h"
+#include "speed_governor.h"
+#include "state_checkpoint.h"
+#include "turn_calibrator.h"
+
+// Owns every manager and runs the main loop schedule. The sketch holds a
+// single statically allocated instance; the host simulator creates one per
+// simulated vehicle. Nothing in the loop path allocates from the heap.
+class VehicleSystem {
+  private:
+    LedManager ledManager;
+    SensorManager sensorManager;
+    SweepMapper sweepMapper;
+    MovementController movementController;
+    LoopWatchdog watchdog;
+    ScanCapture scanCapture;
+    IntentFilter intentFilter;
+    IdleScheduler idleScheduler;
+    SpeedGovernor speedGovernor;
+    SerialReceiver serialReceiver;
+    MissionVm missionVm;
+    TurnCalibrator turnCalibrator;
+    CommandProcessor commandProcessor;
+    StateCheckpoint stateCheckpoint;
+    
+    // Loop task timers
+    unsigned long lastLedUpdate;
+    
+    // Timer for the periodic "System running" message
+    unsigned long lastHeartbeatTime;
+    
+    // Act on the last obstacle reading, whichever stage took it: update the speed governor and
+    // start avoidance if it breached the floor
+    void handleReading();
+    
+    // Snapshot of what a warm boot restores
+    void captureState(RuntimeState* state) const;
+    
+    // Bring the recovered checkpoint back into force at the end of a warm boot
+    void restoreState();
+    
+    // Milliseconds until the LED, ranging, mission or heartbeat task is next due
+    unsigned long millisUntilNextTask(unsigned long currentTime) const;
+    
+  public:
+    VehicleSystem();
+    
+    // Initialize hardware and print the startup banner
+    void setup();
+    
+    // Run one iteration of the main loop
+    void loop();
+    
+    // Access to the managers for tuning and inspection
+    SensorManager& getSensorManager();
+    MovementController& getMovementController();
+};
+
+#endif
\ No newline at end of file
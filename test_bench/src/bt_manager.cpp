@@ -1,3 +1,8 @@
+#include "../include/config.h"
+
+// Compiled only when a build asks for Bluetooth: including BluetoothSerial.h links the whole stack
+#if FEATURE_BLUETOOTH
+
 #include "../include/bt_manager.h"
 #include <stdarg.h>
 
@@ -81,4 +86,6 @@ void BtManager::sendPing() {
   if (isConnected) {
     serialBT.println("ping");
   }
-}
\ No newline at end of file
+}
+
+#endif // FEATURE_BLUETOOTH
\ No newline at end of file
@@ -1,244 +1,632 @@
 #include "../include/command_processor.h"
 #include "../include/message_manager.h"
+#include "../include/memory_monitor.h"
+#include "../include/trace.h"
+#include <errno.h>
+#include <limits.h>
 
-CommandProcessor::CommandProcessor(MovementController* moveCtrl, SensorManager* sensMgr, BtManager* bluetoothMgr) {
+// Descriptions are compiled out of profiles without help text; help then lists names and usage
+#if FEATURE_HELP_TEXT
+#define HELP(text) text
+#else
+#define HELP(text) ""
+#endif
+
+// Argument bounds used in the table
+#define ARG_ANY {INT_MIN, INT_MAX}
+#define ARG_POSITIVE {1, INT_MAX}
+#define ARG_NON_NEGATIVE {0, INT_MAX}
+#define ARG_SPEED {MIN_SPEED, MAX_SPEED}
+#define ARG_SECONDS {1, INT_MAX / 1000}  // Kept in unsigned long milliseconds
+#define ARG_DEGREES {-3600, 3600}        // Ten turns either way
+#define ARG_U16 {0, 65535}               // Fits a 16-bit field, such as the mission checksum
+
+// The command table. Help is printed in table order, starting a new heading whenever
+// the section changes; lookup compares the first word against name and alias.
+constexpr CommandProcessor::CommandSpec CommandProcessor::commandTable[] = {
+  {"speed",    nullptr, ARGS_INT,      1, 1, {ARG_SPEED},                       true,  "Speed Control",     "<value>",            HELP("Set global speed (50-255)"),                                      &CommandProcessor::handleSpeed},
+  {"forward",  "f",     ARGS_INT_TAIL, 0, 2, {ARG_SPEED, ARG_SECONDS},          true,  "Movement Commands", "[[speed] seconds]",  HELP("Move forward at current or given speed, optionally for seconds"),  &CommandProcessor::handleForward},
+  {"backward", "b",     ARGS_INT_TAIL, 0, 2, {ARG_SPEED, ARG_SECONDS},          true,  "Movement Commands", "[[speed] seconds]",  HELP("Move backward at current or given speed, optionally for seconds"), &CommandProcessor::handleBackward},
+  {"stop",     "s",     ARGS_NONE,     0, 0, {},                                true,  "Movement Commands", "",                   HELP("Stop movement"),                                                  &CommandProcessor::handleStop},
+  {"estop",    nullptr, ARGS_FLAG,     1, 1, {},                                true,  "Movement Commands", "on/off",             HELP("Latch the motors off, or release them; the Ctrl-C byte latches without a line"), &CommandProcessor::handleEstop},
+  {"turn",     nullptr, ARGS_INT,      1, 2, {ARG_DEGREES, ARG_SPEED},          true,  "Movement Commands", "<degrees> [speed]",  HELP("Turn by degrees (positive for right, negative for left), timed from the turn table"), &CommandProcessor::handleTurn},
+  {"drive",    nullptr, ARGS_INT,      0, 1, {ARG_NON_NEGATIVE},                true,  "Movement Commands", "[timeout_ms]",       HELP("Accept '>linear turn' setpoints, stopping if none arrives in time; 0 disables"), &CommandProcessor::handleDrive},
+  {"distance", nullptr, ARGS_NONE,     0, 0, {},                                true,  "Sensor Commands",   "",                   HELP("Report current distance from ultrasonic sensor"),                 &CommandProcessor::handleDistance},
+  {"avoid",    nullptr, ARGS_FLAG,     1, 1, {},                                true,  "Sensor Commands",   "on/off",             HELP("Enable/disable obstacle avoidance"),                              &CommandProcessor::handleAvoid},
+  {"govern",   nullptr, ARGS_FLAG,     1, 1, {},                                true,  "Sensor Commands",   "on/off",             HELP("Slow forward motion near obstacles, avoiding only below a hard floor"), &CommandProcessor::handleGovern},
+#if FEATURE_DIAGNOSTICS
+  {"debug",    nullptr, ARGS_FLAG,     1, 1, {},                                true,  "Sensor Commands",   "on/off",             HELP("Enable/disable sensor debugging information"),                    &CommandProcessor::handleDebug},
+#endif
+#if FEATURE_CALIBRATION
+  {"calibrate", nullptr, ARGS_NONE,    0, 0, {},                                true,  "Sensor Commands",   "",                   HELP("Face a wall 20-100 cm away, then spin to measure the turn table; stop aborts"), &CommandProcessor::handleCalibrate},
+#endif
+#if FEATURE_SCAN
+  {"scan",     nullptr, ARGS_INT,      0, 1, {{0, SCAN_BUFFER_SAMPLES}},        true,  "Sensor Commands",   "[samples]",          HELP("Stop and capture raw echoes at full rate, then dump them in binary; 0 aborts"), &CommandProcessor::handleScan},
+#endif
+#if FEATURE_DIAGNOSTICS
+  {"grid",     nullptr, ARGS_NONE,     0, 0, {},                                true,  "Sensor Commands",   "",                   HELP("Report the occupancy grid mapped while turning and the clearest turn"), &CommandProcessor::handleGrid},
+#endif
+  {"intent",   nullptr, ARGS_FLAG,     1, 1, {},                                true,  "BCI Stream",        "on/off",             HELP("Accept '@' probability frames and drive from the smoothed intent"), &CommandProcessor::handleIntent},
+#if FEATURE_MISSIONS
+  {"mission",  nullptr, ARGS_INT,      0, 2, {{1, MISSION_MAX_BYTES}, ARG_U16}, true,  "Missions",          "[bytes checksum]",   HELP("Show the loaded mission; with a size and checksum, start a '$' hex upload"), &CommandProcessor::handleMission},
+  {"run",      nullptr, ARGS_NONE,     0, 0, {},                                true,  "Missions",          "",                   HELP("Run the uploaded mission; stop or any move command ends it"),     &CommandProcessor::handleRun},
+#endif
+  {"help",     nullptr, ARGS_NONE,     0, 0, {},                                true,  "Other Commands",    "",                   HELP("Show this help information"),                                     &CommandProcessor::handleHelp},
+  {"ping",     nullptr, ARGS_INT_TOKEN, 0, 2, {ARG_ANY, ARG_ANY},               false, "Other Commands",    "[seq host_ts]",      HELP("Connectivity test; with a sequence number and host timestamp, reply with device timings"), &CommandProcessor::handlePing},
+  {"flow",     nullptr, ARGS_FLAG,     1, 1, {},                                true,  "Other Commands",    "on/off",             HELP("Return input credit as '~bytes' lines so the host can pace itself to the loop"), &CommandProcessor::handleFlow},
+  {"status",   nullptr, ARGS_NONE,     0, 0, {},                                true,  "Other Commands",    "",                   HELP("Show current system status (includes speed)"),                    &CommandProcessor::handleStatus},
+#if FEATURE_DIAGNOSTICS
+  {"mem",      nullptr, ARGS_NONE,     0, 0, {},                                true,  "Other Commands",    "",                   HELP("Show heap usage and task stack high-water marks"),                &CommandProcessor::handleMem},
+  {"stalls",   nullptr, ARGS_INT,      0, 1, {ARG_POSITIVE},                    true,  "Other Commands",    "[budget_ms]",        HELP("Show loop stalls kept across resets; with a value, set the budget"), &CommandProcessor::handleStalls}
+#endif
+};
+
+constexpr int CommandProcessor::commandCount = sizeof(commandTable) / sizeof(commandTable[0]);
+
+// Compile-time checks over the table, written as single-expression recursion so they
+// also build on toolchains limited to C++11 constexpr
+static constexpr bool sameName(const char* a, const char* b) {
+  return a != nullptr && b != nullptr && *a == *b && (*a == '\0' || sameName(a + 1, b + 1));
+}
+
+static constexpr bool isLowercaseName(const char* name) {
+  return *name == '\0' || (!(*name >= 'A' && *name <= 'Z') && *name != ' ' && isLowercaseName(name + 1));
+}
+
+template <typename Range>
+static constexpr bool rangesValid(const Range* ranges, int count) {
+  return count == 0 || (ranges->min <= ranges->max && rangesValid(ranges + 1, count - 1));
+}
+
+template <typename Spec>
+static constexpr bool nameTaken(const Spec* table, int count, const char* name) {
+  return count > 0 && (sameName(table->name, name) || sameName(table->alias, name) ||
+                       nameTaken(table + 1, count - 1, name));
+}
+
+template <typename Spec>
+static constexpr bool tableValid(const Spec* table, int count) {
+  return count == 0 ||
+         (table->name[0] != '\0' && isLowercaseName(table->name) &&
+          (table->alias == nullptr || isLowercaseName(table->alias)) &&
+          !sameName(table->name, table->alias) &&
+          table->minArgs <= table->maxArgs && table->maxArgs <= MAX_COMMAND_ARGS &&
+          rangesValid(table->ranges, table->maxArgs) &&
+          table->handler != nullptr &&
+          !nameTaken(table + 1, count - 1, table->name) &&
+          (table->alias == nullptr || !nameTaken(table + 1, count - 1, table->alias)) &&
+          tableValid(table + 1, count - 1));
+}
+
+CommandProcessor::CommandProcessor(MovementController* moveCtrl, SensorManager* sensMgr,
+                                   LoopWatchdog* loopWatchdog, ScanCapture* scan, IntentFilter* intent,
+                                   IdleScheduler* idle, SweepMapper* mapper, MissionVm* mission,
+                                   SerialReceiver* receiver, SpeedGovernor* governor,
+                                   StateCheckpoint* checkpoint, TurnCalibrator* calibrator) {
   movementCtrl = moveCtrl;
   sensorMgr = sensMgr;
-  btMgr = bluetoothMgr;
+  watchdog = loopWatchdog;
+  scanCapture = scan;
+  intentFilter = intent;
+  idleScheduler = idle;
+  sweepMapper = mapper;
+  missionVm = mission;
+  serialReceiver = receiver;
+  speedGovernor = governor;
+  stateCheckpoint = checkpoint;
+  turnCalibrator = calibrator;
+  inputLength = 0;
+  discardingLine = false;
+  overlongLines = 0;
+  sequenceHead = 0;
+  sequenceCount = 0;
+  sequencedCommands = 0;
+  duplicateCommands = 0;
+  lineArrivalMicros = 0;
+  commandArrivalMicros = 0;
+  parseDoneMicros = 0;
 }
 
-CommandProcessor::ParsedCommand CommandProcessor::parseCommand(const String& cmd) {
-  ParsedCommand result = {CMD_UNKNOWN, 0, 0, false};
+const CommandProcessor::CommandSpec* CommandProcessor::findCommand(const char* name) {
+  static_assert(tableValid(commandTable, commandCount),
+                "command table has a duplicate or non-lowercase name, or an invalid argument count or range");
   
-  if (cmd.length() == 0) {
-    return result;
+  for (int i = 0; i < commandCount; i++) {
+    const CommandSpec* spec = &commandTable[i];
+    if (strcmp(name, spec->name) == 0 || (spec->alias != nullptr && strcmp(name, spec->alias) == 0)) {
+      return spec;
+    }
   }
+  return nullptr;
+}
+
+bool CommandProcessor::parseArgs(const CommandSpec* spec, char* params, CommandArgs* args) {
+  args->count = 0;
+  args->flag = false;
   
-  // Create lowercase version of command for case-insensitive matching
-  String lowerCmd = cmd;
-  lowerCmd.toLowerCase();
-  
-  // Check for simple commands first
-  if (lowerCmd.equals("help")) {
-    result.type = CMD_HELP;
-    return result;
+  while (params != nullptr && *params != '\0') {
+    // Isolate the next space-separated word
+    while (*params == ' ') {
+      params++;
+    }
+    if (*params == '\0') {
+      break;
+    }
+    char* word = params;
+    while (*params != '\0' && *params != ' ') {
+      params++;
+    }
+    if (*params == ' ') {
+      *params++ = '\0';
+    }
+    
+    bool numeric = spec->kind == ARGS_INT || spec->kind == ARGS_INT_TAIL || spec->kind == ARGS_INT_TOKEN;
+    if (args->count < MAX_COMMAND_ARGS) {
+      args->words[args->count] = word;
+    }
+    if (spec->kind == ARGS_FLAG && args->count == 0 && (strcmp(word, "on") == 0 || strcmp(word, "off") == 0)) {
+      args->flag = strcmp(word, "on") == 0;
+    } else if (spec->kind == ARGS_INT_TOKEN && args->count == spec->maxArgs - 1) {
+      args->values[args->count] = 0;
+    } else if (numeric && args->count < spec->maxArgs) {
+      char* end;
+      errno = 0;
+      long value = strtol(word, &end, 10);
+      if (*end != '\0' || errno == ERANGE || value < INT_MIN || value > INT_MAX) {
+        printUsage(spec);
+        return false;
+      }
+      args->values[args->count] = (int)value;
+    } else {
+      printUsage(spec);
+      return false;
+    }
+    args->count++;
   }
-  else if (lowerCmd.equals("ping")) {
-    result.type = CMD_PING;
-    return result;
+  
+  if (args->count < spec->minArgs) {
+    printUsage(spec);
+    return false;
   }
-  else if (lowerCmd.equals("status")) {
-    result.type = CMD_STATUS;
-    return result;
+  
+  // A short form leaves out the leading or trailing arguments of the longest one
+  int first = spec->kind == ARGS_INT_TAIL ? spec->maxArgs - args->count : 0;
+  for (int i = 0; i < args->count; i++) {
+    const ArgRange& range = spec->ranges[first + i];
+    if (spec->kind == ARGS_INT_TOKEN && i == spec->maxArgs - 1) {
+      continue;
+    }
+    if (args->values[i] < range.min || args->values[i] > range.max) {
+      printUsage(spec);
+      MessageManager::sendF("%d is outside %d to %d", args->values[i], range.min, range.max);
+      return false;
+    }
   }
-  else if (lowerCmd.equals("distance")) {
-    result.type = CMD_DISTANCE;
-    return result;
+  return true;
+}
+
+void CommandProcessor::printUsage(const CommandSpec* spec) {
+  MessageManager::sendF("Usage: %s%s%s", spec->name, spec->usage[0] != '\0' ? " " : "", spec->usage);
+}
+
+bool CommandProcessor::processCommand(const char* command, unsigned long arrivalMicros) {
+  TRACE_SCOPE("CommandProcessor::processCommand");
+  commandArrivalMicros = arrivalMicros;
+  
+  // Trim leading and trailing whitespace into a local copy
+  while (isspace(*command)) {
+    command++;
   }
-  else if (lowerCmd.equals("stop") || lowerCmd.equals("s")) {
-    result.type = CMD_STOP;
-    return result;
+  char cmd[MAX_COMMAND_LENGTH + 1];
+  strncpy(cmd, command, MAX_COMMAND_LENGTH);
+  cmd[MAX_COMMAND_LENGTH] = '\0';
+  int length = strlen(cmd);
+  while (length > 0 && isspace(cmd[length - 1])) {
+    cmd[--length] = '\0';
   }
   
-  // Check for commands with no parameters
-  if (lowerCmd.equals("forward") || lowerCmd.equals("f")) {
-    result.type = CMD_FORWARD;
-    return result;
+  // Ignore empty commands
+  if (length == 0) {
+    return false;
   }
   
-  if (lowerCmd.equals("backward") || lowerCmd.equals("b")) {
-    result.type = CMD_BACKWARD;
-    return result;
+  // Look the name up before echoing, so commands that answer first can skip the echo
+  char name[MAX_COMMAND_LENGTH + 1];
+  int nameLength = 0;
+  while (cmd[nameLength] != '\0' && cmd[nameLength] != ' ') {
+    name[nameLength] = tolower(cmd[nameLength]);
+    nameLength++;
   }
+  name[nameLength] = '\0';
+  const CommandSpec* spec = findCommand(name);
   
-  // For commands with parameters
-  int spaceIndex = lowerCmd.indexOf(' ');
-  if (spaceIndex <= 0) {
-    return result; // No space found or space at beginning
+  if (spec == nullptr || spec->echo) {
+    MessageManager::sendF("Command received: %s", cmd);
+  }
+  if (spec == nullptr) {
+    MessageManager::send("Unknown command. Type 'help' for available commands.");
+    return false;
   }
   
-  String cmdName = lowerCmd.substring(0, spaceIndex);
-  String params = lowerCmd.substring(spaceIndex + 1);
+  // Arguments match case-insensitively too
+  for (int i = nameLength; i < length; i++) {
+    cmd[i] = tolower(cmd[i]);
+  }
+  char* params = cmd[nameLength] == ' ' ? cmd + nameLength + 1 : nullptr;
   
-  if (cmdName.equals("forward") || cmdName.equals("f")) {
-    result.type = CMD_FORWARD;
-    
-    // Check for second parameter
-    int secondSpaceIndex = params.indexOf(' ');
-    if (secondSpaceIndex > 0) {
-      // Two parameters: speed and duration
-      result.param1 = params.substring(0, secondSpaceIndex).toInt();
-      result.param2 = params.substring(secondSpaceIndex + 1).toInt();
-    } else {
-      // One parameter: duration (using global speed)
-      result.param1 = params.toInt();
-    }
+  CommandArgs args;
+  if (!parseArgs(spec, params, &args)) {
+    return false;
   }
-  else if (cmdName.equals("backward") || cmdName.equals("b")) {
-    result.type = CMD_BACKWARD;
-    
-    // Check for second parameter
-    int secondSpaceIndex = params.indexOf(' ');
-    if (secondSpaceIndex > 0) {
-      // Two parameters: speed and duration
-      result.param1 = params.substring(0, secondSpaceIndex).toInt();
-      result.param2 = params.substring(secondSpaceIndex + 1).toInt();
-    } else {
-      // One parameter: duration (using global speed)
-      result.param1 = params.toInt();
-    }
+  parseDoneMicros = micros();
+  (this->*spec->handler)(args);
+  return true;
+}
+
+void CommandProcessor::handleHelp(const CommandArgs& args) {
+  printHelpInfo();
+}
+
+void CommandProcessor::handleForward(const CommandArgs& args) {
+  missionVm->abort("manual command");
+  if (args.count == 2) {
+    // Specific speed and duration
+    movementCtrl->moveForwardWithSpeed(args.values[0], args.values[1]);
+  } else if (args.count == 1) {
+    // Global speed with this duration
+    movementCtrl->moveForward(args.values[0]);
+  } else {
+    movementCtrl->moveForward();
   }
-  else if (cmdName.equals("turn")) {
-    result.type = CMD_TURN;
-    result.param1 = params.toInt();
+}
+
+void CommandProcessor::handleBackward(const CommandArgs& args) {
+  missionVm->abort("manual command");
+  if (args.count == 2) {
+    // Specific speed and duration
+    movementCtrl->moveBackwardWithSpeed(args.values[0], args.values[1]);
+  } else if (args.count == 1) {
+    // Global speed with this duration
+    movementCtrl->moveBackward(args.values[0]);
+  } else {
+    movementCtrl->moveBackward();
   }
-  else if (cmdName.equals("speed")) {
-    result.type = CMD_SPEED;
-    result.param1 = params.toInt();
+}
+
+void CommandProcessor::handleStop(const CommandArgs& args) {
+  missionVm->abort("stop");
+  movementCtrl->stop();
+}
+
+void CommandProcessor::handleEstop(const CommandArgs& args) {
+  if (args.flag) {
+    missionVm->abort("emergency stop");
+    movementCtrl->emergencyStop();
+    movementCtrl->takeEmergencyStop();
+  } else {
+    movementCtrl->clearEmergencyStop();
   }
-  else if (cmdName.equals("avoid")) {
-    result.type = CMD_AVOID;
-    result.flagValue = params.equals("on");
+}
+
+void CommandProcessor::handleTurn(const CommandArgs& args) {
+  missionVm->abort("manual command");
+  movementCtrl->turnByDegrees(args.values[0], args.count == 2 ? args.values[1] : TURN_SPEED);
+}
+
+void CommandProcessor::handleDrive(const CommandArgs& args) {
+  if (args.count == 1 && args.values[0] == 0) {
+    movementCtrl->disableSetpoints();
+    return;
   }
-  else if (cmdName.equals("debug")) {
-    result.type = CMD_DEBUG;
-    result.flagValue = params.equals("on");
+  missionVm->abort("setpoint mode");
+  movementCtrl->enableSetpoints(args.count == 1 ? args.values[0] : SETPOINT_TIMEOUT_MS);
+}
+
+void CommandProcessor::handleSetpointFrame(const char* frame) {
+  char* end;
+  long linear = strtol(frame, &end, 10);
+  if (end == frame || *end != ' ') {
+    return;  // Malformed frames are dropped; the dead-man stops the car if they keep coming
   }
-  
-  return result;
+  const char* turnText = end;
+  long turn = strtol(turnText, &end, 10);
+  if (end == turnText || *end != '\0') {
+    return;
+  }
+  movementCtrl->applySetpoint(linear, turn, millis());
 }
 
-void CommandProcessor::processCommand(const String& command) {
-  // Ignore empty commands
-  if (command.length() == 0) {
+void CommandProcessor::handleSequencedLine(char* line) {
+  // "#<seq> <command>": seq is 1-65535 and a single space separates it from the command
+  char* end = nullptr;
+  long seq = strtol(line + 1, &end, 10);
+  if (end == line + 1 || *end != ' ' || end[1] == '\0' || seq < 1 || seq > 65535) {
+    MessageManager::send("Error: expected '#<seq> <command>' with seq 1-65535");
     return;
   }
   
-  String cmd = command;
-  cmd.trim();
+  // A host that lost the ack to a reset sends the command again; running it twice could
+  // repeat a move, so only the acknowledgement is repeated
+  for (int i = 0; i < sequenceCount; i++) {
+    if (recentSequences[i] == seq) {
+      duplicateCommands++;
+      MessageManager::sendF("ack %ld dup", seq);
+      return;
+    }
+  }
   
-  MessageManager::send("Command received: " + cmd);
+  // A rejected command did not run, so its number stays free for the corrected line
+  if (!processCommand(end + 1, lineArrivalMicros)) {
+    MessageManager::sendF("nak %ld", seq);
+    return;
+  }
+  recentSequences[sequenceHead] = (uint16_t)seq;
+  sequenceHead = (sequenceHead + 1) % CHECKPOINT_SEQUENCES;
+  if (sequenceCount < CHECKPOINT_SEQUENCES) {
+    sequenceCount++;
+  }
+  sequencedCommands++;
+  MessageManager::sendF("ack %ld", seq);
+}
+
+int CommandProcessor::getRecentSequences(uint16_t* sequences) const {
+  int oldest = (sequenceHead - sequenceCount + CHECKPOINT_SEQUENCES) % CHECKPOINT_SEQUENCES;
+  for (int i = 0; i < sequenceCount; i++) {
+    sequences[i] = recentSequences[(oldest + i) % CHECKPOINT_SEQUENCES];
+  }
+  return sequenceCount;
+}
+
+void CommandProcessor::restoreSequences(const uint16_t* sequences, int count) {
+  sequenceCount = 0;
+  sequenceHead = 0;
+  for (int i = 0; i < count && i < CHECKPOINT_SEQUENCES; i++) {
+    recentSequences[sequenceHead] = sequences[i];
+    sequenceHead = (sequenceHead + 1) % CHECKPOINT_SEQUENCES;
+    sequenceCount++;
+  }
+}
+
+void CommandProcessor::handleSpeed(const CommandArgs& args) {
+  movementCtrl->setSpeed(args.values[0]);
+}
+
+void CommandProcessor::handleDistance(const CommandArgs& args) {
+  if (sensorMgr->isSensorFailed()) {
+    MessageManager::send("Current distance: unavailable, sensor failed");
+    return;
+  }
+  int validDistance = sensorMgr->getValidDistance();
+  MessageManager::sendF("Current distance: %d cm", validDistance);
+}
+
+void CommandProcessor::handleAvoid(const CommandArgs& args) {
+  sensorMgr->setAvoidanceEnabled(args.flag);
+  MessageManager::sendF("Obstacle avoidance %s", args.flag ? "enabled" : "disabled");
+}
+
+void CommandProcessor::handleGovern(const CommandArgs& args) {
+  speedGovernor->setEnabled(args.flag);
+  if (!args.flag) {
+    MessageManager::send("Speed governor disabled");
+    return;
+  }
+  MessageManager::sendF("Speed governor enabled: forward speed falls inside %d cm, avoidance below %d cm",
+                        GOVERNOR_SLOW_CM, speedGovernor->floorDistance(sensorMgr->getObstacleDistance()));
+  if (!sensorMgr->isAvoidanceEnabled()) {
+    MessageManager::send("It takes effect once obstacle avoidance is enabled");
+  }
+}
+
+#if FEATURE_DIAGNOSTICS
+void CommandProcessor::handleDebug(const CommandArgs& args) {
+  sensorMgr->setDebugEnabled(args.flag);
+  MessageManager::sendF("Debug mode %s", args.flag ? "enabled" : "disabled");
+}
+#endif
+
+#if FEATURE_SCAN
+void CommandProcessor::handleScan(const CommandArgs& args) {
+  if (args.count == 1 && args.values[0] == 0) {
+    scanCapture->abort();
+    return;
+  }
+  if (scanCapture->isActive()) {
+    MessageManager::send("Scan already running. Send 'scan 0' to abort it.");
+    return;
+  }
   
-  ParsedCommand parsed = parseCommand(cmd);
+  // Characterize the sensor standing still
+  movementCtrl->stop();
+  scanCapture->start(args.count == 1 ? args.values[0] : 0);
+}
+#endif
+
+#if FEATURE_CALIBRATION
+void CommandProcessor::handleCalibrate(const CommandArgs& args) {
+  if (turnCalibrator->isActive()) {
+    MessageManager::send("Calibration already running. Send 'stop' to abort it.");
+    return;
+  }
+  if (scanCapture->isActive()) {
+    MessageManager::send("Scan running; calibrate once it has finished");
+    return;
+  }
+  missionVm->abort("calibration");
+  turnCalibrator->start();
+}
+#endif
+
+#if FEATURE_DIAGNOSTICS
+void CommandProcessor::handleGrid(const CommandArgs& args) {
+  sweepMapper->printStatus();
+}
+#endif
+
+void CommandProcessor::handleIntent(const CommandArgs& args) {
+  if (args.flag) {
+    missionVm->abort("intent stream");
+  }
+  intentFilter->setEnabled(args.flag);
+  MessageManager::sendF("Intent stream %s", args.flag ? "enabled" : "disabled");
+}
+
+#if FEATURE_MISSIONS
+void CommandProcessor::handleMission(const CommandArgs& args) {
+  if (args.count == 0) {
+    missionVm->printStatus();
+  } else if (args.count == 2) {
+    missionVm->beginUpload(args.values[0], args.values[1]);
+  } else {
+    MessageManager::send("Give both the program size and its checksum");
+  }
+}
+
+void CommandProcessor::handleRun(const CommandArgs& args) {
+  missionVm->start();
+}
+#endif
+
+void CommandProcessor::handlePing(const CommandArgs& args) {
+  if (args.count == 0) {
+    MessageManager::send("pong");
+    return;
+  }
   
-  switch (parsed.type) {
-    case CMD_HELP:
-      printHelpInfo();
-      break;
-      
-    case CMD_FORWARD:
-      if (parsed.param2 > 0) {
-        // Two parameters provided: specific speed and duration
-        movementCtrl->moveForwardWithSpeed(parsed.param1, parsed.param2);
-      } else if (parsed.param1 > 0) {
-        // One parameter: use global speed with this duration
-        movementCtrl->moveForward(parsed.param1);
-      } else {
-        // No parameters: move forward at global speed
-        movementCtrl->moveForward();
-      }
-      break;
-      
-    case CMD_BACKWARD:
-      if (parsed.param2 > 0) {
-        // Two parameters provided: specific speed and duration
-        movementCtrl->moveBackwardWithSpeed(parsed.param1, parsed.param2);
-      } else if (parsed.param1 > 0) {
-        // One parameter: use global speed with this duration
-        movementCtrl->moveBackward(parsed.param1);
-      } else {
-        // No parameters: move backward at global speed
-        movementCtrl->moveBackward();
-      }
-      break;
-      
-    case CMD_STOP:
-      movementCtrl->stop();
-      break;
-      
-    case CMD_TURN:
-      movementCtrl->turnByDegrees(parsed.param1);
-      break;
-      
-    case CMD_SPEED:
-      if (parsed.param1 > 0) {
-        movementCtrl->setSpeed(parsed.param1);
-      } else {
-        MessageManager::send("Invalid speed value. Please specify a positive number.");
-      }
-      break;
-      
-    case CMD_DISTANCE:
-      {
-        int validDistance = sensorMgr->getValidDistance();
-        MessageManager::send("Current distance: " + String(validDistance) + " cm");
-      }
-      break;
-      
-    case CMD_AVOID:
-      sensorMgr->setAvoidanceEnabled(parsed.flagValue);
-      MessageManager::send("Obstacle avoidance " + String(parsed.flagValue ? "enabled" : "disabled"));
-      break;
-      
-    case CMD_DEBUG:
-      sensorMgr->setDebugEnabled(parsed.flagValue);
-      MessageManager::send("Debug mode " + String(parsed.flagValue ? "enabled" : "disabled"));
-      break;
-      
-    case CMD_PING:
-      MessageManager::send("pong");
-      break;
-      
-    case CMD_STATUS:
-      MessageManager::send("Connection: " + String(MessageManager::isConnected() ? "Connected" : "Disconnected"));
-      MessageManager::send("Current speed: " + String(movementCtrl->getSpeed()));
-      MessageManager::send("Obstacle avoidance: " + String(sensorMgr->isAvoidanceEnabled() ? "Enabled" : "Disabled"));
-      MessageManager::send("Debug mode: " + String(sensorMgr->isDebugEnabled() ? "Enabled" : "Disabled"));
-      break;
-      
-    default:
-      MessageManager::send("Unknown command. Type 'help' for available commands.");
-      break;
+  // Stamps are device micros(): first byte of the line taken off the UART, arguments parsed,
+  // reply handed to the UART. The host pairs them with its own send and receive times; its
+  // timestamp is an opaque word, echoed as sent, so any clock width works.
+  const char* hostTimestamp = args.count == 2 ? args.words[1] : "0";
+  MessageManager::sendF("pong %d %s %lu %lu %lu", args.values[0], hostTimestamp,
+                        commandArrivalMicros, parseDoneMicros, micros());
+}
+
+void CommandProcessor::handleFlow(const CommandArgs& args) {
+  serialReceiver->setFlowControl(args.flag);
+  if (args.flag) {
+    MessageManager::sendF("Flow control on: %d bytes of credit, returned as ~<bytes> every %d bytes read",
+                          SERIAL_RX_QUEUE, FLOW_CREDIT_BATCH);
+  } else {
+    MessageManager::send("Flow control off");
   }
 }
 
+void CommandProcessor::handleStatus(const CommandArgs& args) {
+  MessageManager::sendF("Build profile: %s", BUILD_PROFILE_NAME);
+  MessageManager::sendF("Connection: %s", MessageManager::isConnected() ? "Connected" : "Disconnected");
+  stateCheckpoint->printStatus();
+  MessageManager::sendF("Serial input: %u of %d bytes waiting, %lu dropped, %lu overlong lines",
+                        (unsigned)serialReceiver->waiting(), SERIAL_RX_QUEUE, serialReceiver->getDroppedBytes(),
+                        overlongLines);
+  if (serialReceiver->isFlowControlEnabled()) {
+    MessageManager::sendF("Flow control: on, %lu bytes of credit returned", serialReceiver->getCreditsReturned());
+  } else {
+    MessageManager::send("Flow control: off");
+  }
+  if (sequenceCount > 0) {
+    MessageManager::sendF("Sequenced commands: %lu run, %lu duplicates acknowledged, last #%u", sequencedCommands,
+                          duplicateCommands,
+                          recentSequences[(sequenceHead + CHECKPOINT_SEQUENCES - 1) % CHECKPOINT_SEQUENCES]);
+  }
+  MessageManager::sendF("Current speed: %d", movementCtrl->getSpeed());
+  MessageManager::sendF("Emergency stop: %s (%lu since boot)",
+                        movementCtrl->isEmergencyStopped() ? "LATCHED - send 'estop off'" : "clear",
+                        movementCtrl->getEmergencyStopCount());
+  MessageManager::sendF("Obstacle avoidance: %s", sensorMgr->isAvoidanceEnabled() ? "Enabled" : "Disabled");
+  movementCtrl->printReactionStats();
+  speedGovernor->printStatus();
+  sweepMapper->printTurnTable();
+  MessageManager::sendF("Debug mode: %s", sensorMgr->isDebugEnabled() ? "Enabled" : "Disabled");
+  sensorMgr->printStatus();
+  if (movementCtrl->isSetpointMode()) {
+    MessageManager::sendF("Setpoint mode: Enabled (dead-man %lu ms)", movementCtrl->getSetpointTimeout());
+  } else {
+    MessageManager::send("Setpoint mode: Disabled");
+  }
+  intentFilter->printStatus();
+  missionVm->printStatus();
+  idleScheduler->printStatus();
+}
+
+#if FEATURE_DIAGNOSTICS
+void CommandProcessor::handleMem(const CommandArgs& args) {
+  MemoryMonitor::report();
+}
+
+void CommandProcessor::handleStalls(const CommandArgs& args) {
+  if (args.count == 1) {
+    watchdog->setStallBudget(args.values[0]);
+  }
+  watchdog->report();
+}
+#endif
+
 void CommandProcessor::printHelpInfo() {
   MessageManager::send("Test-bench Car Control Commands:");
   MessageManager::send("---------------------------");
-  MessageManager::send("Speed Control:");
-  MessageManager::send("  speed [value]: Set global speed (50-255)");
-  MessageManager::send("");
-  MessageManager::send("Movement Commands:");
-  MessageManager::send("  forward/f: Move forward at current speed");
-  MessageManager::send("  forward/f [seconds]: Move forward for specified seconds at current speed");
-  MessageManager::send("  forward/f [speed] [seconds]: Move forward at specific speed for specified seconds");
-  MessageManager::send("  backward/b: Move backward at current speed");
-  MessageManager::send("  backward/b [seconds]: Move backward for specified seconds at current speed");
-  MessageManager::send("  backward/b [speed] [seconds]: Move backward at specific speed for specified seconds");
-  MessageManager::send("  stop/s: Stop movement");
-  MessageManager::send("  turn X: Turn by X degrees (positive for right, negative for left)");
-  MessageManager::send("");
-  MessageManager::send("Sensor Commands:");
-  MessageManager::send("  distance: Report current distance from ultrasonic sensor");
-  MessageManager::send("  avoid on/off: Enable/disable obstacle avoidance");
-  MessageManager::send("  debug on/off: Enable/disable sensor debugging information");
-  MessageManager::send("");
-  MessageManager::send("Other Commands:");
-  MessageManager::send("  help: Show this help information");
-  MessageManager::send("  ping: Simple connectivity test");
-  MessageManager::send("  status: Show current system status (includes speed)");
-}
-
-void CommandProcessor::processSerialInput(String& inputBuffer) {
-  while (Serial.available() > 0) {
-    char inChar = (char)Serial.read();
+  
+  const char* section = nullptr;
+  for (int i = 0; i < commandCount; i++) {
+    const CommandSpec* spec = &commandTable[i];
+    if (section == nullptr || strcmp(section, spec->section) != 0) {
+      if (section != nullptr) {
+        MessageManager::send("");
+      }
+      MessageManager::sendF("%s:", spec->section);
+      section = spec->section;
+    }
+    MessageManager::sendF("  %s%s%s%s%s%s%s", spec->name,
+                          spec->alias != nullptr ? "/" : "", spec->alias != nullptr ? spec->alias : "",
+                          spec->usage[0] != '\0' ? " " : "", spec->usage,
+                          spec->description[0] != '\0' ? ": " : "", spec->description);
+  }
+}
+
+void CommandProcessor::processSerialInput() {
+  // Only what was waiting on entry: a host refilling the ring as fast as replies drain it must
+  // not hold the loop in this stage
+  size_t budget = serialReceiver->waiting();
+  char inChar;
+  unsigned long arrivalMicros;
+  while (budget-- > 0 && serialReceiver->read(inChar, &arrivalMicros)) {
     if (inChar == '\n' || inChar == '\r') {
-      if (inputBuffer.length() > 0) {
-        processCommand(inputBuffer);
-        inputBuffer = "";
+      if (discardingLine) {
+        // Running what is left of a line could do something else entirely, so none of it runs
+        overlongLines++;
+        MessageManager::sendF("Error: line longer than %d characters dropped", MAX_COMMAND_LENGTH);
+        discardingLine = false;
+        inputLength = 0;
+      } else if (inputLength > 0) {
+        inputBuffer[inputLength] = '\0';
+        idleScheduler->lineDispatched();
+        // Stream frames skip the echo and the command table; they arrive at up to 100 Hz
+        if (inputBuffer[0] == '@') {
+          intentFilter->processFrame(inputBuffer + 1, millis());
+        } else if (inputBuffer[0] == '>') {
+          handleSetpointFrame(inputBuffer + 1);
+#if FEATURE_MISSIONS
+        } else if (inputBuffer[0] == '$') {
+          missionVm->receiveChunk(inputBuffer + 1);
+#endif
+        } else if (inputBuffer[0] == '#') {
+          handleSequencedLine(inputBuffer);
+        } else {
+          processCommand(inputBuffer, lineArrivalMicros);
+        }
+        inputLength = 0;
       }
+    } else if (inputLength == MAX_COMMAND_LENGTH) {
+      discardingLine = true;
     } else {
-      inputBuffer += inChar;
+      if (inputLength == 0) {
+        lineArrivalMicros = arrivalMicros;
+      }
+      inputBuffer[inputLength++] = inChar;
     }
   }
+  
+  unsigned long credits = serialReceiver->takeCredits();
+  if (credits > 0) {
+    MessageManager::sendF("~%lu", credits);
+  }
 }
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include "../include/idle_scheduler.h"
+#include "../include/message_manager.h"
+#include "../include/serial_receiver.h"
+
+IdleScheduler::IdleScheduler() {
+  loopTask = nullptr;
+  serialReceiver = nullptr;
+  receiveMicros = 0;
+  wokeBySerial = false;
+  latencyPending = false;
+  startMillis = 0;
+  sleptMicros = 0;
+  sleeps = 0;
+  serialWakes = 0;
+  maxWakeLatency = 0;
+  wakesOverBudget = 0;
+}
+
+void IdleScheduler::init(SerialReceiver* receiver) {
+  loopTask = xTaskGetCurrentTaskHandle();
+  serialReceiver = receiver;
+  startMillis = millis();
+}
+
+void IdleScheduler::onSerialReceive() {
+  if (loopTask != nullptr) {
+    xTaskNotifyGive(loopTask);
+  }
+}
+
+void IdleScheduler::sleepFor(unsigned long waitMillis) {
+  if (loopTask == nullptr || waitMillis < IDLE_MIN_SLEEP_MS) {
+    return;
+  }
+  if (waitMillis > IDLE_MAX_SLEEP_MS) {
+    waitMillis = IDLE_MAX_SLEEP_MS;
+  }
+  
+  // The callback notifies for every batch, awake or not: drop what piled up while the loop ran,
+  // then look for input, which a batch landing after the clear would have queued
+  ulTaskNotifyTake(pdTRUE, 0);
+  if (serialReceiver == nullptr || serialReceiver->available()) {
+    return;
+  }
+  unsigned long start = micros();
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMillis));
+  sleptMicros += micros() - start;
+  sleeps++;
+  
+  // The ring was empty going to sleep, so its first byte is what cut the sleep short
+  if (serialReceiver->nextArrival(&receiveMicros)) {
+    serialWakes++;
+    wokeBySerial = true;
+    latencyPending = true;
+  }
+}
+
+bool IdleScheduler::consumeSerialWake() {
+  bool woke = wokeBySerial;
+  wokeBySerial = false;
+  return woke;
+}
+
+void IdleScheduler::lineDispatched() {
+  if (!latencyPending) {
+    return;
+  }
+  latencyPending = false;
+  
+  unsigned long latency = micros() - receiveMicros;
+  if (latency > maxWakeLatency) {
+    maxWakeLatency = latency;
+  }
+  if (latency > IDLE_WAKE_BUDGET_US) {
+    wakesOverBudget++;
+  }
+}
+
+void IdleScheduler::commandsServiced() {
+  latencyPending = false;
+}
+
+void IdleScheduler::printStatus() const {
+  unsigned long elapsed = millis() - startMillis;
+  unsigned long idlePercent = elapsed > 0 ? (unsigned long)(sleptMicros / 10 / elapsed) : 0;
+  MessageManager::sendF("Idle: %lu%% asleep, %lu sleeps, %lu serial wakes", idlePercent, sleeps, serialWakes);
+  MessageManager::sendF("Wake-to-command: max %lu us, %lu over the %d us budget",
+                        maxWakeLatency, wakesOverBudget, IDLE_WAKE_BUDGET_US);
+}
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "../include/intent_filter.h"
+#include "../include/message_manager.h"
+
+// Value of one hex digit, or -1
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+IntentFilter::IntentFilter(MovementController* moveCtrl) {
+  movementCtrl = moveCtrl;
+  enabled = false;
+  for (int i = 0; i < INTENT_COUNT; i++) {
+    smoothed[i] = 0;
+  }
+  decision = INTENT_COUNT;
+  candidate = INTENT_COUNT;
+  candidateSince = 0;
+  streaming = false;
+  lastFrameTime = 0;
+  frameCount = 0;
+  rejectedFrames = 0;
+  decisionCount = 0;
+}
+
+void IntentFilter::setEnabled(bool enable) {
+  if (enabled && !enable) {
+    reset("Intent stream disabled");
+  }
+  enabled = enable;
+}
+
+bool IntentFilter::isEnabled() const {
+  return enabled;
+}
+
+bool IntentFilter::processFrame(const char* hex, unsigned long currentTime) {
+  if (!enabled) {
+    rejectedFrames++;
+    return false;
+  }
+  
+  // Decode exactly two hex digits per class
+  float probability[INTENT_COUNT];
+  for (int i = 0; i < INTENT_COUNT; i++) {
+    int high = hexValue(hex[2 * i]);
+    int low = high < 0 ? -1 : hexValue(hex[2 * i + 1]);
+    if (low < 0) {
+      rejectedFrames++;
+      return false;
+    }
+    probability[i] = (high * 16 + low) / 255.0f;
+  }
+  if (hex[2 * INTENT_COUNT] != '\0') {
+    rejectedFrames++;
+    return false;
+  }
+  frameCount++;
+  
+  // Smooth by elapsed time rather than per frame, so 50 and 100 Hz streams behave alike
+  float alpha = 1.0f;
+  if (streaming) {
+    unsigned long elapsed = currentTime - lastFrameTime;
+    alpha = 1.0f - expf(-(float)elapsed / INTENT_SMOOTHING_MS);
+  }
+  streaming = true;
+  lastFrameTime = currentTime;
+  
+  int best = 0;
+  for (int i = 0; i < INTENT_COUNT; i++) {
+    smoothed[i] += alpha * (probability[i] - smoothed[i]);
+    if (smoothed[i] > smoothed[best]) {
+      best = i;
+    }
+  }
+  
+  // Hysteresis: a new class must rise above the enter level while the current one has fallen below the exit level
+  bool qualifies = best != decision && smoothed[best] >= INTENT_ENTER_LEVEL &&
+                   (decision == INTENT_COUNT || smoothed[decision] <= INTENT_EXIT_LEVEL);
+  if (!qualifies) {
+    candidate = INTENT_COUNT;
+    return true;
+  }
+  
+  // Dwell: it must stay qualified for a while before the car reacts
+  if (candidate != best) {
+    candidate = best;
+    candidateSince = currentTime;
+  }
+  if (currentTime - candidateSince >= INTENT_DWELL_MS) {
+    decision = best;
+    candidate = INTENT_COUNT;
+    decisionCount++;
+    act(decision);
+  }
+  return true;
+}
+
+void IntentFilter::update(unsigned long currentTime) {
+  if (streaming && currentTime - lastFrameTime > INTENT_TIMEOUT_MS) {
+    reset("Intent stream lost");
+  }
+}
+
+void IntentFilter::reset(const char* reason) {
+  if (decision != INTENT_COUNT && decision != INTENT_REST) {
+    MessageManager::sendF("%s - stopping", reason);
+    movementCtrl->stop();
+  }
+  for (int i = 0; i < INTENT_COUNT; i++) {
+    smoothed[i] = 0;
+  }
+  decision = INTENT_COUNT;
+  candidate = INTENT_COUNT;
+  streaming = false;
+}
+
+void IntentFilter::act(int intent) {
+  MessageManager::sendF("Intent: %s", intentName(intent));
+  
+  switch (intent) {
+    case INTENT_FORWARD:
+      movementCtrl->moveForward();
+      break;
+    case INTENT_BACKWARD:
+      movementCtrl->moveBackward();
+      break;
+    case INTENT_LEFT:
+      movementCtrl->rotate(false);
+      break;
+    case INTENT_RIGHT:
+      movementCtrl->rotate(true);
+      break;
+    default:
+      movementCtrl->stop();
+      break;
+  }
+}
+
+void IntentFilter::printStatus() const {
+  MessageManager::sendF("Intent stream: %s, %lu frames, %lu rejected, %lu decisions, current %s",
+                        enabled ? "Enabled" : "Disabled", frameCount, rejectedFrames, decisionCount,
+                        decision == INTENT_COUNT ? "none" : intentName(decision));
+}
+
+const char* IntentFilter::intentName(int intent) {
+  switch (intent) {
+    case INTENT_REST:     return "rest";
+    case INTENT_FORWARD:  return "forward";
+    case INTENT_BACKWARD: return "backward";
+    case INTENT_LEFT:     return "left";
+    case INTENT_RIGHT:    return "right";
+    default:              return "none";
+  }
+}
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "../include/led_manager.h"
+#include "../include/trace.h"
 
 LedManager::LedManager() {
   rightLedState = false;
@@ -17,6 +18,8 @@ void LedManager::init() {
 }
 
 void LedManager::updateStatus(unsigned long currentTime, bool isConnected) {
+  TRACE_SCOPE("LedManager::updateStatus");
+  
   // Right LED - Connection Status
   if (isConnected) {
     // Connected - solid right LED
@@ -110,4 +113,34 @@ void LedManager::setLeftLedStatus(LedStatus status) {
 
 LedStatus LedManager::getCurrentLeftLedStatus() const {
   return currentLeftLedStatus;
+}
+
+// Time left before a blink interval measured from lastBlink runs out
+static unsigned long blinkRemaining(unsigned long currentTime, unsigned long lastBlink, unsigned long interval) {
+  unsigned long elapsed = currentTime - lastBlink;
+  return elapsed >= interval ? 0 : interval - elapsed;
+}
+
+unsigned long LedManager::millisUntilChange(unsigned long currentTime, bool isConnected) const {
+  unsigned long wait = ULONG_MAX;
+  if (!isConnected) {
+    wait = blinkRemaining(currentTime, lastRightBlinkTime, CONNECTION_BLINK_INTERVAL);
+  }
+  
+  unsigned long leftWait = ULONG_MAX;
+  switch (currentLeftLedStatus) {
+    case LED_BACKWARD:
+      leftWait = blinkRemaining(currentTime, lastLeftBlinkTime, MOVEMENT_BLINK_INTERVAL);
+      break;
+    case LED_TURNING:
+    case LED_ERROR:
+      leftWait = blinkRemaining(currentTime, lastLeftBlinkTime, FAST_BLINK_INTERVAL);
+      break;
+    case LED_OBSTACLE:
+      leftWait = blinkRemaining(currentTime, lastLeftBlinkTime, OBSTACLE_BLINK_INTERVAL);
+      break;
+    default:
+      break;  // Idle and forward are steady
+  }
+  return leftWait < wait ? leftWait : wait;
 }
\ No newline at end of file
@@ -1,6 +1,9 @@
 #include "ultrasonic.h"
 #include "Arduino.h"
 
+// The sensor raises its echo line about 0.5 ms after the trigger, once its burst is out
+static const unsigned long ECHO_START_SLACK_US = 500;
+
 void ultrasonic::Init(int trigPin, int echoPin)
 {
     _trigPin = trigPin;
@@ -23,18 +26,8 @@ float ultrasonic::Ranging()
     float distance = 0;
     
     for (int attempt = 0; attempt < maxAttempts; attempt++) {
-        // Clear the trigger
-        digitalWrite(_trigPin, LOW);
-        delayMicroseconds(5);
-        
-        // Set trigger HIGH for 10 microseconds
-        digitalWrite(_trigPin, HIGH);
-        delayMicroseconds(10);
-        digitalWrite(_trigPin, LOW);
-        
-        // Read the echo pulse with a timeout
         // 30ms timeout corresponds to ~5 meters which is a reasonable maximum
-        unsigned long duration = pulseIn(_echoPin, HIGH, 30000);
+        unsigned long duration = Ping(30000);
         
         // Calculate distance if we received a valid pulse
         if (duration > 0) {
@@ -54,4 +47,27 @@ float ultrasonic::Ranging()
     // Return the last calculated distance, even if invalid
     // This allows the calling function to decide how to handle errors
     return distance;
+}
+
+float ultrasonic::Ranging(int maxDistanceCm)
+{
+    // Round trip of maxDistanceCm at 343 m/s; a missing echo is the answer, so no retry
+    unsigned long timeout = (unsigned long)(maxDistanceCm * 2 / 0.0343) + ECHO_START_SLACK_US;
+    unsigned long duration = Ping(timeout);
+    return duration * 0.0343 / 2;
+}
+
+unsigned long ultrasonic::Ping(unsigned long timeoutMicros)
+{
+    // Clear the trigger
+    digitalWrite(_trigPin, LOW);
+    delayMicroseconds(5);
+    
+    // Set trigger HIGH for 10 microseconds
+    digitalWrite(_trigPin, HIGH);
+    delayMicroseconds(10);
+    digitalWrite(_trigPin, LOW);
+    
+    // Read the echo pulse with a timeout
+    return pulseIn(_echoPin, HIGH, timeoutMicros);
 }
\ No newline at end of file
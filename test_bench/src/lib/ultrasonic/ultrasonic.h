@@ -8,6 +8,11 @@ class ultrasonic
      public: 
           void Init(int trigPin, int echoPin); 
           float Ranging();
+          // Range-gated reading: one ping that waits only as long as an echo from maxDistanceCm
+          // takes to return; 0 when nothing is that close
+          float Ranging(int maxDistanceCm);
+          // Fire one ping and return the raw echo pulse width in microseconds (0 on timeout)
+          unsigned long Ping(unsigned long timeoutMicros);
      private:
           int _trigPin;
           int _echoPin;
@@ -12,12 +12,24 @@ void vehicle::Init()
 }
 
 void vehicle::Move(int Dir, int Speed) 
+{
+    Drive(Dir, Speed, Speed);
+}
+
+void vehicle::Drive(int Dir, int LeftSpeed, int RightSpeed) 
 {
     digitalWrite(EN_PIN, LOW);
-    analogWrite(PWM1_PIN, Speed);
-    analogWrite(PWM2_PIN, Speed);
+    analogWrite(PWM1_PIN, LeftSpeed);
+    analogWrite(PWM2_PIN, RightSpeed);
 
     digitalWrite(STCP_PIN, LOW);
     shiftOut(DATA_PIN, SHCP_PIN, MSBFIRST, Dir);
     digitalWrite(STCP_PIN, HIGH);
 }
+
+void vehicle::Disable() 
+{
+    analogWrite(PWM1_PIN, 0);
+    analogWrite(PWM2_PIN, 0);
+    digitalWrite(EN_PIN, HIGH);
+}
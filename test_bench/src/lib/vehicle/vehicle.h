@@ -39,6 +39,8 @@ class vehicle
      public: 
           void Init();        
           void Move(int Dir, int Speed);
+          void Drive(int Dir, int LeftSpeed, int RightSpeed);   // PWM1 drives M1/M2, PWM2 drives M3/M4
+          void Disable();     // PWM off and shift register outputs off; leaves the latched direction alone
      private:
           
 };
@@ -0,0 +1,209 @@
+#include "../include/loop_watchdog.h"
+#include "../include/message_manager.h"
+#include "../include/trace.h"
+#include <esp_attr.h>
+#include <esp_system.h>
+
+// Marks the RTC block as written by this firmware; anything else is power-on noise
+static const uint32_t POST_MORTEM_MAGIC = 0x57444731;
+
+// Post-mortem state kept in RTC memory, which a soft reset does not clear
+struct PostMortem {
+  uint32_t magic;
+  uint32_t resets;           // Resets survived since power-on
+  uint8_t stage;             // Stage at the last checkpoint
+  uint8_t resetReason;       // Reason for the reset being recovered, until the next one
+  uint16_t head;             // Next record slot to write
+  uint16_t count;
+  uint32_t stageStartMillis;
+  StallRecord records[STALL_LOG_SIZE];
+};
+
+RTC_NOINIT_ATTR static PostMortem postMortem;
+
+const char* LoopWatchdog::resetReasonName(uint8_t reason) {
+  switch (reason) {
+    case ESP_RST_POWERON:  return "power-on";
+    case ESP_RST_EXT:      return "external pin";
+    case ESP_RST_SW:       return "software restart";
+    case ESP_RST_PANIC:    return "panic";
+    case ESP_RST_INT_WDT:  return "interrupt watchdog";
+    case ESP_RST_TASK_WDT: return "task watchdog";
+    case ESP_RST_WDT:      return "watchdog";
+    case ESP_RST_BROWNOUT: return "brownout";
+    default:               return "other";
+  }
+}
+
+LoopWatchdog::LoopWatchdog() {
+  stallBudgetMicros = LOOP_STALL_BUDGET_MS * 1000UL;
+  stage = STAGE_IDLE;
+  stageStart = 0;
+  stageSerialStart = 0;
+  loopStart = 0;
+  loopSerialStart = 0;
+  longestStage = STAGE_IDLE;
+  longestStageMicros = 0;
+  stalledThisLoop = false;
+}
+
+void LoopWatchdog::init() {
+  // RTC memory holds noise after power-on, however plausible it looks
+  bool valid = esp_reset_reason() != ESP_RST_POWERON && postMortem.magic == POST_MORTEM_MAGIC &&
+               postMortem.count <= STALL_LOG_SIZE && postMortem.head < STALL_LOG_SIZE &&
+               postMortem.stage < STAGE_COUNT;
+  
+  if (!valid) {
+    memset(&postMortem, 0, sizeof(postMortem));
+    postMortem.magic = POST_MORTEM_MAGIC;
+  } else {
+    postMortem.resets++;
+    postMortem.resetReason = esp_reset_reason();
+    
+    // A reset mid-iteration leaves the stage it interrupted behind
+    if (postMortem.stage != STAGE_IDLE) {
+      record(STALL_RESET, static_cast<LoopStage>(postMortem.stage), postMortem.stageStartMillis, 0, 0);
+    }
+    if (postMortem.count > 0) {
+      MessageManager::sendF("Recovered %u loop stall records after %s reset - send 'stalls' to list them",
+                            postMortem.count, resetReasonName(postMortem.resetReason));
+    }
+  }
+  postMortem.stage = STAGE_IDLE;
+  
+  // A loop that stops feeding the task watchdog for its timeout resets the board
+  enableLoopWDT();
+}
+
+void LoopWatchdog::beginLoop() {
+  feedLoopWDT();
+  
+  loopStart = micros();
+  loopSerialStart = MessageManager::getWriteMicros();
+  stageStart = loopStart;
+  stageSerialStart = loopSerialStart;
+  longestStage = STAGE_IDLE;
+  longestStageMicros = 0;
+  stalledThisLoop = false;
+}
+
+void LoopWatchdog::enterStage(LoopStage next) {
+  unsigned long now = micros();
+  finishStage(now);
+  
+  stage = next;
+  TRACE_STAGE_BEGIN(stageName(stage));
+  stageStart = now;
+  stageSerialStart = MessageManager::getWriteMicros();
+  
+  // Checkpoint for the next boot in case this stage never returns
+  postMortem.stage = next;
+  postMortem.stageStartMillis = millis();
+}
+
+void LoopWatchdog::endLoop() {
+  unsigned long now = micros();
+  finishStage(now);
+  stage = STAGE_IDLE;
+  postMortem.stage = STAGE_IDLE;
+  
+  // Several stages can add up to a stall without any one of them overrunning
+  unsigned long loopMicros = now - loopStart;
+  if (!stalledThisLoop && loopMicros > stallBudgetMicros) {
+    record(STALL_LOOP, longestStage, millis(), loopMicros, MessageManager::getWriteMicros() - loopSerialStart);
+  }
+}
+
+void LoopWatchdog::finishStage(unsigned long now) {
+  if (stage == STAGE_IDLE) {
+    return;
+  }
+  TRACE_STAGE_END(stageName(stage));
+  
+  unsigned long elapsed = now - stageStart;
+  if (elapsed > longestStageMicros) {
+    longestStage = stage;
+    longestStageMicros = elapsed;
+  }
+  if (elapsed > stallBudgetMicros) {
+    record(STALL_STAGE, stage, millis(), elapsed, MessageManager::getWriteMicros() - stageSerialStart);
+    stalledThisLoop = true;
+  }
+}
+
+void LoopWatchdog::record(StallKind kind, LoopStage stalledStage, uint32_t atMillis,
+                          uint32_t durationMicros, uint32_t serialMicros) {
+  StallRecord& entry = postMortem.records[postMortem.head];
+  entry.atMillis = atMillis;
+  entry.durationMicros = durationMicros;
+  entry.serialMicros = serialMicros;
+  entry.kind = kind;
+  entry.stage = stalledStage;
+  entry.resetReason = kind == STALL_RESET ? postMortem.resetReason : 0;
+  
+  postMortem.head = (postMortem.head + 1) % STALL_LOG_SIZE;
+  if (postMortem.count < STALL_LOG_SIZE) {
+    postMortem.count++;
+  }
+}
+
+void LoopWatchdog::setStallBudget(unsigned long budgetMillis) {
+  if (budgetMillis < 1) {
+    budgetMillis = 1;
+  }
+  stallBudgetMicros = budgetMillis * 1000UL;
+}
+
+unsigned long LoopWatchdog::getStallBudget() const {
+  return stallBudgetMicros / 1000UL;
+}
+
+int LoopWatchdog::getStallCount() const {
+  return postMortem.count;
+}
+
+void LoopWatchdog::report() const {
+  MessageManager::sendF("Stall budget: %lu ms, %u resets since power-on", getStallBudget(), (unsigned)postMortem.resets);
+  if (postMortem.count == 0) {
+    MessageManager::send("No loop stalls recorded");
+    return;
+  }
+  
+  int oldest = (postMortem.head + STALL_LOG_SIZE - postMortem.count) % STALL_LOG_SIZE;
+  for (int i = 0; i < postMortem.count; i++) {
+    const StallRecord& entry = postMortem.records[(oldest + i) % STALL_LOG_SIZE];
+    unsigned long ms = entry.durationMicros / 1000;
+    unsigned long tenths = (entry.durationMicros % 1000) / 100;
+    unsigned long serialMs = entry.serialMicros / 1000;
+    unsigned long serialTenths = (entry.serialMicros % 1000) / 100;
+    
+    switch (entry.kind) {
+      case STALL_STAGE:
+        MessageManager::sendF("  %lu ms: %s took %lu.%lu ms (%lu.%lu ms writing serial)", (unsigned long)entry.atMillis,
+                              stageName(entry.stage), ms, tenths, serialMs, serialTenths);
+        break;
+      case STALL_LOOP:
+        MessageManager::sendF("  %lu ms: loop took %lu.%lu ms, longest in %s (%lu.%lu ms writing serial)",
+                              (unsigned long)entry.atMillis, ms, tenths, stageName(entry.stage), serialMs, serialTenths);
+        break;
+      default:
+        MessageManager::sendF("  %lu ms: %s reset during %s", (unsigned long)entry.atMillis,
+                              resetReasonName(entry.resetReason), stageName(entry.stage));
+        break;
+    }
+  }
+}
+
+const char* LoopWatchdog::stageName(uint8_t stage) {
+  switch (stage) {
+    case STAGE_LEDS:        return "leds";
+    case STAGE_MOTION:      return "motion";
+    case STAGE_MISSION:     return "mission";
+    case STAGE_RANGING:     return "ranging";
+    case STAGE_SCAN:        return "scan";
+    case STAGE_COMMANDS:    return "commands";
+    case STAGE_MOTOR_WRITE: return "motor write";
+    case STAGE_HEARTBEAT:   return "heartbeat";
+    default:                return "idle";
+  }
+}
\ No newline at end of file
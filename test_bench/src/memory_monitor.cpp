@@ -0,0 +1,28 @@
+#include "../include/memory_monitor.h"
+#include "../include/message_manager.h"
+
+// Tasks worth watching on the ESP32 Arduino core; missing ones are skipped
+static const char* const MONITORED_TASKS[] = {
+  "loopTask",
+  "IDLE0",
+  "IDLE1",
+  "esp_timer",
+  "ipc0",
+  "ipc1",
+  "Tmr Svc"
+};
+
+void MemoryMonitor::report() {
+  MessageManager::sendF("Free heap: %u bytes", (unsigned)ESP.getFreeHeap());
+  MessageManager::sendF("Largest free block: %u bytes", (unsigned)ESP.getMaxAllocHeap());
+  MessageManager::sendF("Minimum free heap: %u bytes", (unsigned)ESP.getMinFreeHeap());
+  
+  // High-water mark is the least free stack the task has ever had
+  MessageManager::send("Stack high-water marks:");
+  for (unsigned int i = 0; i < sizeof(MONITORED_TASKS) / sizeof(MONITORED_TASKS[0]); i++) {
+    TaskHandle_t task = xTaskGetHandle(MONITORED_TASKS[i]);
+    if (task != nullptr) {
+      MessageManager::sendF("  %s: %u bytes free", MONITORED_TASKS[i], (unsigned)uxTaskGetStackHighWaterMark(task));
+    }
+  }
+}
\ No newline at end of file
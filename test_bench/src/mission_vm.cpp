@@ -0,0 +1,373 @@
+#include "../include/mission_vm.h"
+#include "../include/message_manager.h"
+#include "../include/trace.h"
+
+#if FEATURE_MISSIONS
+
+static uint16_t readU16(const uint8_t* operand) {
+  return operand[0] | (operand[1] << 8);
+}
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+MissionVm::MissionVm(MovementController* moveCtrl, SensorManager* sensMgr) {
+  movementCtrl = moveCtrl;
+  sensorMgr = sensMgr;
+  length = 0;
+  loaded = false;
+  uploading = false;
+  expectedLength = 0;
+  expectedChecksum = 0;
+  running = false;
+  pc = 0;
+  distance = MISSION_NO_ECHO_CM;
+  lastRangeTime = 0;
+  waitState = WAIT_NONE;
+  waitUntil = 0;
+  moveDirection = MDIR_STOP;
+  moveSpeed = 0;
+  pausedForAvoidance = false;
+  startMillis = 0;
+  instructions = 0;
+  ticks = 0;
+  rangeReadings = 0;
+  memset(counters, 0, sizeof(counters));
+}
+
+void MissionVm::beginUpload(int size, int checksum) {
+  if (size < 1 || size > MISSION_MAX_BYTES) {
+    MessageManager::sendF("Mission size must be 1-%d bytes", MISSION_MAX_BYTES);
+    return;
+  }
+  if (running) {
+    abort("new upload");
+  }
+  
+  uploading = true;
+  loaded = false;
+  length = 0;
+  expectedLength = size;
+  expectedChecksum = checksum;
+  MessageManager::sendF("Mission upload: send %d bytes as '$' hex lines", size);
+}
+
+void MissionVm::receiveChunk(const char* hex) {
+  if (!uploading) {
+    MessageManager::send("No mission upload in progress - send 'mission <bytes> <checksum>' first");
+    return;
+  }
+  
+  for (; hex[0] != '\0'; hex += 2) {
+    int high = hexDigit(hex[0]);
+    int low = hex[1] != '\0' ? hexDigit(hex[1]) : -1;
+    if (high < 0 || low < 0 || length >= expectedLength) {
+      uploading = false;
+      MessageManager::sendF("Mission upload failed: bad hex or too many bytes after %d", length);
+      return;
+    }
+    program[length++] = (high << 4) | low;
+  }
+  if (length < expectedLength) {
+    return;
+  }
+  
+  uploading = false;
+  const char* error = nullptr;
+  if (missionChecksum(program, length) != expectedChecksum) {
+    MessageManager::sendF("Mission upload failed: checksum %u, expected %u",
+                          missionChecksum(program, length), expectedChecksum);
+  } else if (!verify(&error)) {
+    MessageManager::sendF("Mission rejected: %s", error);
+  } else {
+    loaded = true;
+    MessageManager::sendF("Mission loaded: %d bytes - send 'run' to start", length);
+  }
+}
+
+bool MissionVm::verify(const char** error) const {
+  // Mark instruction starts, then check every jump lands on one
+  uint8_t starts[(MISSION_MAX_BYTES + 7) / 8];
+  memset(starts, 0, sizeof(starts));
+  
+  for (int at = 0; at < length; ) {
+    uint8_t size = missionInstructionSize(program[at]);
+    if (size == 0) {
+      *error = "unknown opcode";
+      return false;
+    }
+    if (at + size > length) {
+      *error = "truncated instruction";
+      return false;
+    }
+    starts[at / 8] |= 1 << (at % 8);
+    at += size;
+  }
+  
+  for (int at = 0; at < length; at += missionInstructionSize(program[at])) {
+    const uint8_t* operand = &program[at + 1];
+    int target = -1;
+    switch (program[at]) {
+      case MOP_MOVE:
+        if (operand[0] >= MDIR_COUNT || (operand[1] != 0 && operand[1] < MIN_SPEED)) {
+          *error = "bad move direction or speed";
+          return false;
+        }
+        break;
+      case MOP_JUMP_LT:
+      case MOP_JUMP_GE:
+        target = readU16(operand + 2);
+        break;
+      case MOP_JUMP:
+        target = readU16(operand);
+        break;
+      case MOP_SET_COUNTER:
+      case MOP_LOOP:
+        if (operand[0] >= MISSION_COUNTERS) {
+          *error = "counter out of range";
+          return false;
+        }
+        if (program[at] == MOP_LOOP) {
+          target = readU16(operand + 1);
+        }
+        break;
+      default:
+        break;
+    }
+    if (target >= 0 && (target >= length || !(starts[target / 8] & (1 << (target % 8))))) {
+      *error = "jump into the middle of an instruction or past the end";
+      return false;
+    }
+  }
+  return true;
+}
+
+void MissionVm::start() {
+  if (!loaded) {
+    MessageManager::send("No mission loaded");
+    return;
+  }
+  if (sensorMgr->isSensorFailed()) {
+    MessageManager::send("Mission not started: sensor failed");
+    return;
+  }
+  if (movementCtrl->isEmergencyStopped()) {
+    MessageManager::send("Mission not started: emergency stop latched");
+    return;
+  }
+  
+  running = true;
+  pc = 0;
+  memset(counters, 0, sizeof(counters));
+  distance = MISSION_NO_ECHO_CM;
+  waitState = WAIT_NONE;
+  moveDirection = MDIR_STOP;
+  moveSpeed = 0;
+  pausedForAvoidance = false;
+  startMillis = millis();
+  instructions = 0;
+  ticks = 0;
+  rangeReadings = 0;
+  TRACE_INSTANT("mission: start");
+  MessageManager::sendF("Mission started: %d bytes", length);
+}
+
+void MissionVm::abort(const char* reason) {
+  if (!running) {
+    return;
+  }
+  running = false;
+  TRACE_INSTANT("mission: aborted");
+  MessageManager::sendF("Mission aborted (%s) at byte %d after %lu instructions", reason, pc, instructions);
+}
+
+void MissionVm::finish(const char* outcome) {
+  running = false;
+  TRACE_INSTANT("mission: finished");
+  MessageManager::sendF("Mission %s: %lu instructions over %lu ticks in %lu ms, %lu range readings",
+                        outcome, instructions, ticks, millis() - startMillis, rangeReadings);
+}
+
+bool MissionVm::isRunning() const {
+  return running;
+}
+
+void MissionVm::applyMove(uint8_t direction, uint8_t speed) {
+  moveDirection = direction;
+  moveSpeed = speed;
+  
+  // Without a speed operand, drives take the global speed and spins the turning speed
+  int pwm = speed != 0 ? speed : movementCtrl->getSpeed();
+  int spinPwm = speed != 0 ? speed : TURN_SPEED;
+  
+  switch (direction) {
+    case MDIR_FORWARD:
+      movementCtrl->moveForwardWithSpeed(pwm);
+      break;
+    case MDIR_BACKWARD:
+      movementCtrl->moveBackwardWithSpeed(pwm);
+      break;
+    case MDIR_SPIN_LEFT:
+      movementCtrl->rotate(false, spinPwm);
+      break;
+    case MDIR_SPIN_RIGHT:
+      movementCtrl->rotate(true, spinPwm);
+      break;
+    default:
+      movementCtrl->stop();
+      break;
+  }
+}
+
+void MissionVm::update(unsigned long currentTime) {
+  if (!running) {
+    return;
+  }
+  
+  // Avoidance preempts the mission's moves; pick up where it left off once the maneuver ends
+  if (movementCtrl->isAvoiding()) {
+    pausedForAvoidance = true;
+    return;
+  }
+  if (pausedForAvoidance) {
+    pausedForAvoidance = false;
+    if (moveDirection != MDIR_STOP) {
+      applyMove(moveDirection, moveSpeed);
+    }
+  }
+  
+  if (millisUntilNextStep(currentTime) > 0) {
+    return;
+  }
+  if (waitState == WAIT_MOTION && movementCtrl->getTimedMoveEnd() != 0) {
+    return;
+  }
+  waitState = WAIT_NONE;
+  
+  TRACE_SCOPE("MissionVm::update");
+  ticks++;
+  for (int steps = 0; steps < MISSION_STEPS_PER_TICK && running; steps++) {
+    if (!step(currentTime)) {
+      break;
+    }
+  }
+}
+
+bool MissionVm::step(unsigned long currentTime) {
+  // Running off the end of the program is the same as MOP_END
+  uint8_t op = pc < length ? program[pc] : (uint8_t)MOP_END;
+  
+  // A range reading too soon after the last one waits for a later tick
+  if (op == MOP_RANGE && millisUntilNextStep(currentTime) > 0) {
+    return false;
+  }
+  instructions++;
+  
+  const uint8_t* operand = &program[pc + 1];
+  int next = pc + missionInstructionSize(op);
+  int target = next;
+  
+  switch (op) {
+    case MOP_MOVE:
+      applyMove(operand[0], operand[1]);
+      break;
+      
+    case MOP_TURN:
+      // The turn leaves the car stopped, so there is no move to resume after avoidance
+      moveDirection = MDIR_STOP;
+      movementCtrl->turnByDegrees((int16_t)readU16(operand));
+      waitState = WAIT_MOTION;
+      pc = next;
+      return false;
+      
+    case MOP_WAIT:
+      waitUntil = currentTime + readU16(operand);
+      waitState = WAIT_TIME;
+      pc = next;
+      return false;
+      
+    case MOP_RANGE: {
+      lastRangeTime = currentTime;
+      unsigned long echo = sensorMgr->pingRaw(MISSION_PING_TIMEOUT);
+      distance = echo > 0 ? (int)(echo * 0.0343f / 2) : MISSION_NO_ECHO_CM;
+      rangeReadings++;
+      pc = next;
+      return false;
+    }
+      
+    case MOP_JUMP_LT:
+      if (distance < readU16(operand)) {
+        target = readU16(operand + 2);
+      }
+      break;
+      
+    case MOP_JUMP_GE:
+      if (distance >= readU16(operand)) {
+        target = readU16(operand + 2);
+      }
+      break;
+      
+    case MOP_JUMP:
+      target = readU16(operand);
+      break;
+      
+    case MOP_SET_COUNTER:
+      counters[operand[0]] = readU16(operand + 1);
+      break;
+      
+    case MOP_LOOP:
+      if (counters[operand[0]] > 0 && --counters[operand[0]] > 0) {
+        target = readU16(operand + 1);
+      }
+      break;
+      
+    default:
+      movementCtrl->stop();
+      finish("complete");
+      return false;
+  }
+  
+  // A backward jump closes a loop: give the rest of the system a turn before going round again
+  bool keepGoing = target > pc;
+  pc = target;
+  return keepGoing;
+}
+
+unsigned long MissionVm::millisUntilNextStep(unsigned long currentTime) const {
+  if (!running) {
+    return ULONG_MAX;
+  }
+  long remaining = 0;
+  if (waitState == WAIT_TIME) {
+    remaining = (long)(waitUntil - currentTime);
+  } else if (pc < length && program[pc] == MOP_RANGE && rangeReadings > 0) {
+    remaining = (long)(lastRangeTime + MISSION_RANGE_INTERVAL_MS - currentTime);
+  }
+  return remaining > 0 ? remaining : 0;
+}
+
+void MissionVm::printStatus() const {
+  if (uploading) {
+    MessageManager::sendF("Mission: uploading, %d of %d bytes received", length, expectedLength);
+  } else if (!loaded) {
+    MessageManager::send("Mission: none loaded");
+  } else if (running) {
+    MessageManager::sendF("Mission: running at byte %d of %d, %lu instructions, distance %d cm%s",
+                          pc, length, instructions, distance, pausedForAvoidance ? ", paused for avoidance" : "");
+  } else {
+    MessageManager::sendF("Mission: %d bytes loaded, last run %lu instructions over %lu ticks",
+                          length, instructions, ticks);
+  }
+}
+
+#endif // FEATURE_MISSIONS
\ No newline at end of file
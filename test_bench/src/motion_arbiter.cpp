@@ -0,0 +1,116 @@
+#include "../include/motion_arbiter.h"
+#include "../include/trace.h"
+
+MotionArbiter::MotionArbiter() {
+  for (int i = 0; i < PRIORITY_LEVELS; i++) {
+    proposals[i].direction = Stop;
+    proposals[i].leftSpeed = 0;
+    proposals[i].rightSpeed = 0;
+    active[i] = false;
+  }
+  lastWritten.direction = Stop;
+  lastWritten.leftSpeed = 0;
+  lastWritten.rightSpeed = 0;
+  hasWritten = false;
+  forwardLimit = MAX_SPEED;
+  estopLatched = false;
+  estopMicros = 0;
+}
+
+void MotionArbiter::init() {
+  car.Init();
+}
+
+void MotionArbiter::propose(MotionPriority priority, int direction, int speed) {
+  propose(priority, direction, speed, speed);
+}
+
+void MotionArbiter::propose(MotionPriority priority, int direction, int leftSpeed, int rightSpeed) {
+  proposals[priority].direction = direction;
+  proposals[priority].leftSpeed = direction == Stop ? 0 : leftSpeed;
+  proposals[priority].rightSpeed = direction == Stop ? 0 : rightSpeed;
+  active[priority] = true;
+}
+
+void MotionArbiter::release(MotionPriority priority) {
+  active[priority] = false;
+}
+
+bool MotionArbiter::isActive(MotionPriority priority) const {
+  return active[priority];
+}
+
+MotorCommand MotionArbiter::getProposal(MotionPriority priority) const {
+  return proposals[priority];
+}
+
+MotionPriority MotionArbiter::getWinner() const {
+  if (estopLatched.load(std::memory_order_acquire)) {
+    return PRIORITY_LEVELS;
+  }
+  for (int i = PRIORITY_LEVELS - 1; i >= 0; i--) {
+    if (active[i]) {
+      return static_cast<MotionPriority>(i);
+    }
+  }
+  return PRIORITY_LEVELS;
+}
+
+MotorCommand MotionArbiter::getCommand() const {
+  MotionPriority winner = getWinner();
+  if (winner == PRIORITY_LEVELS) {
+    MotorCommand idle = {Stop, 0, 0};
+    return idle;
+  }
+  
+  MotorCommand command = proposals[winner];
+  int fastest = max(command.leftSpeed, command.rightSpeed);
+  if (fastest > forwardLimit && drivesForward(command.direction)) {
+    command.leftSpeed = command.leftSpeed * forwardLimit / fastest;
+    command.rightSpeed = command.rightSpeed * forwardLimit / fastest;
+  }
+  return command;
+}
+
+void MotionArbiter::setForwardLimit(int pwm) {
+  forwardLimit = pwm;
+}
+
+void MotionArbiter::apply() {
+  MotorCommand command = getCommand();
+  
+  // Skip the shift register and PWM writes when nothing changed
+  if (hasWritten && command.direction == lastWritten.direction &&
+      command.leftSpeed == lastWritten.leftSpeed && command.rightSpeed == lastWritten.rightSpeed) {
+    return;
+  }
+  
+  TRACE_SCOPE("vehicle::Drive");
+  car.Drive(command.direction, command.leftSpeed, command.rightSpeed);
+  lastWritten = command;
+  hasWritten = true;
+  
+  // An emergency stop that landed during the write may have been overwritten by it
+  if (command.direction != Stop && estopLatched.load(std::memory_order_acquire)) {
+    car.Disable();
+  }
+}
+
+void MotionArbiter::emergencyStop() {
+  estopMicros.store(micros(), std::memory_order_relaxed);
+  estopLatched.store(true, std::memory_order_release);
+  car.Disable();
+  TRACE_INSTANT("estop: motors cut");
+}
+
+bool MotionArbiter::isEmergencyStopped() const {
+  return estopLatched.load(std::memory_order_acquire);
+}
+
+uint32_t MotionArbiter::getEmergencyStopMicros() const {
+  return estopMicros.load(std::memory_order_relaxed);
+}
+
+void MotionArbiter::clearEmergencyStop() {
+  estopLatched.store(false, std::memory_order_release);
+}
\ No newline at end of file
@@ -1,17 +1,32 @@
 #include "../include/movement_controller.h"
 #include "../include/message_manager.h"
+#include "../include/trace.h"
 
-MovementController::MovementController(LedManager* ledMgr) {
-  car = new vehicle();
+MovementController::MovementController(LedManager* ledMgr, SweepMapper* mapper) {
   ledManager = ledMgr;
+  sweepMapper = mapper;
   timedMoveEnd = 0;
+  timedMoveIsTurn = false;
   currentSpeed = DEFAULT_SPEED;  // Initialize with default speed
   avoidanceState = AVOID_IDLE;
   stateChangeTime = 0;
+  avoidBackupDuration = AVOID_BACKUP_DURATION;
+  avoidTurnDegrees = AVOID_TURN_DEGREES;
+  setpointMode = false;
+  setpointDriving = false;
+  setpointTimeout = SETPOINT_TIMEOUT_MS;
+  lastSetpointTime = 0;
+  forwardBlocked = false;
+  lastBlockedReport = 0;
+  obstacleReactions = 0;
+  maxReactionMicros = 0;
+  totalReactionMicros = 0;
+  estopSettled = false;
+  emergencyStops = 0;
 }
 
 void MovementController::init() {
-  car->Init();
+  arbiter.init();
 }
 
 // New methods for handling speed
@@ -25,13 +40,26 @@ void MovementController::setSpeed(int speed) {
   
   currentSpeed = speed;
   
-  MessageManager::send("Speed set to " + String(currentSpeed));
+  MessageManager::sendF("Speed set to %d", currentSpeed);
 }
 
 int MovementController::getSpeed() const {
   return currentSpeed;
 }
 
+bool MovementController::startManual(int direction, int speed, unsigned long durationMillis, bool isTurn) {
+  if (arbiter.isEmergencyStopped()) {
+    MessageManager::send("Emergency stop latched - send 'estop off' to release it");
+    return false;
+  }
+  arbiter.release(PRIORITY_SAFETY);
+  arbiter.propose(PRIORITY_MANUAL, direction, speed);
+  timedMoveEnd = durationMillis > 0 ? millis() + durationMillis : 0;
+  timedMoveIsTurn = isTurn;
+  setpointDriving = false;
+  return true;
+}
+
 // Methods using the global speed setting
 void MovementController::moveForward(int durationSeconds) {
   moveForwardWithSpeed(currentSpeed, durationSeconds);
@@ -43,86 +71,279 @@ void MovementController::moveBackward(int durationSeconds) {
 
 // Methods with explicit speed
 void MovementController::moveForwardWithSpeed(int speed, int durationSeconds) {
-  car->Move(Forward, speed);
-  ledManager->setLeftLedStatus(LED_FORWARD);
+  if (!startManual(Forward, speed, durationSeconds > 0 ? durationSeconds * 1000UL : 0, false)) {
+    return;
+  }
   
   if (durationSeconds > 0) {
-    timedMoveEnd = millis() + (durationSeconds * 1000);
-    MessageManager::send("Moving forward at speed " + String(speed) + " for " + String(durationSeconds) + " seconds");
+    MessageManager::sendF("Moving forward at speed %d for %d seconds", speed, durationSeconds);
   } else {
-    MessageManager::send("Moving forward at speed " + String(speed));
+    MessageManager::sendF("Moving forward at speed %d", speed);
   }
 }
 
 void MovementController::moveBackwardWithSpeed(int speed, int durationSeconds) {
-  car->Move(Backward, speed);
-  ledManager->setLeftLedStatus(LED_BACKWARD);
+  if (!startManual(Backward, speed, durationSeconds > 0 ? durationSeconds * 1000UL : 0, false)) {
+    return;
+  }
   
   if (durationSeconds > 0) {
-    timedMoveEnd = millis() + (durationSeconds * 1000);
-    MessageManager::send("Moving backward at speed " + String(speed) + " for " + String(durationSeconds) + " seconds");
+    MessageManager::sendF("Moving backward at speed %d for %d seconds", speed, durationSeconds);
   } else {
-    MessageManager::send("Moving backward at speed " + String(speed));
+    MessageManager::sendF("Moving backward at speed %d", speed);
   }
 }
 
 void MovementController::stop() {
-  car->Move(Stop, 0);
-  ledManager->setLeftLedStatus(LED_IDLE);
+  // An explicit stop outranks avoidance, so abort the maneuver rather than resume it later
+  arbiter.propose(PRIORITY_SAFETY, Stop, 0);
+  arbiter.release(PRIORITY_MANUAL);
+  arbiter.release(PRIORITY_AVOIDANCE);
+  if (avoidanceState != AVOID_IDLE) {
+    TRACE_INSTANT("avoid: aborted");
+  }
+  avoidanceState = AVOID_IDLE;
   timedMoveEnd = 0;
+  setpointDriving = false;
   
   MessageManager::send("Stopping");
 }
 
-void MovementController::turnByDegrees(int degrees) {
-  // Positive degrees for right turn, negative for left
-  MessageManager::send("Turning " + String(abs(degrees)) + " degrees " + (degrees > 0 ? "right" : "left"));
+void MovementController::emergencyStop() {
+  // Only the arbiter's latch and outputs are touched here; the loop settles the rest
+  arbiter.emergencyStop();
+}
+
+bool MovementController::takeEmergencyStop() {
+  if (!arbiter.isEmergencyStopped() || estopSettled) {
+    return false;
+  }
+  estopSettled = true;
+  emergencyStops++;
+  
+  arbiter.release(PRIORITY_MANUAL);
+  arbiter.release(PRIORITY_AVOIDANCE);
+  arbiter.release(PRIORITY_SAFETY);
+  avoidanceState = AVOID_IDLE;
+  timedMoveEnd = 0;
+  setpointDriving = false;
   
-  ledManager->setLeftLedStatus(LED_TURNING);
+  MessageManager::sendF("EMERGENCY STOP - motors cut %lu us before the loop got to it; send 'estop off' to release",
+                        (unsigned long)(micros() - arbiter.getEmergencyStopMicros()));
+  return true;
+}
+
+void MovementController::clearEmergencyStop() {
+  if (!arbiter.isEmergencyStopped()) {
+    MessageManager::send("Emergency stop is not latched");
+    return;
+  }
+  takeEmergencyStop();
+  arbiter.propose(PRIORITY_SAFETY, Stop, 0);
+  arbiter.clearEmergencyStop();
+  estopSettled = false;
   
-  // Stop any existing movement first
-  car->Move(Stop, 0);
-  delay(50);
+  MessageManager::send("Emergency stop released - stopped until the next move command");
+}
+
+bool MovementController::isEmergencyStopped() const {
+  return arbiter.isEmergencyStopped();
+}
+
+unsigned long MovementController::getEmergencyStopCount() const {
+  return emergencyStops;
+}
+
+void MovementController::turnByDegrees(int degrees, int speed) {
+  // Positive degrees for right turn, negative for left
+  MessageManager::sendF("Turning %d degrees %s", abs(degrees), degrees > 0 ? "right" : "left");
   
-  if (degrees > 0) {
-    car->Move(Clockwise, TURN_SPEED);
-  } else if (degrees < 0) {
-    car->Move(Contrarotate, TURN_SPEED);
-  } else {
+  if (degrees == 0) {
     MessageManager::send("No turn needed (0 degrees)");
     return;
   }
   
-  // IMPORTANT: Using blocking delay for precise turning
-  // Calculate delay time based on degrees
-  // Using 1250ms for 90 degrees
-  int delayTime = abs(degrees) * 1250 / 90;
+  // Calculate turn time from the measured turn rate at this speed
+  unsigned long turnTime = sweepMapper->turnMillis(degrees, speed);
+  if (turnTime == 0) {
+    MessageManager::sendF("Speed %d is too low to turn", speed);
+    return;
+  }
   
   // Debug message to verify calculation
-  MessageManager::sendF("Turn time: %d ms for %d degrees", delayTime, abs(degrees));
+  MessageManager::sendF("Turn time: %lu ms for %d degrees at speed %d", turnTime, abs(degrees), speed);
+  
+  // The turn runs as a timed manual move; checkTimedMovements() ends it
+  startManual(degrees > 0 ? Clockwise : Contrarotate, speed, turnTime, true);
+}
+
+void MovementController::rotate(bool clockwise, int speed) {
+  if (!startManual(clockwise ? Clockwise : Contrarotate, speed, 0, true)) {
+    return;
+  }
+  MessageManager::sendF("Rotating %s", clockwise ? "right" : "left");
+}
+
+void MovementController::enableSetpoints(unsigned long timeoutMillis) {
+  if (arbiter.isEmergencyStopped()) {
+    MessageManager::send("Emergency stop latched - send 'estop off' to release it");
+    return;
+  }
+  
+  // Setpoints never lift a stop hold by themselves, so re-enabling is how the operator resumes
+  arbiter.release(PRIORITY_SAFETY);
+  arbiter.release(PRIORITY_MANUAL);
+  timedMoveEnd = 0;
+  setpointMode = true;
+  setpointDriving = false;
+  setpointTimeout = timeoutMillis;
+  
+  MessageManager::sendF("Setpoint mode enabled, dead-man timeout %lu ms", setpointTimeout);
+}
+
+void MovementController::disableSetpoints() {
+  if (setpointDriving) {
+    arbiter.release(PRIORITY_MANUAL);
+    setpointDriving = false;
+  }
+  setpointMode = false;
+  
+  MessageManager::send("Setpoint mode disabled");
+}
+
+bool MovementController::isSetpointMode() const {
+  return setpointMode;
+}
+
+unsigned long MovementController::getSetpointTimeout() const {
+  return setpointTimeout;
+}
+
+// Map one side's signed duty onto its two motors' direction bits
+static int sideDirection(int duty, int forwardBits, int backwardBits) {
+  if (duty > 0) {
+    return forwardBits;
+  }
+  return duty < 0 ? backwardBits : 0;
+}
+
+void MovementController::applySetpoint(int linear, int turn, unsigned long currentTime) {
+  if (!setpointMode || arbiter.isActive(PRIORITY_SAFETY)) {
+    return;
+  }
+  
+  // Differential mix: turning clockwise speeds up the left side and slows the right
+  int left = constrain(linear + turn, -MAX_SPEED, MAX_SPEED);
+  int right = constrain(linear - turn, -MAX_SPEED, MAX_SPEED);
+  if (abs(left) < SETPOINT_DEADBAND) {
+    left = 0;
+  }
+  if (abs(right) < SETPOINT_DEADBAND) {
+    right = 0;
+  }
   
-  // Use blocking delay for precise timing
-  delay(delayTime);
+  lastSetpointTime = currentTime;
+  timedMoveEnd = 0;
+  if (left == 0 && right == 0) {
+    arbiter.release(PRIORITY_MANUAL);
+    setpointDriving = false;
+    return;
+  }
   
-  // Stop immediately after delay
-  car->Move(Stop, 0);
-  ledManager->setLeftLedStatus(LED_IDLE);
+  // Equal sides give the plain Forward/Backward/Clockwise/Contrarotate codes
+  int direction = sideDirection(left, M1_Forward | M2_Forward, M1_Backward | M2_Backward) |
+                  sideDirection(right, M3_Forward | M4_Forward, M3_Backward | M4_Backward);
+  arbiter.propose(PRIORITY_MANUAL, direction, abs(left), abs(right));
+  setpointDriving = true;
+}
+
+bool MovementController::getResumableMotion(int* direction, int* speed, unsigned long* remainingMillis,
+                                            bool* isTurn) const {
+  if (!arbiter.isActive(PRIORITY_MANUAL) || arbiter.isActive(PRIORITY_SAFETY) || arbiter.isEmergencyStopped() ||
+      setpointDriving) {
+    return false;
+  }
   
-  MessageManager::send("Turn complete");
+  MotorCommand proposal = arbiter.getProposal(PRIORITY_MANUAL);
+  *direction = proposal.direction;
+  *speed = proposal.leftSpeed;
+  *isTurn = timedMoveIsTurn;
+  if (timedMoveEnd == 0) {
+    *remainingMillis = 0;
+  } else {
+    // A move about to end still counts, with the shortest time left
+    unsigned long now = millis();
+    *remainingMillis = timedMoveEnd > now ? timedMoveEnd - now : 1;
+  }
+  return true;
+}
+
+void MovementController::resumeMotion(int direction, int speed, unsigned long remainingMillis, bool isTurn) {
+  if (!startManual(direction, speed, remainingMillis, isTurn)) {
+    return;
+  }
+  
+  if (remainingMillis > 0) {
+    MessageManager::sendF("Resuming motion 0x%02X at speed %d for %lu ms", direction, speed, remainingMillis);
+  } else {
+    MessageManager::sendF("Resuming motion 0x%02X at speed %d", direction, speed);
+  }
 }
 
 void MovementController::performAvoidanceManeuver() {
-  // Set obstacle detection LED status
-  ledManager->setLeftLedStatus(LED_OBSTACLE);
+  if (!canStartAvoidance()) {
+    return;
+  }
+  
+  // Avoidance preempts and cancels the manual move that led into the obstacle
+  arbiter.release(PRIORITY_MANUAL);
+  timedMoveEnd = 0;
   
   // Start the avoidance maneuver state machine
   avoidanceState = AVOID_BACKING;
-  car->Move(Backward, 150);
-  stateChangeTime = millis() + 500; // Back up for 500ms
+  TRACE_INSTANT("avoid: backing");
+  arbiter.propose(PRIORITY_AVOIDANCE, Backward, AVOID_BACKUP_SPEED);
+  stateChangeTime = millis() + avoidBackupDuration;
   
   MessageManager::send("Starting avoidance maneuver");
 }
 
+bool MovementController::reactToObstacle(int distanceCm, unsigned long sampleMicros) {
+  if (!canStartAvoidance()) {
+    return false;
+  }
+  performAvoidanceManeuver();
+  applyMotion();
+  unsigned long latency = micros() - sampleMicros;
+  sweepMapper->track(arbiter.getCommand(), micros());
+  
+  obstacleReactions++;
+  totalReactionMicros += latency;
+  if (latency > maxReactionMicros) {
+    maxReactionMicros = latency;
+  }
+  MessageManager::sendF("Obstacle detected! %dcm - reversing %lu us after the reading", distanceCm, latency);
+  return true;
+}
+
+void MovementController::printReactionStats() const {
+  MessageManager::sendF("Obstacle reaction: %lu maneuvers, reading-to-motors max %lu us, mean %lu us",
+                        obstacleReactions, maxReactionMicros,
+                        obstacleReactions > 0 ? (unsigned long)(totalReactionMicros / obstacleReactions) : 0UL);
+}
+
+bool MovementController::canStartAvoidance() const {
+  return avoidanceState == AVOID_IDLE && !arbiter.isActive(PRIORITY_SAFETY) && !arbiter.isEmergencyStopped();
+}
+
+bool MovementController::isAvoiding() const {
+  return avoidanceState != AVOID_IDLE;
+}
+
+bool MovementController::isIdle() const {
+  return avoidanceState == AVOID_IDLE && arbiter.getCommand().direction == Stop;
+}
+
 void MovementController::updateAvoidanceManeuver(unsigned long currentTime) {
   if (avoidanceState == AVOID_IDLE) {
     return;
@@ -130,23 +351,33 @@ void MovementController::updateAvoidanceManeuver(unsigned long currentTime) {
   
   if (currentTime >= stateChangeTime) {
     switch (avoidanceState) {
-      case AVOID_BACKING:
-        // Switch to turning state
-        car->Move(Contrarotate, 180);
+      case AVOID_BACKING: {
+        // Turn toward the clearest mapped heading, or left for the fixed time if nothing is mapped
+        int turn = sweepMapper->clearestTurn();
+        if (turn != 0) {
+          arbiter.propose(PRIORITY_AVOIDANCE, turn > 0 ? Clockwise : Contrarotate, AVOID_TURN_SPEED);
+          stateChangeTime = currentTime + sweepMapper->turnMillis(turn, AVOID_TURN_SPEED);
+          MessageManager::sendF("Turning %d degrees %s toward free space", abs(turn), turn > 0 ? "right" : "left");
+        } else {
+          arbiter.propose(PRIORITY_AVOIDANCE, Contrarotate, AVOID_TURN_SPEED);
+          stateChangeTime = currentTime + sweepMapper->turnMillis(avoidTurnDegrees, AVOID_TURN_SPEED);
+        }
         avoidanceState = AVOID_TURNING;
-        stateChangeTime = currentTime + 1000; // Turn for 1000ms
+        TRACE_INSTANT("avoid: turning");
         break;
+      }
         
       case AVOID_TURNING:
         // Complete the maneuver
-        car->Move(Stop, 0);
+        arbiter.release(PRIORITY_AVOIDANCE);
         avoidanceState = AVOID_IDLE;
-        ledManager->setLeftLedStatus(LED_IDLE);
+        TRACE_INSTANT("avoid: complete");
         
         MessageManager::send("Avoidance maneuver complete");
         break;
         
       default:
+        arbiter.release(PRIORITY_AVOIDANCE);
         avoidanceState = AVOID_IDLE;
         break;
     }
@@ -155,17 +386,98 @@ void MovementController::updateAvoidanceManeuver(unsigned long currentTime) {
 
 void MovementController::checkTimedMovements(unsigned long currentTime) {
   if (timedMoveEnd > 0 && currentTime >= timedMoveEnd) {
-    car->Move(Stop, 0);
-    MessageManager::send("Timed movement complete");
+    arbiter.release(PRIORITY_MANUAL);
+    MessageManager::send(timedMoveIsTurn ? "Turn complete" : "Timed movement complete");
+    timedMoveEnd = 0;
+  }
+  
+  // Dead-man: a setpoint only holds for one window
+  if (setpointDriving && currentTime - lastSetpointTime > setpointTimeout) {
+    arbiter.release(PRIORITY_MANUAL);
+    setpointDriving = false;
+    MessageManager::send("Setpoint timeout - stopping");
+  }
+}
+
+LedStatus MovementController::motionLedStatus() const {
+  if (arbiter.isEmergencyStopped()) {
+    return LED_ERROR;
+  }
+  if (arbiter.getWinner() == PRIORITY_AVOIDANCE) {
+    return LED_OBSTACLE;
+  }
+  
+  int direction = arbiter.getCommand().direction;
+  switch (direction) {
+    case Forward:
+      return LED_FORWARD;
+    case Backward:
+      return LED_BACKWARD;
+    case Clockwise:
+    case Contrarotate:
+      return LED_TURNING;
+    case Stop:
+      return LED_IDLE;
+    default:
+      // Setpoint arcs and pivots with one side stopped
+      if ((direction & (M1_Forward | M3_Forward)) && (direction & (M1_Backward | M3_Backward))) {
+        return LED_TURNING;
+      }
+      return (direction & (M1_Forward | M3_Forward)) ? LED_FORWARD : LED_BACKWARD;
+  }
+}
+
+void MovementController::setForwardBlocked(bool blocked) {
+  forwardBlocked = blocked;
+}
+
+void MovementController::setForwardLimit(int pwm) {
+  arbiter.setForwardLimit(pwm);
+}
+
+void MovementController::applyMotion() {
+  // Drop a manual proposal that would drive the car into what it can no longer see
+  if (forwardBlocked && drivesForward(arbiter.getCommand().direction) && arbiter.getWinner() == PRIORITY_MANUAL) {
+    arbiter.release(PRIORITY_MANUAL);
     timedMoveEnd = 0;
-    ledManager->setLeftLedStatus(LED_IDLE);
+    setpointDriving = false;
+    // Setpoint streams re-propose every frame, so report at most once a second
+    if (millis() - lastBlockedReport >= 1000 || lastBlockedReport == 0) {
+      lastBlockedReport = millis();
+      MessageManager::send("Forward motion blocked: sensor failed");
+    }
+  }
+  
+  arbiter.apply();
+  
+  // Follow the winner with the left LED, leaving a running pattern alone
+  LedStatus status = motionLedStatus();
+  if (status != ledManager->getCurrentLeftLedStatus()) {
+    ledManager->setLeftLedStatus(status);
   }
 }
 
+MotorCommand MovementController::getMotorCommand() const {
+  return arbiter.getCommand();
+}
+
 unsigned long MovementController::getTimedMoveEnd() const {
   return timedMoveEnd;
 }
 
 void MovementController::cancelTimedMovement() {
   timedMoveEnd = 0;
+}
+
+void MovementController::setAvoidanceTimings(unsigned long backupDuration, int turnDegrees) {
+  avoidBackupDuration = backupDuration;
+  avoidTurnDegrees = turnDegrees;
+}
+
+unsigned long MovementController::getAvoidBackupDuration() const {
+  return avoidBackupDuration;
+}
+
+int MovementController::getAvoidTurnDegrees() const {
+  return avoidTurnDegrees;
 }
\ No newline at end of file
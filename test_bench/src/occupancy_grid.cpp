@@ -0,0 +1,161 @@
+#include "../include/occupancy_grid.h"
+
+// Log-odds steps per reading; a hit outweighs a pass so thin obstacles survive
+static const int LOG_ODDS_FREE = -1;
+static const int LOG_ODDS_HIT = 3;
+static const int LOG_ODDS_MIN = -8;
+static const int LOG_ODDS_MAX = 7;
+static const int OCCUPIED_LEVEL = 2;
+
+// World cell index of a coordinate, rounding toward negative infinity
+static int cellIndex(float cm) {
+  return (int)floorf(cm / GRID_CELL_CM);
+}
+
+// Storage slot of a world cell index; the window wraps around the array
+static int wrap(int index) {
+  int slot = index % GRID_CELLS;
+  return slot < 0 ? slot + GRID_CELLS : slot;
+}
+
+OccupancyGrid::OccupancyGrid() {
+  clear();
+}
+
+void OccupancyGrid::clear() {
+  // Stored values are offset by 8, so unknown (0) is 0x88 for a pair of cells
+  memset(cells, 0x88, sizeof(cells));
+  originX = -GRID_CELLS / 2;
+  originY = -GRID_CELLS / 2;
+}
+
+bool OccupancyGrid::inWindow(int cellX, int cellY) const {
+  return cellX >= originX && cellX < originX + GRID_CELLS && cellY >= originY && cellY < originY + GRID_CELLS;
+}
+
+int OccupancyGrid::get(int cellX, int cellY) const {
+  int slot = wrap(cellY) * GRID_CELLS + wrap(cellX);
+  uint8_t pair = cells[slot / 2];
+  int stored = (slot & 1) ? pair >> 4 : pair & 0x0F;
+  return stored - 8;
+}
+
+void OccupancyGrid::set(int cellX, int cellY, int logOdds) {
+  int slot = wrap(cellY) * GRID_CELLS + wrap(cellX);
+  uint8_t stored = (uint8_t)(logOdds + 8);
+  uint8_t& pair = cells[slot / 2];
+  pair = (slot & 1) ? (uint8_t)((pair & 0x0F) | (stored << 4)) : (uint8_t)((pair & 0xF0) | stored);
+}
+
+void OccupancyGrid::clearColumn(int cellX) {
+  for (int y = originY; y < originY + GRID_CELLS; y++) {
+    set(cellX, y, 0);
+  }
+}
+
+void OccupancyGrid::clearRow(int cellY) {
+  for (int x = originX; x < originX + GRID_CELLS; x++) {
+    set(x, cellY, 0);
+  }
+}
+
+void OccupancyGrid::recenter(float x, float y) {
+  int targetX = cellIndex(x) - GRID_CELLS / 2;
+  int targetY = cellIndex(y) - GRID_CELLS / 2;
+  
+  // Only scroll once the car is a quarter of the window off centre
+  if (abs(targetX - originX) >= GRID_CELLS / 4) {
+    while (originX < targetX) {
+      clearColumn(originX);  // Leaves on the low side, reappears as the new high column
+      originX++;
+    }
+    while (originX > targetX) {
+      originX--;
+      clearColumn(originX);
+    }
+  }
+  if (abs(targetY - originY) >= GRID_CELLS / 4) {
+    while (originY < targetY) {
+      clearRow(originY);
+      originY++;
+    }
+    while (originY > targetY) {
+      originY--;
+      clearRow(originY);
+    }
+  }
+}
+
+void OccupancyGrid::addRange(float x, float y, float heading, int distanceCm, int maxCm) {
+  bool hit = distanceCm > 0 && distanceCm <= maxCm;
+  int freeCm = hit ? distanceCm - GRID_CELL_CM / 2 : maxCm;
+  float dx = cosf(heading);
+  float dy = sinf(heading);
+  
+  // Half-cell steps visit every cell the ray crosses at least once; each cell is updated once
+  int lastX = INT_MIN, lastY = INT_MIN;
+  for (float r = 0; r < freeCm; r += GRID_CELL_CM / 2.0f) {
+    int cx = cellIndex(x + dx * r);
+    int cy = cellIndex(y + dy * r);
+    if ((cx == lastX && cy == lastY) || !inWindow(cx, cy)) {
+      continue;
+    }
+    lastX = cx;
+    lastY = cy;
+    set(cx, cy, max(get(cx, cy) + LOG_ODDS_FREE, LOG_ODDS_MIN));
+  }
+  
+  if (hit) {
+    int cx = cellIndex(x + dx * distanceCm);
+    int cy = cellIndex(y + dy * distanceCm);
+    if (inWindow(cx, cy)) {
+      set(cx, cy, min(get(cx, cy) + LOG_ODDS_HIT, LOG_ODDS_MAX));
+    }
+  }
+}
+
+void OccupancyGrid::markFree(float x, float y) {
+  int cx = cellIndex(x);
+  int cy = cellIndex(y);
+  if (inWindow(cx, cy)) {
+    set(cx, cy, LOG_ODDS_MIN);
+  }
+}
+
+int OccupancyGrid::clearance(float x, float y, float heading, int maxCm, int* unknownCm) const {
+  float dx = cosf(heading);
+  float dy = sinf(heading);
+  float step = GRID_CELL_CM / 2.0f;
+  float unknown = 0;
+  
+  for (float r = 0; r < maxCm; r += step) {
+    int cx = cellIndex(x + dx * r);
+    int cy = cellIndex(y + dy * r);
+    if (!inWindow(cx, cy)) {
+      unknown += maxCm - r;  // Past the mapped area nothing is known
+      break;
+    }
+    int logOdds = get(cx, cy);
+    if (logOdds >= OCCUPIED_LEVEL) {
+      *unknownCm = (int)unknown;
+      return (int)r;
+    }
+    if (logOdds > LOG_ODDS_FREE) {
+      unknown += step;
+    }
+  }
+  *unknownCm = (int)unknown;
+  return maxCm;
+}
+
+int OccupancyGrid::knownCells() const {
+  int known = 0;
+  for (int y = originY; y < originY + GRID_CELLS; y++) {
+    for (int x = originX; x < originX + GRID_CELLS; x++) {
+      if (get(x, y) != 0) {
+        known++;
+      }
+    }
+  }
+  return known;
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+#include "../include/scan_capture.h"
+#include "../include/message_manager.h"
+
+#if FEATURE_SCAN
+
+// Longest a ping can take: the trigger pulse, then the whole echo timeout
+static const unsigned long PING_WORST_MICROS = 15 + SCAN_PING_TIMEOUT;
+
+static_assert(SCAN_SLICE_MICROS >= PING_WORST_MICROS, "a scan slice must fit at least one timed-out ping");
+
+ScanCapture::ScanCapture(SensorManager* sensMgr) {
+  sensorMgr = sensMgr;
+  targetCount = 0;
+  sampleCount = 0;
+  timeouts = 0;
+  active = false;
+  startMicros = 0;
+}
+
+void ScanCapture::start(int count) {
+  if (count <= 0 || count > SCAN_BUFFER_SAMPLES) {
+    count = SCAN_BUFFER_SAMPLES;
+  }
+  
+  targetCount = count;
+  sampleCount = 0;
+  timeouts = 0;
+  active = true;
+  startMicros = micros();
+  
+  MessageManager::sendF("Scan started: %d samples", targetCount);
+}
+
+void ScanCapture::abort() {
+  if (active) {
+    active = false;
+    MessageManager::sendF("Scan aborted after %d samples", sampleCount);
+  }
+}
+
+bool ScanCapture::isActive() const {
+  return active;
+}
+
+void ScanCapture::update() {
+  if (!active) {
+    return;
+  }
+  
+  // A ping starts only if the slice still has room for it to time out
+  unsigned long sliceStart = micros();
+  while (sampleCount < targetCount && micros() - sliceStart <= SCAN_SLICE_MICROS - PING_WORST_MICROS) {
+    ScanSample& sample = samples[sampleCount++];
+    sample.atMicros = micros() - startMicros;
+    unsigned long echo = sensorMgr->pingRaw(SCAN_PING_TIMEOUT);
+    sample.echoMicros = echo > 0xFFFF ? 0xFFFF : echo;
+    if (echo == 0) {
+      timeouts++;
+    }
+  }
+  
+  if (sampleCount == targetCount) {
+    active = false;
+    dump();
+  }
+}
+
+void ScanCapture::dump() {
+  unsigned long duration = micros() - startMicros;
+  unsigned long rate = duration > 0 ? (unsigned long)((uint64_t)sampleCount * 1000000 / duration) : 0;
+  MessageManager::sendF("Scan complete: %d samples in %lu ms (%lu Hz), %d timeouts",
+                        sampleCount, duration / 1000, rate, timeouts);
+  
+  ScanDumpHeader header;
+  memcpy(header.magic, "SCN1", 4);
+  header.sampleCount = sampleCount;
+  header.sampleSize = sizeof(ScanSample);
+  header.durationMicros = duration;
+  
+  const uint8_t* headerBytes = reinterpret_cast<const uint8_t*>(&header);
+  const uint8_t* sampleBytes = reinterpret_cast<const uint8_t*>(samples);
+  size_t sampleLength = sampleCount * sizeof(ScanSample);
+  
+  uint32_t checksum = 0;
+  for (size_t i = 0; i < sizeof(header); i++) {
+    checksum += headerBytes[i];
+  }
+  for (size_t i = 0; i < sampleLength; i++) {
+    checksum += sampleBytes[i];
+  }
+  
+  MessageManager::sendF("Scan dump: %u bytes follow", (unsigned)(sizeof(header) + sampleLength + sizeof(checksum)));
+  MessageManager::sendBinary(headerBytes, sizeof(header));
+  MessageManager::sendBinary(sampleBytes, sampleLength);
+  MessageManager::sendBinary(reinterpret_cast<const uint8_t*>(&checksum), sizeof(checksum));
+  MessageManager::send("");
+}
+
+#endif // FEATURE_SCAN
\ No newline at end of file
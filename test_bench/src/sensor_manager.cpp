@@ -1,39 +1,60 @@
 #include "../include/sensor_manager.h"
 #include "../include/message_manager.h" // Add this include
+#include "../include/trace.h"
 
 SensorManager::SensorManager() {
-  sensor = new ultrasonic();
   debugEnabled = false;
-  lastObstacleCheck = 0;
   avoidanceEnabled = true;
   consecutiveFailedReadings = 0;
   lastValidDistance = 0;
+  lastSampleTime = 0;
+  sampleInterval = OBSTACLE_CHECK_INTERVAL;
+  readingPending = false;
+  pendingDistance = 0;
+  pendingMicros = 0;
+  nearField = false;
+  nearPingCount = 0;
+  nearPingNext = 0;
+  nearReadings = 0;
+  fullReadings = 0;
+  obstacleDistance = OBSTACLE_DETECTION_DISTANCE;
+  obstacleCheckInterval = OBSTACLE_CHECK_INTERVAL;
+  readingAttempts = MAX_READING_ATTEMPTS;
+  sensorFailed = false;
+  tripPending = false;
+  failedSince = 0;
+  lastProbeTime = 0;
+  probeInterval = SENSOR_PROBE_MIN_MS;
+  probes = 0;
+  trips = 0;
 }
 
-SensorManager::~SensorManager() {
-  // Free memory on destruction
-  if (sensor != nullptr) {
-    delete sensor;
-    sensor = nullptr;
-  }
-}
-
-void SensorManager::init(int trigPin, int echoPin) {
-  sensor->Init(trigPin, echoPin);
+void SensorManager::init(int trigPin, int echoPin, bool warmUp) {
+  sensor.Init(trigPin, echoPin);
   // Initialize with a reading to warm up the sensor
-  getValidDistance();
+  if (warmUp) {
+    getValidDistance();
+  }
 }
 
 int SensorManager::getValidDistance() {
-  int distances[MAX_READING_ATTEMPTS]; // Store all readings
+  TRACE_SCOPE("SensorManager::getValidDistance");
+  // A failed sensor would only burn every attempt's timeouts; the probes decide when it is back
+  if (sensorFailed) {
+    return FALLBACK_DISTANCE;
+  }
+  
+  int distances[READING_ATTEMPTS_LIMIT]; // Store all readings
   int validCount = 0;
   
+  fullReadings++;
+  
   // Take multiple readings
-  for (int i = 0; i < MAX_READING_ATTEMPTS; i++) {
+  for (int i = 0; i < readingAttempts; i++) {
     // Use a non-blocking approach for multiple readings
-    int reading = static_cast<int>(sensor->Ranging());
+    int reading = static_cast<int>(sensor.Ranging());
     
-    if (debugEnabled) {
+    if (FEATURE_DIAGNOSTICS && debugEnabled) {
       MessageManager::sendF("Debug - Reading attempt %d: %dcm", i+1, reading);
     }
     
@@ -42,26 +63,28 @@ int SensorManager::getValidDistance() {
       distances[validCount++] = reading;
     }
     
-    // Smaller delay between readings
-    delay(10);
+    // After a failed reading, one more silent attempt is enough to confirm the failure
+    if (validCount == 0 && consecutiveFailedReadings > 0) {
+      break;
+    }
+    
+    // Let the echo die down between readings; the reading is done after the last one
+    if (i + 1 < readingAttempts) {
+      delay(10);
+    }
   }
   
   // If no valid readings, handle sensor issues
   if (validCount == 0) {
     consecutiveFailedReadings++;
     
-    if (debugEnabled) {
+    if (FEATURE_DIAGNOSTICS && debugEnabled) {
       MessageManager::sendF("Debug - No valid readings (%d consecutive failures). Check connections.", 
                                     consecutiveFailedReadings);
     }
     
-    // If we have repeated failures, alert but use last known valid distance if available
-    if (consecutiveFailedReadings >= 5) {
-      MessageManager::send("WARNING: Ultrasonic sensor may be disconnected or malfunctioning");
-      
-      // If we have a previous valid reading, use it with an added safety margin
-      // otherwise return a default safe value
-      return (lastValidDistance > 0) ? lastValidDistance / 2 : FALLBACK_DISTANCE;
+    if (consecutiveFailedReadings >= SENSOR_TRIP_FAILURES) {
+      trip();
     }
     
     return FALLBACK_DISTANCE; // Return a large value to prevent false obstacle detection
@@ -71,68 +94,196 @@ int SensorManager::getValidDistance() {
   consecutiveFailedReadings = 0;
   
   // With multiple readings, return the median (more robust against outliers)
-  if (validCount > 1) {
-    // Sort the array
-    for (int i = 0; i < validCount - 1; i++) {
-      for (int j = i + 1; j < validCount; j++) {
-        if (distances[i] > distances[j]) {
-          // Swap
-          int temp = distances[i];
-          distances[i] = distances[j];
-          distances[j] = temp;
-        }
-      }
-    }
-    
-    // Store and return the median value
-    lastValidDistance = distances[validCount / 2];
-    return lastValidDistance;
-  }
+  lastValidDistance = median(distances, validCount);
   
-  // Store and return the single valid reading
-  lastValidDistance = distances[0];
+  // A full reading inside the gate starts the near-field median from it
+  if (lastValidDistance <= RANGE_GATE_CM) {
+    nearPings[0] = lastValidDistance;
+    nearPingCount = 1;
+    nearPingNext = 1 % readingAttempts;
+  }
+  onSample(lastValidDistance);
   return lastValidDistance;
 }
 
-bool SensorManager::checkForObstacles(unsigned long currentTime) {
-  static int lastDistance = FALLBACK_DISTANCE; // Start with a large value
-  static unsigned long lastFullCheckTime = 0;
+bool SensorManager::takeNearFieldReading() {
+  TRACE_SCOPE("SensorManager::takeNearFieldReading");
+  int reading = static_cast<int>(sensor.Ranging(RANGE_GATE_CM));
   
-  if (!avoidanceEnabled) {
-    return false;
+  if (FEATURE_DIAGNOSTICS && debugEnabled) {
+    MessageManager::sendF("Debug - Gated ping: %dcm", reading);
   }
   
-  // Quick check based on timing
-  if (currentTime - lastObstacleCheck < OBSTACLE_CHECK_INTERVAL) {
+  // No echo inside the gate looks the same as a dead sensor, so the full reading decides
+  if (reading < MIN_VALID_DISTANCE || reading > RANGE_GATE_CM) {
+    nearField = false;
     return false;
   }
+  nearReadings++;
+  consecutiveFailedReadings = 0;
   
-  lastObstacleCheck = currentTime;
+  if (nearPingCount > readingAttempts) {
+    nearPingCount = readingAttempts;  // The attempt count was lowered since the window started
+  }
+  if (nearPingNext >= readingAttempts) {
+    nearPingNext = 0;
+  }
+  nearPings[nearPingNext] = reading;
+  nearPingNext = (nearPingNext + 1) % readingAttempts;
+  if (nearPingCount < readingAttempts) {
+    nearPingCount++;
+  }
   
-  // Adaptive timing: if clear path, check less frequently
-  if (lastDistance > 100 && (currentTime - lastFullCheckTime < 1000)) {
-    // Gradually increase the check interval based on distance
-    unsigned long adjustedInterval = map(lastDistance, 100, 300, 1000, 2000);
-    if (currentTime - lastFullCheckTime < adjustedInterval) {
-      return false;
+  int window[READING_ATTEMPTS_LIMIT];
+  memcpy(window, nearPings, nearPingCount * sizeof(int));
+  lastValidDistance = median(window, nearPingCount);
+  onSample(lastValidDistance);
+  return true;
+}
+
+int SensorManager::median(int* values, int count) {
+  // Insertion sort; count is at most READING_ATTEMPTS_LIMIT
+  for (int i = 1; i < count; i++) {
+    int value = values[i];
+    int j = i - 1;
+    for (; j >= 0 && values[j] > value; j--) {
+      values[j + 1] = values[j];
     }
+    values[j + 1] = value;
   }
+  return values[count / 2];
+}
+
+void SensorManager::onSample(int distance) {
+  TRACE_COUNTER("distance cm", distance);
+  readingPending = true;
+  pendingDistance = distance;
+  pendingMicros = micros();
   
-  // Get a valid distance reading
-  lastDistance = getValidDistance();
-  lastFullCheckTime = currentTime;
+  // Near an obstacle read several times as often, with pings that give up at the gate. With
+  // clear space ahead read less often, but soon enough that the car cannot cover more than half
+  // the margin between readings even at top speed.
+  nearField = distance <= RANGE_GATE_CM;
+  sampleInterval = obstacleCheckInterval;
+  if (nearField) {
+    sampleInterval = min(obstacleCheckInterval, (unsigned long)NEAR_CHECK_INTERVAL);
+  } else if (distance > 100) {
+    unsigned long halfMargin = (unsigned long)(distance - obstacleDistance) * 1000 / (2 * DRIVE_TOP_SPEED_CM_S);
+    sampleInterval = constrain(halfMargin, obstacleCheckInterval, (unsigned long)OBSTACLE_MAX_CHECK_INTERVAL);
+  }
+}
+
+void SensorManager::trip() {
+  sensorFailed = true;
+  tripPending = true;
+  failedSince = millis();
+  lastProbeTime = failedSince;
+  probeInterval = SENSOR_PROBE_MIN_MS;
+  probes = 0;
+  trips++;
+  TRACE_INSTANT("sensor: tripped");
+  MessageManager::sendF("WARNING: Ultrasonic sensor failed (no echo in %d readings) - avoidance suspended, probing",
+                        consecutiveFailedReadings);
+}
+
+void SensorManager::updateBreaker(unsigned long currentTime) {
+  if (!sensorFailed || currentTime - lastProbeTime < probeInterval) {
+    return;
+  }
+  lastProbeTime = currentTime;
+  probes++;
+  
+  unsigned long echo = sensor.Ping(SENSOR_PROBE_TIMEOUT);
+  int distance = (int)(echo * 0.0343f / 2);
+  if (echo == 0 || distance < MIN_VALID_DISTANCE || distance >= MAX_VALID_DISTANCE) {
+    // Still silent: back off so a dead sensor costs almost nothing
+    probeInterval = min(probeInterval * 2, (unsigned long)SENSOR_PROBE_MAX_MS);
+    return;
+  }
+  
+  // Echoes are back: resume full readings at the normal rate
+  sensorFailed = false;
+  consecutiveFailedReadings = 0;
+  nearField = false;
+  lastValidDistance = distance;
+  sampleInterval = obstacleCheckInterval;
+  TRACE_INSTANT("sensor: restored");
+  MessageManager::sendF("Ultrasonic sensor restored after %lu ms and %lu probes (%d cm)",
+                        currentTime - failedSince, probes, distance);
+}
+
+bool SensorManager::isSensorFailed() const {
+  return sensorFailed;
+}
+
+bool SensorManager::takeTripEvent() {
+  bool tripped = tripPending;
+  tripPending = false;
+  return tripped;
+}
+
+unsigned long SensorManager::millisUntilNextProbe(unsigned long currentTime) const {
+  if (!sensorFailed) {
+    return ULONG_MAX;
+  }
+  unsigned long elapsed = currentTime - lastProbeTime;
+  return elapsed >= probeInterval ? 0 : probeInterval - elapsed;
+}
+
+void SensorManager::printStatus() const {
+  if (!sensorFailed) {
+    MessageManager::sendF("Sensor: OK (%lu trips since boot); %lu full readings, %lu gated within %d cm",
+                          trips, fullReadings, nearReadings, RANGE_GATE_CM);
+    return;
+  }
+  MessageManager::sendF("Sensor: FAILED for %lu ms - degraded mode, avoidance suspended; %lu probes, every %lu ms",
+                        millis() - failedSince, probes, probeInterval);
+}
+
+unsigned long SensorManager::pingRaw(unsigned long timeoutMicros) {
+  return sensor.Ping(timeoutMicros);
+}
+
+bool SensorManager::updateRanging(unsigned long currentTime) {
+  if (!avoidanceEnabled || sensorFailed || currentTime - lastSampleTime < sampleInterval) {
+    return false;
+  }
+  lastSampleTime = currentTime;
   
-  if (debugEnabled) {
-    MessageManager::sendF("Debug - Current distance: %dcm", lastDistance);
+  // A reading without an echo is not clear space; check again at the base rate
+  sampleInterval = obstacleCheckInterval;
+  if (nearField && takeNearFieldReading()) {
+    return true;
   }
+  int distance = getValidDistance();
   
-  // Return true if an obstacle is detected within range (defined in config.h)
-  return (lastDistance > MIN_VALID_DISTANCE && lastDistance <= OBSTACLE_DETECTION_DISTANCE);
+  if (FEATURE_DIAGNOSTICS && debugEnabled) {
+    MessageManager::sendF("Debug - Current distance: %dcm", distance);
+  }
+  return true;
+}
+
+unsigned long SensorManager::millisUntilNextSample(unsigned long currentTime) const {
+  if (!avoidanceEnabled || sensorFailed) {
+    return ULONG_MAX;
+  }
+  unsigned long elapsed = currentTime - lastSampleTime;
+  return elapsed >= sampleInterval ? 0 : sampleInterval - elapsed;
+}
+
+bool SensorManager::takeReading(int* distanceCm, unsigned long* sampleMicros) {
+  if (!readingPending) {
+    return false;
+  }
+  readingPending = false;
+  *distanceCm = pendingDistance;
+  *sampleMicros = pendingMicros;
+  return true;
 }
 
 void SensorManager::setAvoidanceEnabled(bool enabled) {
   avoidanceEnabled = enabled;
-  if (debugEnabled) {
+  if (FEATURE_DIAGNOSTICS && debugEnabled) {
     MessageManager::sendF("Obstacle avoidance %s", enabled ? "enabled" : "disabled");
   }
 }
@@ -147,4 +298,34 @@ bool SensorManager::isAvoidanceEnabled() const {
 
 bool SensorManager::isDebugEnabled() const {
   return debugEnabled;
+}
+
+void SensorManager::setObstacleDistance(int distance) {
+  obstacleDistance = distance;
+}
+
+void SensorManager::setObstacleCheckInterval(unsigned long interval) {
+  obstacleCheckInterval = interval;
+}
+
+void SensorManager::setReadingAttempts(int attempts) {
+  // Constrain to the size of the reading buffer
+  if (attempts < 1) {
+    attempts = 1;
+  } else if (attempts > READING_ATTEMPTS_LIMIT) {
+    attempts = READING_ATTEMPTS_LIMIT;
+  }
+  readingAttempts = attempts;
+}
+
+int SensorManager::getObstacleDistance() const {
+  return obstacleDistance;
+}
+
+unsigned long SensorManager::getObstacleCheckInterval() const {
+  return obstacleCheckInterval;
+}
+
+int SensorManager::getReadingAttempts() const {
+  return readingAttempts;
 }
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include "../include/serial_receiver.h"
+
+// A host waiting for credit to send its longest line must always be owed at least a batch,
+// or it would wait forever
+static_assert(FLOW_CREDIT_BATCH + MAX_COMMAND_LENGTH + 2 <= SERIAL_RX_QUEUE,
+              "FLOW_CREDIT_BATCH too large for SERIAL_RX_QUEUE and MAX_COMMAND_LENGTH");
+
+SerialReceiver::SerialReceiver(MovementController* moveCtrl, IdleScheduler* idleSched) {
+  movementCtrl = moveCtrl;
+  idleScheduler = idleSched;
+  droppedBytes = 0;
+  queuedBytes = 0;
+  readBytes = 0;
+  readStamp.endCount = 0;
+  readStamp.atMicros = 0;
+  flowControl = false;
+  creditsOwed = 0;
+  creditsReturned = 0;
+}
+
+void SerialReceiver::init() {
+  Serial.onReceive([this]() { onReceive(); });
+}
+
+void SerialReceiver::onReceive() {
+  uint32_t now = micros();
+  uint32_t before = queuedBytes;
+  while (Serial.available() > 0) {
+    char c = (char)Serial.read();
+    if (c == ESTOP_BYTE) {
+      movementCtrl->emergencyStop();
+    } else if (received.push(c)) {
+      queuedBytes++;
+    } else {
+      droppedBytes = droppedBytes + 1;
+    }
+  }
+  if (queuedBytes != before) {
+    stamps.push({queuedBytes, now});
+  }
+  idleScheduler->onSerialReceive();
+}
+
+bool SerialReceiver::read(char& c, unsigned long* arrivalMicros) {
+  if (!received.pop(c)) {
+    return false;
+  }
+  creditsOwed++;
+  readBytes++;
+  if (arrivalMicros != nullptr) {
+    *arrivalMicros = arrivalOf(readBytes);
+  } else {
+    arrivalOf(readBytes);
+  }
+  return true;
+}
+
+bool SerialReceiver::nextArrival(unsigned long* arrivalMicros) {
+  if (received.empty()) {
+    return false;
+  }
+  *arrivalMicros = arrivalOf(readBytes + 1);
+  return true;
+}
+
+unsigned long SerialReceiver::arrivalOf(uint32_t byteCount) {
+  // Move on to the first stamp whose callback queued this byte
+  while ((int32_t)(readStamp.endCount - byteCount) < 0 && stamps.pop(readStamp)) {
+  }
+  return (int32_t)(readStamp.endCount - byteCount) >= 0 ? readStamp.atMicros : micros();
+}
+
+bool SerialReceiver::available() const {
+  return !received.empty();
+}
+
+size_t SerialReceiver::waiting() const {
+  return received.size();
+}
+
+void SerialReceiver::setFlowControl(bool enabled) {
+  flowControl = enabled;
+  creditsOwed = 0;
+  creditsReturned = 0;
+}
+
+bool SerialReceiver::isFlowControlEnabled() const {
+  return flowControl;
+}
+
+unsigned long SerialReceiver::takeCredits() {
+  if (!flowControl || creditsOwed < FLOW_CREDIT_BATCH) {
+    return 0;
+  }
+  unsigned long credits = creditsOwed;
+  creditsOwed = 0;
+  creditsReturned += credits;
+  return credits;
+}
+
+unsigned long SerialReceiver::getCreditsReturned() const {
+  return creditsReturned;
+}
+
+unsigned long SerialReceiver::getDroppedBytes() const {
+  return droppedBytes;
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "../include/speed_governor.h"
+#include "../include/message_manager.h"
+#include "../include/trace.h"
+
+SpeedGovernor::SpeedGovernor() {
+  enabled = false;
+  hasReading = false;
+  lastDistance = 0;
+  lastReadingMicros = 0;
+  closingSpeed = 0;
+  limit = MAX_SPEED;
+  readings = 0;
+  governedReadings = 0;
+  lowestLimit = MAX_SPEED;
+}
+
+void SpeedGovernor::setEnabled(bool enable) {
+  if (enable && !enabled) {
+    hasReading = false;
+    closingSpeed = 0;
+    readings = 0;
+    governedReadings = 0;
+    lowestLimit = MAX_SPEED;
+  }
+  enabled = enable;
+  limit = MAX_SPEED;
+}
+
+bool SpeedGovernor::isEnabled() const {
+  return enabled;
+}
+
+void SpeedGovernor::update(int distanceCm, unsigned long sampleMicros) {
+  if (!enabled) {
+    return;
+  }
+  readings++;
+  
+  // Closing speed from consecutive readings; readings far apart say nothing about the current approach
+  if (hasReading) {
+    unsigned long elapsed = sampleMicros - lastReadingMicros;
+    if (elapsed > 0 && elapsed <= GOVERNOR_READING_GAP_MS * 1000UL) {
+      float rate = (lastDistance - distanceCm) * 1000000.0f / elapsed;
+      float alpha = 1.0f - expf(-(float)elapsed / (GOVERNOR_SMOOTHING_MS * 1000.0f));
+      closingSpeed += alpha * (rate - closingSpeed);
+    } else {
+      closingSpeed = 0;
+    }
+  }
+  hasReading = true;
+  lastDistance = distanceCm;
+  lastReadingMicros = sampleMicros;
+  
+  // Share of full speed the margin above the floor allows, and the time left to reach the floor
+  float margin = (float)(distanceCm - GOVERNOR_FLOOR_CM);
+  float share = constrain(margin / (GOVERNOR_SLOW_CM - GOVERNOR_FLOOR_CM), 0.0f, 1.0f);
+  if (closingSpeed > 0) {
+    float millisToFloor = margin / closingSpeed * 1000.0f;
+    share = min(share, constrain(millisToFloor / GOVERNOR_HORIZON_MS, 0.0f, 1.0f));
+  }
+  
+  limit = GOVERNOR_MIN_PWM + (int)((MAX_SPEED - GOVERNOR_MIN_PWM) * share);
+  TRACE_COUNTER("governor pwm", limit);
+  if (limit < MAX_SPEED) {
+    governedReadings++;
+  }
+  if (limit < lowestLimit) {
+    lowestLimit = limit;
+  }
+}
+
+int SpeedGovernor::getLimit() const {
+  return enabled ? limit : MAX_SPEED;
+}
+
+int SpeedGovernor::floorDistance(int obstacleDistance) const {
+  return enabled ? min(obstacleDistance, GOVERNOR_FLOOR_CM) : obstacleDistance;
+}
+
+void SpeedGovernor::printStatus() const {
+  if (!enabled) {
+    MessageManager::send("Speed governor: Disabled");
+    return;
+  }
+  MessageManager::sendF("Speed governor: Enabled, forward cap %d PWM, closing at %d cm/s; %lu of %lu readings capped, lowest %d",
+                        limit, (int)closingSpeed, governedReadings, readings, lowestLimit);
+}
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "../include/state_checkpoint.h"
+#include "../include/loop_watchdog.h"
+#include "../include/message_manager.h"
+#include "../include/trace.h"
+#include <esp_attr.h>
+#include <esp_system.h>
+
+// Marks a slot as written by this layout of the firmware; anything else is power-on noise
+static const uint32_t CHECKPOINT_MAGIC = 0x53544B31;
+
+// One checkpoint as kept in RTC memory
+struct CheckpointSlot {
+  uint32_t magic;
+  uint32_t generation;     // Checkpoints written since the last cold boot, this one included
+  uint32_t unstableBoots;  // Warm boots in a row without CHECKPOINT_STABLE_MS of uptime
+  RuntimeState state;
+  uint32_t checksum;       // FNV-1a over everything above
+};
+
+RTC_NOINIT_ATTR static CheckpointSlot checkpointSlots[2];
+
+static uint32_t slotChecksum(const CheckpointSlot& slot) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&slot);
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < offsetof(CheckpointSlot, checksum); i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static bool slotValid(const CheckpointSlot& slot) {
+  return slot.magic == CHECKPOINT_MAGIC && slot.checksum == slotChecksum(slot) &&
+         slot.state.sequenceCount <= CHECKPOINT_SEQUENCES;
+}
+
+StateCheckpoint::StateCheckpoint() {
+  warmBoot = false;
+  resetReason = 0;
+  generation = 0;
+  unstableBoots = 0;
+  bootMillis = 0;
+  memset(&recovered, 0, sizeof(recovered));
+}
+
+bool StateCheckpoint::init() {
+  resetReason = esp_reset_reason();
+  bootMillis = millis();
+  warmBoot = false;
+  
+  // RTC memory holds noise after power-on, however plausible it looks
+  const CheckpointSlot* newest = nullptr;
+  if (resetReason != ESP_RST_POWERON) {
+    for (int i = 0; i < 2; i++) {
+      const CheckpointSlot& slot = checkpointSlots[i];
+      if (slotValid(slot) && (newest == nullptr || (int32_t)(slot.generation - newest->generation) > 0)) {
+        newest = &slot;
+      }
+    }
+  }
+  
+  if (newest != nullptr) {
+    warmBoot = true;
+    recovered = newest->state;
+    generation = newest->generation;
+    unstableBoots = newest->unstableBoots + 1;
+  } else {
+    generation = 0;
+    unstableBoots = 0;
+  }
+  return warmBoot;
+}
+
+bool StateCheckpoint::isWarmBoot() const {
+  return warmBoot;
+}
+
+const RuntimeState& StateCheckpoint::getRecovered() const {
+  return recovered;
+}
+
+uint32_t StateCheckpoint::getUnstableBoots() const {
+  return unstableBoots;
+}
+
+unsigned long StateCheckpoint::getBootMillis() const {
+  return bootMillis;
+}
+
+uint8_t StateCheckpoint::getResetReason() const {
+  return resetReason;
+}
+
+bool StateCheckpoint::isCrashReset() const {
+  switch (resetReason) {
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void StateCheckpoint::save(const RuntimeState& state) {
+  TRACE_SCOPE("StateCheckpoint::save");
+  generation++;
+  CheckpointSlot& slot = checkpointSlots[generation & 1];
+  slot.magic = CHECKPOINT_MAGIC;
+  slot.generation = generation;
+  slot.unstableBoots = millis() - bootMillis >= CHECKPOINT_STABLE_MS ? 0 : unstableBoots;
+  slot.state = state;
+  slot.checksum = slotChecksum(slot);
+}
+
+void StateCheckpoint::printStatus() const {
+  if (warmBoot) {
+    MessageManager::sendF("Recovery: warm boot after %s reset (%lu in a row), %lu checkpoints written",
+                          LoopWatchdog::resetReasonName(resetReason), (unsigned long)unstableBoots,
+                          (unsigned long)generation);
+  } else {
+    MessageManager::sendF("Recovery: cold boot, %lu checkpoints written", (unsigned long)generation);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,255 @@
+#include "../include/sweep_mapper.h"
+#include "../include/message_manager.h"
+#include <Preferences.h>
+
+static const int TURN_LEVELS[TURN_TABLE_SIZE] = {TURN_TABLE_PWM};
+static const uint16_t DEFAULT_TURN_MS_PER_90[TURN_TABLE_SIZE] = {TURN_TABLE_MS_PER_90};
+
+// NVS namespace and key of the saved turn table
+static const char* NVS_NAMESPACE = "turn";
+static const char* NVS_TABLE_KEY = "table";
+
+// The turn table as saved. The levels it was measured at go with it, so a table from firmware
+// with other TURN_TABLE_PWM levels is left unused.
+struct SavedTurnTable {
+  uint8_t pwm[TURN_TABLE_SIZE];
+  uint16_t msPer90[TURN_TABLE_SIZE];
+};
+
+SweepMapper::SweepMapper(SensorManager* sensMgr) {
+  sensorMgr = sensMgr;
+  x = 0;
+  y = 0;
+  heading = 0;
+  command.direction = Stop;
+  command.leftSpeed = 0;
+  command.rightSpeed = 0;
+  lastTrackMicros = 0;
+  tracking = false;
+  lastSample = 0;
+  samples = 0;
+  memcpy(turnMsPer90, DEFAULT_TURN_MS_PER_90, sizeof(turnMsPer90));
+  turnTableCalibrated = false;
+}
+
+float SweepMapper::wheelSpeed(int pwm) {
+  if (pwm <= MOTOR_DEADBAND_PWM) {
+    return 0;
+  }
+  return DRIVE_TOP_SPEED_CM_S * (float)(pwm - MOTOR_DEADBAND_PWM) / (255 - MOTOR_DEADBAND_PWM);
+}
+
+float SweepMapper::turnRate(int pwm) const {
+  if (pwm <= MOTOR_DEADBAND_PWM) {
+    return 0;
+  }
+  
+  // Below the first level the rate falls to nothing at the deadband
+  int lowPwm = MOTOR_DEADBAND_PWM;
+  float lowRate = 0;
+  for (int level = 0; level < TURN_TABLE_SIZE; level++) {
+    float rate = 90000.0f / turnMsPer90[level];
+    if (pwm <= TURN_LEVELS[level]) {
+      return lowRate + (rate - lowRate) * (pwm - lowPwm) / (TURN_LEVELS[level] - lowPwm);
+    }
+    lowPwm = TURN_LEVELS[level];
+    lowRate = rate;
+  }
+  return lowRate;
+}
+
+// Signed direction of the motor pair whose forward and backward bits are given
+static int sideSign(int direction, int forwardBit, int backwardBit) {
+  if (direction & forwardBit) {
+    return 1;
+  }
+  return (direction & backwardBit) ? -1 : 0;
+}
+
+void SweepMapper::track(const MotorCommand& applied, unsigned long nowMicros) {
+  if (tracking && command.direction != Stop) {
+    float dt = (nowMicros - lastTrackMicros) / 1000000.0f;
+    int leftSign = sideSign(command.direction, M1_Forward, M1_Backward);
+    int rightSign = sideSign(command.direction, M3_Forward, M3_Backward);
+    float left = leftSign * wheelSpeed(command.leftSpeed);
+    float right = rightSign * wheelSpeed(command.rightSpeed);
+    
+    // Skid steering loses most of the wheel speed, so turn rate comes from the measured spin:
+    // each side contributes half the in-place rate at its duty
+    float linear = (left + right) / 2;
+    float rate = (rightSign * turnRate(command.rightSpeed) - leftSign * turnRate(command.leftSpeed)) / 2;
+    
+    heading += rate * DEG_TO_RAD * dt;
+    if (heading > PI) {
+      heading -= 2 * PI;
+    } else if (heading < -PI) {
+      heading += 2 * PI;
+    }
+    x += linear * cosf(heading) * dt;
+    y += linear * sinf(heading) * dt;
+    grid.recenter(x, y);
+    
+    // Wherever the car has been is free
+    grid.markFree(x, y);
+  }
+  
+  command = applied;
+  lastTrackMicros = nowMicros;
+  tracking = true;
+}
+
+bool SweepMapper::isRotating() const {
+  return command.direction == Clockwise || command.direction == Contrarotate;
+}
+
+void SweepMapper::update(unsigned long currentTime) {
+  if (!isRotating() || currentTime - lastSample < GRID_SAMPLE_INTERVAL_MS) {
+    return;
+  }
+  lastSample = currentTime;
+  
+  unsigned long echo = sensorMgr->pingRaw(GRID_PING_TIMEOUT);
+  if (echo == 0) {
+    // Silence is weak evidence: absorbent or slanted surfaces and a dead sensor give it too.
+    // Clear a short stretch ahead, one free step per ping, so only repeated silence opens it up
+    if (!sensorMgr->isSensorFailed()) {
+      grid.addRange(x, y, heading, 0, GRID_NO_ECHO_FREE_CM);
+      samples++;
+    }
+    return;
+  }
+  int distance = (int)(echo * 0.0343f / 2);
+  if (distance < MIN_VALID_DISTANCE) {
+    return;  // Too close to trust
+  }
+  // The echo may come from anywhere in the cone, so only its centre gets the hit;
+  // the edges only clear the space up to the reading
+  grid.addRange(x, y, heading, distance, GRID_MAX_RANGE_CM);
+  int edgeFree = distance - GRID_CELL_CM;
+  if (edgeFree > 0) {
+    grid.addRange(x, y, heading + GRID_BEAM_HALF_ANGLE * DEG_TO_RAD, 0, edgeFree);
+    grid.addRange(x, y, heading - GRID_BEAM_HALF_ANGLE * DEG_TO_RAD, 0, edgeFree);
+  }
+  samples++;
+}
+
+int SweepMapper::clearestTurn() const {
+  int bestTurn = 0;
+  int bestScore = -1;
+  bool evidence = false;
+  
+  // Smaller turns are tried first and win ties
+  for (int degrees = GRID_AHEAD_EXCLUDE_DEG; degrees <= 180; degrees += 15) {
+    for (int side = -1; side <= 1; side += 2) {
+      int turn = side * degrees;
+      
+      // The car needs a corridor, not a ray: take the worst of the centre and edge rays
+      int clear = GRID_MAX_RANGE_CM;
+      int unknown = 0;
+      for (int edge = -GRID_CORRIDOR_HALF_ANGLE; edge <= GRID_CORRIDOR_HALF_ANGLE; edge += GRID_CORRIDOR_HALF_ANGLE) {
+        int rayUnknown;
+        int rayClear = grid.clearance(x, y, heading - (turn + edge) * DEG_TO_RAD, GRID_MAX_RANGE_CM, &rayUnknown);
+        if (rayUnknown < GRID_MAX_RANGE_CM) {
+          evidence = true;
+        }
+        if (rayClear < clear || (rayClear == clear && rayUnknown > unknown)) {
+          clear = rayClear;
+          unknown = rayUnknown;
+        }
+      }
+      if (clear < GRID_MIN_CLEAR_CM) {
+        continue;
+      }
+      // Unmapped cells count half: probably free, but not seen
+      int score = 2 * clear - unknown;
+      if (score > bestScore) {
+        bestScore = score;
+        bestTurn = turn;
+      }
+    }
+  }
+  return evidence ? bestTurn : 0;
+}
+
+unsigned long SweepMapper::turnMillis(int degrees, int pwm) const {
+  float rate = turnRate(pwm);
+  if (rate <= 0) {
+    return 0;
+  }
+  return (unsigned long)(abs(degrees) / rate * 1000);
+}
+
+int SweepMapper::turnTablePwm(int level) {
+  return TURN_LEVELS[level];
+}
+
+unsigned long SweepMapper::getTurnMsPer90(int level) const {
+  return turnMsPer90[level];
+}
+
+void SweepMapper::setTurnMsPer90(int level, unsigned long msPer90, bool calibrated) {
+  turnMsPer90[level] = constrain(msPer90, 1UL, 65535UL);
+  turnTableCalibrated = calibrated;
+}
+
+void SweepMapper::loadTurnTable() {
+  SavedTurnTable saved;
+  Preferences nvs;
+  if (!nvs.begin(NVS_NAMESPACE, true)) {
+    return;
+  }
+  bool found = nvs.getBytesLength(NVS_TABLE_KEY) == sizeof(saved) &&
+               nvs.getBytes(NVS_TABLE_KEY, &saved, sizeof(saved)) == sizeof(saved);
+  nvs.end();
+  if (!found) {
+    return;
+  }
+  
+  for (int level = 0; level < TURN_TABLE_SIZE; level++) {
+    if (saved.pwm[level] != TURN_LEVELS[level] || saved.msPer90[level] == 0) {
+      return;
+    }
+  }
+  memcpy(turnMsPer90, saved.msPer90, sizeof(turnMsPer90));
+  turnTableCalibrated = true;
+}
+
+bool SweepMapper::saveTurnTable() const {
+  SavedTurnTable table;
+  memset(&table, 0, sizeof(table));
+  for (int level = 0; level < TURN_TABLE_SIZE; level++) {
+    table.pwm[level] = TURN_LEVELS[level];
+  }
+  memcpy(table.msPer90, turnMsPer90, sizeof(turnMsPer90));
+  
+  Preferences nvs;
+  if (!nvs.begin(NVS_NAMESPACE, false)) {
+    return false;
+  }
+  bool written = nvs.putBytes(NVS_TABLE_KEY, &table, sizeof(table)) == sizeof(table);
+  nvs.end();
+  return written;
+}
+
+void SweepMapper::printTurnTable() const {
+  // "<pwm>:<ms>" per level
+  char line[11 * TURN_TABLE_SIZE + 1];
+  int length = 0;
+  for (int level = 0; level < TURN_TABLE_SIZE; level++) {
+    length += snprintf(line + length, sizeof(line) - length, " %d:%u", TURN_LEVELS[level], turnMsPer90[level]);
+  }
+  MessageManager::sendF("Turn table (%s), PWM:ms per 90 deg:%s",
+                        turnTableCalibrated ? "calibrated" : "default from config.h", line);
+}
+
+void SweepMapper::printStatus() const {
+  MessageManager::sendF("Pose estimate: x=%d cm y=%d cm heading=%d deg", (int)x, (int)y, (int)(heading * RAD_TO_DEG));
+  MessageManager::sendF("Grid: %d of %d cells mapped from %lu sweep samples", grid.knownCells(),
+                        GRID_CELLS * GRID_CELLS, samples);
+  int turn = clearestTurn();
+  if (turn != 0) {
+    MessageManager::sendF("Clearest turn: %d degrees %s", abs(turn), turn > 0 ? "right" : "left");
+  } else {
+    MessageManager::send("Clearest turn: nothing mapped around the car");
+  }
+}
\ No newline at end of file
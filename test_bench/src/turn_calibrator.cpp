@@ -0,0 +1,190 @@
+#include "../include/turn_calibrator.h"
+#include "../include/message_manager.h"
+#include "../include/trace.h"
+
+#if FEATURE_CALIBRATION
+
+TurnCalibrator::TurnCalibrator(MovementController* moveCtrl, SensorManager* sensMgr, SweepMapper* mapper) {
+  movementCtrl = moveCtrl;
+  sensorMgr = sensMgr;
+  sweepMapper = mapper;
+  active = false;
+  phase = PHASE_SETTLE;
+  level = 0;
+  wallCm = 0;
+  windowCm = 0;
+  pingTimeout = 0;
+  startTime = 0;
+  levelStart = 0;
+  lastPing = 0;
+  enterMicros = 0;
+  leaveMicros = 0;
+  awayReadings = 0;
+  passes = 0;
+  firstCentreMicros = 0;
+  memset(measured, 0, sizeof(measured));
+}
+
+void TurnCalibrator::start() {
+  if (sensorMgr->isSensorFailed()) {
+    MessageManager::send("Calibration needs the ultrasonic sensor, which has failed");
+    return;
+  }
+  
+  wallCm = sensorMgr->getValidDistance();
+  if (wallCm < CALIBRATION_MIN_CM || wallCm > CALIBRATION_MAX_CM) {
+    MessageManager::sendF("Calibration needs a wall %d-%d cm ahead; the reading is %d cm", CALIBRATION_MIN_CM,
+                          CALIBRATION_MAX_CM, wallCm);
+    return;
+  }
+  
+  // Pings only need to reach the edge of the window, which keeps each one short
+  windowCm = wallCm * CALIBRATION_WINDOW_PCT / 100;
+  pingTimeout = CALIBRATION_ECHO_START_US +
+                (unsigned long)((windowCm + CALIBRATION_HYSTERESIS_CM + MIN_VALID_DISTANCE) * 2 / 0.0343f);
+  
+  active = true;
+  startTime = millis();
+  level = 0;
+  MessageManager::sendF("Calibrating turns against a wall at %d cm: %d levels, keep %d cm clear all round",
+                        wallCm, TURN_TABLE_SIZE, windowCm + CALIBRATION_HYSTERESIS_CM);
+  startLevel(startTime);
+}
+
+void TurnCalibrator::startLevel(unsigned long currentTime) {
+  movementCtrl->rotate(true, SweepMapper::turnTablePwm(level));
+  phase = PHASE_SETTLE;
+  levelStart = currentTime;
+  lastPing = currentTime;
+  awayReadings = 0;
+  passes = 0;
+}
+
+void TurnCalibrator::abort(const char* reason, bool stopCar) {
+  if (!active) {
+    return;
+  }
+  active = false;
+  if (stopCar) {
+    movementCtrl->stop();
+  }
+  MessageManager::sendF("Turn calibration aborted at PWM %d: %s; turn table unchanged",
+                        SweepMapper::turnTablePwm(level), reason);
+}
+
+bool TurnCalibrator::isActive() const {
+  return active;
+}
+
+void TurnCalibrator::update(unsigned long currentTime) {
+  if (!active) {
+    return;
+  }
+  
+  // Anything else that moves the car, the emergency stop included, ends the calibration
+  MotorCommand command = movementCtrl->getMotorCommand();
+  if (command.direction != Clockwise || command.leftSpeed != SweepMapper::turnTablePwm(level)) {
+    abort("the car was given another motion", false);
+    return;
+  }
+  if (currentTime - levelStart >= CALIBRATION_LEVEL_TIMEOUT_MS) {
+    abort("no full revolution past the wall", true);
+    return;
+  }
+  
+  if (phase == PHASE_SETTLE) {
+    if (currentTime - levelStart >= CALIBRATION_SETTLE_MS) {
+      phase = PHASE_LEAVE;
+    }
+    return;
+  }
+  if (currentTime - lastPing < CALIBRATION_PING_MS) {
+    return;
+  }
+  lastPing = currentTime;
+  
+  TRACE_SCOPE("TurnCalibrator::ping");
+  unsigned long echo = sensorMgr->pingRaw(pingTimeout);
+  unsigned long nowMicros = micros();
+  int distance = (int)(echo * 0.0343f / 2);
+  bool facing = echo > 0 && distance >= MIN_VALID_DISTANCE && distance <= windowCm;
+  bool away = echo == 0 || distance > windowCm + CALIBRATION_HYSTERESIS_CM;
+  onReading(facing, away, nowMicros, currentTime);
+}
+
+void TurnCalibrator::onReading(bool facing, bool away, unsigned long nowMicros, unsigned long currentTime) {
+  switch (phase) {
+    case PHASE_LEAVE:
+      // As below, one reading past the window may be a missed echo
+      awayReadings = away ? awayReadings + 1 : 0;
+      if (awayReadings >= 2) {
+        phase = PHASE_APPROACH;
+      }
+      break;
+      
+    case PHASE_APPROACH:
+      if (facing) {
+        enterMicros = nowMicros;
+        awayReadings = 0;
+        phase = PHASE_FACING;
+      }
+      break;
+      
+    case PHASE_FACING: {
+      // Two readings in a row confirm the car has turned past; a lone one is a missed echo
+      if (!away) {
+        awayReadings = 0;
+        break;
+      }
+      if (awayReadings++ == 0) {
+        leaveMicros = nowMicros;
+      }
+      if (awayReadings < 2) {
+        break;
+      }
+      
+      // Entry and exit lag the window edges alike, so the pass centres are a revolution apart
+      unsigned long centre = enterMicros + (leaveMicros - enterMicros) / 2;
+      phase = PHASE_APPROACH;
+      if (passes++ == 0) {
+        firstCentreMicros = centre;
+        break;
+      }
+      measured[level] = (centre - firstCentreMicros + 2000) / 4000;
+      MessageManager::sendF("PWM %d: %lu ms per 90 degrees (table had %lu)", SweepMapper::turnTablePwm(level),
+                            measured[level], sweepMapper->getTurnMsPer90(level));
+      
+      if (++level == TURN_TABLE_SIZE) {
+        finish(currentTime);
+      } else {
+        startLevel(currentTime);
+      }
+      break;
+    }
+    
+    default:
+      break;
+  }
+}
+
+void TurnCalibrator::finish(unsigned long currentTime) {
+  active = false;
+  movementCtrl->stop();
+  
+  // "a, b, ..." for the config.h line
+  char values[7 * TURN_TABLE_SIZE + 1];
+  int length = 0;
+  for (int i = 0; i < TURN_TABLE_SIZE; i++) {
+    sweepMapper->setTurnMsPer90(i, measured[i], true);
+    length += snprintf(values + length, sizeof(values) - length, "%s%lu", i > 0 ? ", " : "", measured[i]);
+  }
+  
+  // A flash write blocks for a few milliseconds, once, with the car stopped
+  bool saved = sweepMapper->saveTurnTable();
+  MessageManager::sendF("Turn table calibrated in %lu s, %s", (currentTime - startTime) / 1000,
+                        saved ? "saved to NVS" : "but saving it to NVS failed: it lasts until reset");
+  sweepMapper->printTurnTable();
+  MessageManager::sendF("To make it the default, set in config.h: #define TURN_TABLE_MS_PER_90 %s", values);
+}
+
+#endif // FEATURE_CALIBRATION
\ No newline at end of file
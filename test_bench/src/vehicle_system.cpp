@@ -0,0 +1,304 @@
+#include "../include/vehicle_system.h"
+#include "../include/message_manager.h"
+
+// Interval for the periodic status message
+static const unsigned long HEARTBEAT_INTERVAL = 30000; // Every 30 seconds
+
+VehicleSystem::VehicleSystem()
+  : sweepMapper(&sensorManager),
+    movementController(&ledManager, &sweepMapper),
+    scanCapture(&sensorManager),
+    intentFilter(&movementController),
+    serialReceiver(&movementController, &idleScheduler),
+    missionVm(&movementController, &sensorManager),
+    turnCalibrator(&movementController, &sensorManager, &sweepMapper),
+    commandProcessor(&movementController, &sensorManager, &watchdog, &scanCapture, &intentFilter,
+                     &idleScheduler, &sweepMapper, &missionVm, &serialReceiver, &speedGovernor,
+                     &stateCheckpoint, &turnCalibrator) {
+  lastLedUpdate = 0;
+  lastHeartbeatTime = 0;
+}
+
+void VehicleSystem::setup() {
+  // Initialize serial communication
+  Serial.begin(115200);
+  
+  // A watchdog or panic reset leaves the last checkpoint in RTC memory; the host is already
+  // listening then, so skip the wait for it
+  bool warmBoot = stateCheckpoint.init();
+  
+  // Wait for serial to initialize
+  if (BOOT_SERIAL_DELAY_MS > 0 && !warmBoot) {
+    delay(BOOT_SERIAL_DELAY_MS);
+  }
+  
+  Serial.println("\n\nBCI-Controlled Test-bench Vehicle");
+  MessageManager::sendF("Build profile: %s, %u bytes of system state", BUILD_PROFILE_NAME,
+                        (unsigned)sizeof(VehicleSystem));
+  
+  // Recover stall records from before a reset and arm the task watchdog
+  watchdog.init();
+  
+  // Initialize LED manager
+  ledManager.init();
+  
+  // Initialize sensor manager; after a warm boot the first loop iteration's reading is the warm-up
+  sensorManager.init(ULTRASONIC_TRIG_PIN, ULTRASONIC_ECHO_PIN, !warmBoot);
+  
+  // Initialize movement controller
+  movementController.init();
+  
+  // Time turns from the table the last calibration saved, if any
+  sweepMapper.loadTurnTable();
+  
+  // Take over the UART receive path; from here the emergency stop byte works even if the loop hangs
+  serialReceiver.init();
+  
+  // Print system information and instructions
+  MessageManager::send("System ready - Connected via USB Serial");
+  MessageManager::send("Left LED = movement/obstacles, Right LED = operational status");
+  
+  // Set initial heartbeat time
+  lastHeartbeatTime = millis();
+  
+  // Let serial input wake the loop from idle sleeps
+  idleScheduler.init(&serialReceiver);
+  
+  if (warmBoot) {
+    restoreState();
+    return;
+  }
+  
+  // Print help info to the serial console; profiles without help text keep boot output short
+  if (FEATURE_HELP_TEXT) {
+    MessageManager::send("\nAvailable commands:");
+    commandProcessor.printHelpInfo();
+  } else {
+    MessageManager::send("Type 'help' for available commands.");
+  }
+}
+
+void VehicleSystem::loop() {
+  watchdog.beginLoop();
+  unsigned long currentMillis = millis();
+  
+  // After a serial wake, serve the command before anything that could block on the sensor
+  bool servingWake = idleScheduler.consumeSerialWake();
+  
+  // LED updates (important for user feedback)
+  watchdog.enterStage(STAGE_LEDS);
+  if (currentMillis - lastLedUpdate >= 20) {
+    lastLedUpdate = currentMillis;
+    ledManager.updateStatus(currentMillis, true); // Always show connected status
+  }
+  
+  // Check for movement completion and avoidance maneuver updates
+  watchdog.enterStage(STAGE_MOTION);
+  if (movementController.takeEmergencyStop()) {
+    missionVm.abort("emergency stop");
+  }
+  movementController.checkTimedMovements(currentMillis);
+  movementController.updateAvoidanceManeuver(currentMillis);
+  intentFilter.update(currentMillis);
+  
+  // Uploaded mission program, a bounded number of instructions per iteration; it waits while a
+  // raw capture or a turn calibration owns the sensor
+  watchdog.enterStage(STAGE_MISSION);
+  if (!scanCapture.isActive() && !turnCalibrator.isActive()) {
+    missionVm.update(currentMillis);
+  }
+  
+  // Raw capture and turn calibration own the sensor while they run
+  watchdog.enterStage(STAGE_SCAN);
+  scanCapture.update();
+  turnCalibrator.update(currentMillis);
+  
+  // Map the surroundings while turning in place, then check for obstacles when necessary;
+  // a running maneuver is never restarted
+  watchdog.enterStage(STAGE_RANGING);
+  bool sensorOwned = scanCapture.isActive() || turnCalibrator.isActive();
+  if (!servingWake && !sensorOwned) {
+    sensorManager.updateBreaker(currentMillis);
+    if (!sensorManager.isSensorFailed()) {
+      sweepMapper.update(currentMillis);
+    }
+  }
+  if (!servingWake && !sensorOwned && movementController.canStartAvoidance()) {
+    sensorManager.updateRanging(currentMillis);
+  }
+  handleReading();
+  
+  // A failed sensor leaves the car blind: end any mission that ranges and stop until the operator
+  // drives it again
+  if (sensorManager.takeTripEvent()) {
+    missionVm.abort("sensor failed");
+    if (!movementController.isIdle()) {
+      movementController.stop();
+    }
+  }
+  
+  // Process serial input - this is now our primary way to receive commands
+  watchdog.enterStage(STAGE_COMMANDS);
+  if (serialReceiver.available()) {
+    commandProcessor.processSerialInput();
+    handleReading();
+  }
+  idleScheduler.commandsServiced();
+  
+  // Write the winning motion proposal once per tick
+  watchdog.enterStage(STAGE_MOTOR_WRITE);
+  movementController.setForwardBlocked(sensorManager.isSensorFailed());
+  movementController.setForwardLimit(sensorManager.isAvoidanceEnabled() ? speedGovernor.getLimit() : MAX_SPEED);
+  movementController.applyMotion();
+  sweepMapper.track(movementController.getMotorCommand(), micros());
+  
+  // Lower priority maintenance tasks
+  watchdog.enterStage(STAGE_HEARTBEAT);
+  if (currentMillis - lastHeartbeatTime >= HEARTBEAT_INTERVAL) {
+    lastHeartbeatTime = currentMillis;
+    
+    // Send periodic status update
+    MessageManager::send(sensorManager.isSensorFailed() ? "System running - sensor failed, avoidance suspended"
+                                                        : "System running - ready for commands");
+  }
+  
+  // Checkpoint last, so a command counts as run only once its effects are saved with it
+  RuntimeState state;
+  captureState(&state);
+  stateCheckpoint.save(state);
+  
+  watchdog.endLoop();
+  
+  // Nothing moves while stopped, so block until the next timer is due or the host sends something
+  if (movementController.isIdle() && !scanCapture.isActive() && !serialReceiver.available()) {
+    idleScheduler.sleepFor(millisUntilNextTask(millis()));
+  }
+}
+
+void VehicleSystem::handleReading() {
+  // Evaluated as soon as the reading completes, so the stop does not wait for the motor stage
+  int distance;
+  unsigned long sampleMicros;
+  if (!sensorManager.takeReading(&distance, &sampleMicros) || !sensorManager.isAvoidanceEnabled()) {
+    return;
+  }
+  speedGovernor.update(distance, sampleMicros);
+  if (distance <= speedGovernor.floorDistance(sensorManager.getObstacleDistance())) {
+    movementController.reactToObstacle(distance, sampleMicros);
+  }
+}
+
+void VehicleSystem::captureState(RuntimeState* state) const {
+  memset(state, 0, sizeof(*state));
+  state->speed = movementController.getSpeed();
+  state->setpointTimeout = movementController.getSetpointTimeout();
+  if (sensorManager.isAvoidanceEnabled()) {
+    state->flags |= STATE_AVOIDANCE;
+  }
+  if (speedGovernor.isEnabled()) {
+    state->flags |= STATE_GOVERNOR;
+  }
+  if (movementController.isSetpointMode()) {
+    state->flags |= STATE_SETPOINTS;
+  }
+  if (intentFilter.isEnabled()) {
+    state->flags |= STATE_INTENT;
+  }
+  if (movementController.isEmergencyStopped()) {
+    state->flags |= STATE_ESTOP;
+  }
+  
+  int direction;
+  int speed;
+  unsigned long remainingMillis;
+  bool isTurn;
+  // A calibration spin only makes sense with the calibration behind it, which a reset loses
+  if (!turnCalibrator.isActive() &&
+      movementController.getResumableMotion(&direction, &speed, &remainingMillis, &isTurn)) {
+    state->flags |= STATE_MOTION;
+    state->direction = direction;
+    state->motionSpeed = speed;
+    state->motionRemainingMillis = remainingMillis;
+    state->motionIsTurn = isTurn;
+  }
+  
+  uint16_t sequences[CHECKPOINT_SEQUENCES];
+  state->sequenceCount = commandProcessor.getRecentSequences(sequences);
+  memcpy(state->sequences, sequences, sizeof(sequences));
+}
+
+void VehicleSystem::restoreState() {
+  const RuntimeState& state = stateCheckpoint.getRecovered();
+  
+  movementController.setSpeed(state.speed);
+  sensorManager.setAvoidanceEnabled(state.flags & STATE_AVOIDANCE);
+  speedGovernor.setEnabled(state.flags & STATE_GOVERNOR);
+  intentFilter.setEnabled(state.flags & STATE_INTENT);
+  if (state.flags & STATE_SETPOINTS) {
+    movementController.enableSetpoints(state.setpointTimeout);
+  }
+  commandProcessor.restoreSequences(state.sequences, state.sequenceCount);
+  
+  // A latched stop stays latched. A move resumes only after a crash, and only if the last boot
+  // ran long enough to show that the move is not what keeps resetting the car.
+  const char* motion = "none";
+  if (state.flags & STATE_ESTOP) {
+    movementController.emergencyStop();
+    motion = "emergency stop latched";
+  } else if (state.flags & STATE_MOTION) {
+    if (!stateCheckpoint.isCrashReset()) {
+      movementController.stop();
+      motion = "dropped, not a crash";
+    } else if (stateCheckpoint.getUnstableBoots() <= 1) {
+      movementController.resumeMotion(state.direction, state.motionSpeed, state.motionRemainingMillis,
+                                      state.motionIsTurn);
+      motion = "resumed";
+    } else {
+      movementController.stop();
+      motion = "dropped, resetting repeatedly";
+    }
+  }
+  
+  // Two lines, each well inside the sendF buffer
+  MessageManager::sendF("Resumed after %s reset: speed %d, avoidance %s, restored %lu ms after reset",
+                        LoopWatchdog::resetReasonName(stateCheckpoint.getResetReason()), state.speed,
+                        (state.flags & STATE_AVOIDANCE) ? "on" : "off", millis() - stateCheckpoint.getBootMillis());
+  if (state.sequenceCount > 0) {
+    MessageManager::sendF("Resumed motion: %s, last command #%u", motion, state.sequences[state.sequenceCount - 1]);
+  } else {
+    MessageManager::sendF("Resumed motion: %s", motion);
+  }
+}
+
+// Time left before an interval measured from last runs out
+static unsigned long remaining(unsigned long currentTime, unsigned long last, unsigned long interval) {
+  unsigned long elapsed = currentTime - last;
+  return elapsed >= interval ? 0 : interval - elapsed;
+}
+
+unsigned long VehicleSystem::millisUntilNextTask(unsigned long currentTime) const {
+  unsigned long wait = remaining(currentTime, lastHeartbeatTime, HEARTBEAT_INTERVAL);
+  
+  unsigned long ledWait = ledManager.millisUntilChange(currentTime, true);
+  if (ledWait != ULONG_MAX) {
+    // A blink step also waits for the 20 ms LED tick
+    ledWait = max(ledWait, remaining(currentTime, lastLedUpdate, 20));
+    wait = min(wait, ledWait);
+  }
+  
+  wait = min(wait, missionVm.millisUntilNextStep(currentTime));
+  wait = min(wait, sensorManager.millisUntilNextProbe(currentTime));
+  
+  if (movementController.canStartAvoidance()) {
+    wait = min(wait, sensorManager.millisUntilNextSample(currentTime));
+  }
+  return wait;
+}
+
+SensorManager& VehicleSystem::getSensorManager() {
+  return sensorManager;
+}
+
+MovementController& VehicleSystem::getMovementController() {
+  return movementController;
+}
\ No newline at end of file